@@ -113,8 +113,12 @@ class LiveCache {
 
     int32_t getLineSize() const { return lineSize; }
 
-    void      read(uint64_t addr);
-    void      write(uint64_t addr);
+    uint64_t getAccesses() const { return nReadHit + nReadMiss + nWriteHit + nWriteMiss; }
+    uint64_t getMisses() const { return nReadMiss + nWriteMiss; }
+
+    bool      read(uint64_t addr);  // returns true on a hit
+    bool      write(uint64_t addr);
+    void      invalidate(uint64_t addr);  // drops the line, if present
     uint64_t *traverse(int &n_entries);
 };
 
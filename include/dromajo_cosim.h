@@ -67,6 +67,28 @@ int dromajo_cosim_step(dromajo_cosim_state_t *state, int hartid, uint64_t dut_pc
  * otherwise.
  */
 void dromajo_cosim_raise_trap(dromajo_cosim_state_t *state, int hartid, int64_t cause);
+
+/*
+ * dromajo_cosim_register_csr --
+ *
+ * Gives the CSR csr of every hart the behaviour of the callbacks, which
+ * return -1 for an illegal access and 0 otherwise.  write is NULL for a
+ * read-only CSR.  The usual privilege checks implied by the CSR number
+ * are done first, and standard CSRs can be replaced the same way.
+ */
+typedef int (*dromajo_cosim_csr_read_t)(void *opaque, int hartid, uint32_t csr, uint64_t *pval);
+typedef int (*dromajo_cosim_csr_write_t)(void *opaque, int hartid, uint32_t csr, uint64_t val);
+
+void dromajo_cosim_register_csr(dromajo_cosim_state_t *state, uint32_t csr, dromajo_cosim_csr_read_t read,
+                                dromajo_cosim_csr_write_t write, void *opaque);
+
+/*
+ * dromajo_cosim_watch --
+ *
+ * Logs every write of the model's harts to the physical range
+ * [paddr, paddr + size) with the hart, PC, instruction count and value.
+ */
+void dromajo_cosim_watch(dromajo_cosim_state_t *state, uint64_t paddr, uint64_t size);
 #ifdef __cplusplus
 }  // extern C
 #endif
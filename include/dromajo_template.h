@@ -211,14 +211,25 @@ static inline uintx_t glue(mulhsu, XLEN)(intx_t a, uintx_t b) {
 #define NEXT_INSN  \
     code_ptr += 4; \
     break
-#define JUMP_INSN(kind)            \
-    do {                           \
-        code_ptr          = NULL;  \
-        code_end          = NULL;  \
-        code_to_pc_addend = s->pc; \
-        s->info           = kind;  \
-        s->next_addr      = s->pc; \
-        goto jump_insn;            \
+#define JUMP_INSN(kind)                   \
+    do {                                  \
+        RISCVCTFInfo ctf_kind = (kind);   \
+        CTF_EVENT(ctf_kind, true, s->pc); \
+        code_ptr          = NULL;         \
+        code_end          = NULL;         \
+        code_to_pc_addend = s->pc;        \
+        s->info           = ctf_kind;     \
+        s->next_addr      = s->pc;        \
+        goto jump_insn;                   \
+    } while (0)
+
+/* Control transfer event for the branch predictor (and through it the
+ * timing model); not-taken conditional branches are reported as
+ * ctf_taken_branch with taken == false. */
+#define CTF_EVENT(kind, taken, target)                                    \
+    do {                                                                  \
+        if (unlikely(s->bpred) && (kind) != ctf_nop)                      \
+            bpred_ctf_event(s, GET_PC(), insn, (kind), taken, target);    \
     } while (0)
 
 #define chkfp32 glue(chkfp32, XLEN)
@@ -250,6 +261,7 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
     target_ulong code_to_pc_addend;
     uint64_t     insn_counter_addend;
     uint64_t     insn_counter_start = s->insn_counter;
+    target_ulong pc_start           = s->pc;
 #if FLEN > 0
     uint32_t rs3;
     int32_t  rm;
@@ -258,6 +270,7 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
     s->most_recently_written_reg    = -1;
     s->most_recently_written_fp_reg = -1;
     s->info                         = ctf_nop;
+    s->took_interrupt               = FALSE;
 
     if (n_cycles == 0)
         return 0;
@@ -287,27 +300,19 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
 
         ++insn_executed;
 
-        /* Handled any breakpoint triggers in order (note, we
-         * precompute the mask and pattern to lower some of the
-         * cost). */
-        target_ulong t_mctl  = MCONTROL_EXECUTE | (MCONTROL_U << s->priv);
-        target_ulong t_mask  = ((target_ulong)0xF << 60) | t_mctl;
-        target_ulong t_match = ((target_ulong)0x2 << 60) | t_mctl;
+        if (unlikely(code_ptr >= code_end)) {
+            uint32_t     tlb_idx;
+            uint16_t     insn_high;
+            target_ulong addr;
 
-        for (int i = 0; i < MAX_TRIGGERS; ++i)
-            if ((s->tdata1[i] & t_mask) != t_match && s->tdata2[i] == s->pc) {
+            /* execute triggers, the fast path ends where they match */
+            if (unlikely(s->trig_exec) && trigger_fire(s, s->trig_exec, s->pc, 1)) {
                 --insn_counter_addend;
-                s->pending_exception = CAUSE_BREAKPOINT;
-                s->pending_tval      = 0;
+                s->trig_fired = false;
                 raise_exception2(s, s->pending_exception, s->pending_tval);
                 goto done_interp;
             }
 
-        if (unlikely(code_ptr >= code_end)) {
-            uint32_t     tlb_idx;
-            uint16_t     insn_high;
-            target_ulong addr;
-
             /* check pending interrupts */
             if (unlikely(((s->mip & s->mie) != 0) && (s->machine->common.pending_interrupt != -1 || !s->machine->common.cosim))) {
                 if (raise_interrupt(s)) {
@@ -315,15 +320,30 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
                 }
             }
 
-            addr    = s->pc;
+            addr = s->pc;
+            if (unlikely(s->machine->idioms)) {
+                uint64_t n = dbcache_idiom(s, addr);
+                if (n) {
+                    insn_counter_addend += n;
+                    insn_executed += n - 1;
+                    goto the_end;
+                }
+            }
+
             tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
-            if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
+            if (s->machine->dbcache && dbcache_fetch(s, addr, &insn)) {
+                /* code_ptr is left alone, the next fetch comes back here */
+            } else if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
                 /* TLB match */
                 uintptr_t mem_addend;
                 mem_addend        = s->tlb_code[tlb_idx].mem_addend;
                 code_ptr          = (uint8_t *)(mem_addend + (uintptr_t)addr);
                 code_end          = (uint8_t *)(mem_addend + (uintptr_t)((addr & ~PG_MASK) + PG_MASK - 1));
                 code_to_pc_addend = addr - (uintptr_t)code_ptr;
+                if (unlikely(s->trig_exec)) {
+                    target_ulong limit = trigger_exec_limit(s, addr, (addr & ~PG_MASK) + PG_MASK - 1);
+                    code_end           = (uint8_t *)(mem_addend + (uintptr_t)limit);
+                }
                 if (unlikely(code_ptr >= code_end)) {
                     /* instruction is potentially half way between two
                        pages ? */
@@ -347,6 +367,10 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
             insn = get_insn32(code_ptr);
         }
 
+        if (unlikely(s->timing))
+            riscv_timing_insn(s->timing, s->pc, insn);
+        track_tlbmodel(s, s->pc, ACCESS_CODE);
+
         opcode = insn & 0x7f;
         rd     = (insn >> 7) & 0x1f;
         rs1    = (insn >> 15) & 0x1f;
@@ -580,6 +604,7 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
                         s->pc = (intx_t)(GET_PC() + imm);
                         JUMP_INSN(ctf_taken_branch);
                     }
+                    CTF_EVENT(ctf_taken_branch, false, GET_PC() + 2);
                     break;
                 case 7: /* c.bnez */
                     rs1 = ((insn >> 7) & 7) | 8;
@@ -590,6 +615,7 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
                         s->pc = (intx_t)(GET_PC() + imm);
                         JUMP_INSN(ctf_taken_branch);
                     }
+                    CTF_EVENT(ctf_taken_branch, false, GET_PC() + 2);
                     break;
                 default: goto illegal_insn;
             }
@@ -812,6 +838,7 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
                     s->pc = (intx_t)(GET_PC() + imm);
                     JUMP_INSN(ctf_taken_branch);
                 }
+                CTF_EVENT(ctf_taken_branch, false, GET_PC() + 4);
                 NEXT_INSN;
             case 0x03: /* load */
                 funct3 = (insn >> 12) & 7;
@@ -1116,6 +1143,7 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
                             s->mcycle += delta;
                             s->minstret += delta;
                         }
+                        timing_flush_stall(s);
                         if (csr_read(s, &val2, imm, TRUE))
                             goto illegal_insn;
                         val2 = (intx_t)val2;
@@ -1144,6 +1172,7 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
                             s->mcycle += delta;
                             s->minstret += delta;
                         }
+                        timing_flush_stall(s);
                         if (csr_read(s, &val2, imm, (rs1 != 0)))
                             goto illegal_insn;
                         val2 = (intx_t)val2;
@@ -1245,8 +1274,8 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
                                 }
                                 break;
                             default:
-                                if ((imm >> 5) == 0x09) {
-                                    /* sfence.vma */
+                                if ((imm >> 5) == 0x09 || (imm >> 5) == 0x0b) {
+                                    /* sfence.vma, sinval.vma (Svinval) */
                                     if (insn & 0x00007f80)
                                         goto illegal_insn;
                                     if (s->priv == PRV_U)
@@ -1258,9 +1287,19 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
                                     } else {
                                         tlb_flush_vaddr(s, read_reg(rs1));
                                     }
+                                    if (unlikely(s->tlbmodel))
+                                        riscv_tlbmodel_flush(s->tlbmodel, rs1 != 0, read_reg(rs1), rs2 != 0, read_reg(rs2));
                                     /* the current code TLB may have been flushed */
                                     s->pc = GET_PC() + 4;
                                     JUMP_INSN(ctf_nop);
+                                } else if ((imm >> 5) == 0x0c && rs2 <= 1) {
+                                    /* sfence.w.inval, sfence.inval.ir: the
+                                       invalidations take effect at once, there
+                                       is nothing to order */
+                                    if (insn & 0x000fff80)
+                                        goto illegal_insn;
+                                    if (s->priv == PRV_U)
+                                        goto illegal_insn;
                                 } else {
                                     goto illegal_insn;
                                 }
@@ -1281,6 +1320,17 @@ int no_inline glue(riscv_cpu_interp, XLEN)(RISCVCPUState *s, int n_cycles) {
                         if (insn != 0x0000100f)
                             goto illegal_insn;
                         break;
+#if XLEN < 128
+                    case 2: /* Zicbom/Zicboz */
+                        if (rd != 0)
+                            goto illegal_insn;
+                        err = target_cbo(s, insn >> 20, read_reg(rs1));
+                        if (err == -2)
+                            goto illegal_insn;
+                        if (err)
+                            goto mmu_exception;
+                        break;
+#endif
 #if XLEN >= 128
                     case 2: /* lq */
                         imm  = (int32_t)insn >> 20;
@@ -1649,12 +1699,13 @@ exception:
     s->pc = GET_PC();
     if (s->pending_exception >= 0) {
         if ((s->pending_exception < CAUSE_USER_ECALL || s->pending_exception > CAUSE_USER_ECALL + 3)
-            && s->pending_exception != CAUSE_BREAKPOINT) {
+            && (s->pending_exception != CAUSE_BREAKPOINT || s->trig_fired)) {
             /* All other causes cancelled the instruction and shouldn't be
              * counted in minstret */
             --insn_counter_addend;
             --insn_executed;
         }
+        s->trig_fired = false;
 
         raise_exception2(s, s->pending_exception, s->pending_tval);
     }
@@ -1671,6 +1722,8 @@ the_end:
         s->mcycle += delta;
         s->minstret += delta;
     }
+    timing_flush_stall(s);
+    bbv_retire(s, pc_start);
 
     return insn_executed;
 }
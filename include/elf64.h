@@ -33,6 +33,8 @@
 
 bool elf64_is_riscv64(const uint8_t *image, size_t image_size);
 bool elf64_find_global(const uint8_t *image, size_t image_size, const char *key, uint64_t *value);
+/* Any defined symbol, local ones included */
+bool elf64_find_symbol(const uint8_t *image, size_t image_size, const char *key, uint64_t *value, uint64_t *size);
 
 uint64_t elf64_get_entrypoint(const uint8_t *image);
 
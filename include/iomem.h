@@ -91,6 +91,8 @@ struct PhysMemoryMap {
     void (*set_ram_addr)(PhysMemoryMap *s, PhysMemoryRange *pr, uint64_t addr, BOOL enabled);
     void *opaque;
     void (*flush_tlb_write_range)(void *opaque, uint8_t *ram_addr, size_t ram_size);
+    /* optional, called after a device wrote to RAM */
+    void (*ram_written)(void *opaque, uint8_t *ram_addr, size_t size);
 };
 
 PhysMemoryMap *                phys_mem_map_init(void);
@@ -64,6 +64,9 @@ struct FBDevice {
 
 #include <stdint.h>
 
+#include "riscv_bpred.h"
+#include "riscv_timing.h"
+#include "riscv_tlbmodel.h"
 #include "virtio.h"
 
 #define MAX_DRIVE_DEVICE 4
@@ -72,13 +75,8 @@ struct FBDevice {
 
 #define VM_CONFIG_VERSION 1
 
-#ifdef SIMPOINT_BB
-extern int simpoint_roi;
-
-//#define SIMPOINT_SIZE 1000000UL      // For Benchmarking Fine Grain
-//#define SIMPOINT_SIZE 10000UL        // For verification
+// Default interval, --simpoint_size sets e.g. 1M for fine grain benchmarking or 10K for verification
 #define SIMPOINT_SIZE 100000000UL  // Traditional 100M simpoint
-#endif
 
 typedef enum {
     VM_FILE_BIOS,
@@ -119,7 +117,7 @@ typedef struct AddressSet {
     uint64_t size;
 } AddressSet;
 
-#ifdef SIMPOINT_BB
+#include <utility>
 #include <vector>
 struct Simpoint {
     Simpoint(uint64_t i, int j) : start(i), id(j) {}
@@ -128,7 +126,19 @@ struct Simpoint {
     uint64_t start;
     int      id;
 };
-#endif
+
+/* Which steps of the --trace window are printed.  Everything is decided
+ * from the hart, privilege and pc before the step, so the others are not
+ * even fetched. */
+struct TraceFilter {
+    std::vector<std::pair<uint64_t, uint64_t>> pcs;   /* [lo, hi) ranges, empty for any pc */
+    uint32_t                                   privs; /* bit per PRV_x */
+    uint32_t                                   harts; /* bit per hart */
+    std::vector<uint64_t>                      on;    /* pcs that start the trace, empty if always on */
+    std::vector<uint64_t>                      off;   /* pcs that stop it */
+    bool                                       active;
+    uint64_t                                   left; /* steps until the window closes, UINT64_MAX for never */
+};
 
 typedef struct {
     char *           cfg_filename;
@@ -190,8 +200,26 @@ typedef struct {
     char *logfile;  // If non-zero, all output goes here, stderr and stdout
 
     bool dump_memories;
+
+    /* Approximate timing model driving mcycle */
+    bool              timing;
+    RISCVTimingParams timing_params;
+
+    /* Branch predictor model, enabled unless type is BPRED_NONE */
+    RISCVBPredParams bpred_params;
+
+    /* Target TLB model */
+    bool                tlbmodel;
+    RISCVTLBModelParams tlbmodel_params;
+
+    /* Fetch through the block cache shared by the harts */
+    bool dbcache;
+    /* Run memset/memcpy loops as bulk copies (implies dbcache) */
+    bool idioms;
 } VirtMachineParams;
 
+typedef struct Replay Replay;
+
 typedef struct VirtMachine {
     /* network */
     EthernetDevice *net;
@@ -201,16 +229,30 @@ typedef struct VirtMachine {
     /* graphics */
     FBDevice *fb_dev;
 
-#ifdef SIMPOINT_BB
+    /* SimPoint: BBV profiling (see riscv_bbv.h) or checkpoint creation.
+     * Both only count instructions inside the region of interest, which
+     * is either the whole run or delimited by writes to CSR 0x8c2.
+     * simpoint_hart >= 0 places the checkpoints at markers of that hart. */
+    bool                  simpoint;
+    bool                  simpoint_roi;
+    uint64_t              simpoint_size;
+    uint64_t              simpoint_ninst;
     uint32_t              simpoint_next;
+    int                   simpoint_hart;
+    int                   simpoint_jobs; /* checkpoints written in the background, 0 for none */
     std::vector<Simpoint> simpoints;
-#endif
 
     char *   snapshot_load_name;
+    bool     snapshot_direct; /* restore without the boot ROM */
+    Replay * replay;          /* console input record/replay, see replay.h */
+    int      current_hart;    /* the hart being stepped */
     char *   snapshot_save_name;
     char *   terminate_event;
     uint64_t maxinsns;
-    uint64_t trace;
+    uint64_t trace;     /* steps before the trace window opens, 0 once open */
+    bool     selfcheck; /* run against a reference, see riscv_selfcheck.h */
+
+    TraceFilter trace_filter;
 
     /* For co-simulation only, they are -1 if nothing is pending. */
     bool cosim;
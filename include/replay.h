@@ -0,0 +1,47 @@
+/*
+ * Record and replay of the nondeterministic inputs
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+
+#include "virtio.h"
+
+typedef struct Replay       Replay;
+typedef struct RISCVMachine RISCVMachine;
+
+/*
+ * Everything else being deterministic (the RTC follows mcycle, block
+ * devices complete synchronously from their image), the host console is
+ * the only input that differs between two runs of the same machine.
+ * Recording logs every console read that returned data with its
+ * position: the index of the read, and the hart and instruction count it
+ * happened at.  Replaying returns the same data at the same reads and
+ * nothing otherwise, without touching the host console, and reports the
+ * first read whose position differs from the log.
+ */
+
+Replay *replay_init(const char *filename, bool record, CharacterDevice *console);
+void    replay_end(Replay *r);
+
+/* The console to give to the machine in place of the host one */
+CharacterDevice *replay_console(Replay *r);
+
+void replay_set_machine(Replay *r, RISCVMachine *m);
+
+#endif
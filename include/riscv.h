@@ -122,13 +122,33 @@
 #define MSTATUS_UXL_MASK ((uint64_t)3 << MSTATUS_UXL_SHIFT)
 #define MSTATUS_SXL_MASK ((uint64_t)3 << MSTATUS_SXL_SHIFT)
 
-// A few of Debug Trigger Match Control bits (there are many more)
-#define MCONTROL_M       (1 << 6)
-#define MCONTROL_S       (1 << 4)
-#define MCONTROL_U       (1 << 3)
-#define MCONTROL_EXECUTE (1 << 2)
-#define MCONTROL_STORE   (1 << 1)
-#define MCONTROL_LOAD    (1 << 0)
+// menvcfg/senvcfg, the cache block operation enables
+#define ENVCFG_CBIE_SHIFT 4
+#define ENVCFG_CBIE       (3 << ENVCFG_CBIE_SHIFT)
+#define ENVCFG_CBCFE      (1 << 6)
+#define ENVCFG_CBZE       (1 << 7)
+#define ENVCFG_PBMTE      (1ULL << 62) /* menvcfg only */
+#define ENVCFG_MASK       (ENVCFG_CBIE | ENVCFG_CBCFE | ENVCFG_CBZE)
+
+// Zicbom/Zicboz cache block size
+#define CBO_BLOCK_SIZE 64
+
+// Debug Trigger Match Control (mcontrol) bits
+#define MCONTROL_HIT         (1 << 20)
+#define MCONTROL_MATCH_SHIFT 7
+#define MCONTROL_MATCH       (15 << MCONTROL_MATCH_SHIFT)
+#define MCONTROL_M           (1 << 6)
+#define MCONTROL_S           (1 << 4)
+#define MCONTROL_U           (1 << 3)
+#define MCONTROL_EXECUTE     (1 << 2)
+#define MCONTROL_STORE       (1 << 1)
+#define MCONTROL_LOAD        (1 << 0)
+
+// mcontrol match values, only address matching is implemented
+#define MCONTROL_MATCH_EQ    0
+#define MCONTROL_MATCH_NAPOT 1
+#define MCONTROL_MATCH_GE    2
+#define MCONTROL_MATCH_LT    3
 
 #define PHYSICAL_ADDR_LEN_DEFAULT 40
 
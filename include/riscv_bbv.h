@@ -0,0 +1,101 @@
+/*
+ * Basic block vector collection for SimPoint
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_BBV_H
+#define RISCV_BBV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * The interpreter reports every basic block exit (any control transfer
+ * that does not fall through, including traps) with the instruction
+ * counter; the block's instructions are accumulated in an open
+ * addressing table keyed by the block start PC.  Blocks get a stable
+ * ID the first time they are seen, and at the end of every interval
+ * the non-zero counts are written in the SimPoint frequency vector
+ * format ("T:id:count :id:count ...").  The output is formatted into a
+ * large buffer and, for .gz/.zst file names, piped through gzip/zstd.
+ *
+ * Instruction counts are not stable across harts or runs with different
+ * timing, so every interval start is also written to a markers file as
+ * (block PC, execution count of that block, instructions into it).  A
+ * BBV created without a file only watches for such markers and flags the
+ * one it reaches, which is how the checkpoints are placed.
+ */
+
+typedef struct RISCVBBVSlot {
+    uint64_t pc; /* block start, ~0 if the slot is empty */
+    uint64_t count;
+    uint64_t execs; /* executions since the start, for the markers */
+    uint32_t id;
+} RISCVBBVSlot;
+
+typedef struct RISCVBBVMarker {
+    uint64_t pc;
+    uint64_t count;  /* the count-th execution of the block at pc */
+    uint64_t offset; /* instructions into that execution */
+    uint64_t seen;
+    int      id;
+} RISCVBBVMarker;
+
+typedef struct RISCVBBV {
+    FILE *   f;
+    bool     f_is_pipe;
+    char *   buf;
+    size_t   buf_len;
+    FILE *   markers;
+    uint64_t interval;
+
+    /* Current block */
+    uint64_t block_pc;
+    uint64_t block_icount;
+    bool     block_in_roi;
+
+    /* Open addressing table, size is a power of 2 */
+    RISCVBBVSlot *table;
+    uint32_t      table_bits;
+    uint32_t      n_blocks;
+
+    /* Slots with a non-zero count in the current interval */
+    uint32_t *touched;
+    uint32_t  n_touched;
+
+    uint64_t interval_insns;
+    uint64_t n_intervals;
+
+    /* Markers being watched for; hit_id is reached at hit_icount */
+    RISCVBBVMarker *watch;
+    int             n_watch;
+    bool            hit_pending;
+    int             hit_id;
+    uint64_t        hit_icount;
+} RISCVBBV;
+
+/* A NULL filename only watches for markers */
+RISCVBBV *riscv_bbv_init(const char *filename, int hartid, uint64_t interval, uint64_t pc, uint64_t icount);
+void      riscv_bbv_end(RISCVBBV *bbv);
+
+void riscv_bbv_watch(RISCVBBV *bbv, uint64_t pc, uint64_t count, uint64_t offset, int id);
+
+/* The current block ended with the instruction counter at icount and
+ * control continues at next_pc; instructions are only accounted while
+ * in_roi is set. */
+void riscv_bbv_block_exit(RISCVBBV *bbv, uint64_t next_pc, uint64_t icount, bool in_roi);
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Branch predictor models
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_BPRED_H
+#define RISCV_BPRED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The predictors are fed by the control-flow events the interpreter
+ * already classifies (RISCVCTFInfo): conditional branches go to the
+ * direction predictor and the BTB, calls and returns use the RAS hints
+ * (ctf_taken_jalr_push/pop/pop_push) and other indirect jumps the BTB.
+ */
+
+typedef enum {
+    BPRED_NONE,
+    BPRED_BIMODAL,
+    BPRED_GSHARE,
+    BPRED_TAGE,
+} RISCVBPredType;
+
+typedef struct RISCVBPredParams {
+    RISCVBPredType type;
+    int            entries;      /* direction predictor (base) counters, power of 2 */
+    int            history;      /* global history bits (gshare) */
+    int            tage_tables;  /* tagged tables (TAGE), at most 8 */
+    int            tage_entries; /* entries per tagged table, power of 2 */
+    int            btb_entries;  /* power of 2, 0 disables the BTB */
+    int            btb_ways;
+    int            ras_entries;
+    int            report;     /* number of worst PCs printed on exit */
+    char *         stats_file; /* if set, per-PC statistics are written to <stats_file>.<hartid> */
+} RISCVBPredParams;
+
+typedef struct RISCVBPred RISCVBPred;
+
+void        riscv_bpred_set_defaults(RISCVBPredParams *p);
+int         riscv_bpred_parse_type(const char *name, RISCVBPredType *type);
+RISCVBPred *riscv_bpred_init(const RISCVBPredParams *p);
+void        riscv_bpred_end(RISCVBPred *bp, int hartid);
+
+/* Feeds one control transfer (info is a RISCVCTFInfo, not-taken
+ * conditional branches use ctf_taken_branch with taken == false) and
+ * returns true if it was mispredicted. */
+bool riscv_bpred_ctf(RISCVBPred *bp, uint64_t pc, uint32_t insn, int info, bool taken, uint64_t target);
+
+#endif
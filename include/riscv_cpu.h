@@ -43,6 +43,13 @@
 #include <stdbool.h>
 
 #include "riscv.h"
+#include "riscv_bbv.h"
+#include "riscv_hash.h"
+#include "riscv_events.h"
+#include "riscv_bpred.h"
+#include "riscv_dbcache.h"
+#include "riscv_timing.h"
+#include "riscv_tlbmodel.h"
 
 #define ROM_SIZE       0x00001000
 #define ROM_BASE_ADDR  0x00010000
@@ -120,12 +127,14 @@ typedef uint128_t mem_uint_t;
 #define PG_SHIFT 12
 #define PG_MASK  ((1 << PG_SHIFT) - 1)
 
-#define ASID_BITS 0
+#ifndef ASID_BITS
+#define ASID_BITS 0  // satp.ASID is read-only zero unless overridden
+#endif
 
 #define SATP_MASK ((15ULL << 60) | (((1ULL << ASID_BITS) - 1) << 44) | ((1ULL << 44) - 1))
 
 #ifndef MAX_TRIGGERS
-#define MAX_TRIGGERS 1  // As of right now, one trigger register
+#define MAX_TRIGGERS 4  // mcontrol triggers, at most 32
 #endif
 
 /* HPM masks
@@ -191,6 +200,7 @@ typedef struct RISCVCPUState {
     BOOL         terminate_simulation;
     int          pending_exception; /* used during MMU exception handling */
     target_ulong pending_tval;
+    BOOL         took_interrupt; /* the last step took an interrupt */
 
     /* CSRs */
     target_ulong mstatus;
@@ -210,11 +220,21 @@ typedef struct RISCVCPUState {
     uint32_t     mideleg;
     uint32_t     mcounteren;
     uint32_t     mcountinhibit;
+    uint64_t     menvcfg;
     uint32_t     tselect;
     target_ulong tdata1[MAX_TRIGGERS];
     target_ulong tdata2[MAX_TRIGGERS];
     target_ulong tdata3[MAX_TRIGGERS];
 
+    /* Armed triggers (bit i for trigger i) by kind and the address
+       range each one matches, see triggers_update */
+    uint32_t     trig_exec;
+    uint32_t     trig_load;
+    uint32_t     trig_store;
+    target_ulong trig_lo[MAX_TRIGGERS];
+    target_ulong trig_hi[MAX_TRIGGERS];
+    bool         trig_fired; /* the pending breakpoint is a trigger's */
+
     target_ulong mhpmevent[32];
 
     uint64_t csr_pmpcfg[4];  // But only 0 and 2 are valid
@@ -234,6 +254,7 @@ typedef struct RISCVCPUState {
     target_ulong stval;
     uint64_t     satp; /* currently 64 bit physical addresses max */
     uint32_t     scounteren;
+    uint64_t     senvcfg;
 
     target_ulong dcsr;      // Debug CSR 0x7b0 (debug spec only)
     target_ulong dpc;       // Debug DPC 0x7b1 (debug spec only)
@@ -254,6 +275,12 @@ typedef struct RISCVCPUState {
     target_ulong tlb_write_paddr_addend[TLB_SIZE];
     target_ulong tlb_code_paddr_addend[TLB_SIZE];
 #endif
+    /* Leaf page shift of the entries filled from 2M/1G pages, 0 for the
+     * others, and whether there are any; see tlb_flush_vaddr */
+    uint8_t tlb_read_shift[TLB_SIZE];
+    uint8_t tlb_write_shift[TLB_SIZE];
+    uint8_t tlb_code_shift[TLB_SIZE];
+    bool    tlb_superpages;
 
     // Benchmark return value
     uint64_t benchmark_exit_code;
@@ -267,10 +294,81 @@ typedef struct RISCVCPUState {
 
     bool ignore_sbi_shutdown;
 
+    /* Approximate timing model, NULL unless enabled */
+    RISCVTiming *timing;
+
+    /* Branch predictor model, NULL unless enabled (always with timing) */
+    RISCVBPred *bpred;
+
+    /* Target TLB model, NULL unless enabled */
+    RISCVTLBModel *tlbmodel;
+
+    /* Basic block vectors for SimPoint, NULL unless enabled */
+    RISCVBBV *bbv;
+
+    /* Rolling hash of the committed state, NULL unless enabled */
+    RISCVHash *hash;
+
+    /* Scheduled events (riscv_events.h), next_event is UINT64_MAX without any */
+    RISCVEventQueue *events;
+    uint64_t         next_event;
+
+    /* Bytes written since the last --selfcheck comparison, see
+     * riscv_selfcheck.h */
+    uint64_t selfcheck_wsum;
+    uint64_t selfcheck_wbytes;
+
+    /* Block being fetched from the machine's block cache, it starts at
+     * dbc_start and the pc of insn[dbc_idx] is dbc_pc */
+    RISCVCodeBlock dbc_block;
+    uint32_t       dbc_idx;
+    target_ulong   dbc_pc;
+    target_ulong   dbc_start;
+
     /* Extension state, not used by Dromajo itself */
     void *ext_cpu_state;
 } RISCVCPUState;
 
+/*
+ * CSR descriptors, the machine has one per CSR number.  The read-only and
+ * privilege checks implied by the number are always done; the flags add
+ * the checks and side effects of the individual CSRs.  Handlers return -1
+ * for an illegal access and writes also -2 if they raised an exception,
+ * 2 if the TLBs were flushed or 1 to end the current block.
+ */
+#define CSR_FS        (1 << 0) /* illegal while mstatus.FS is off */
+#define CSR_COUNTER   (1 << 1) /* subject to [ms]counteren */
+#define CSR_DEBUG     (1 << 2) /* only in debug mode */
+#define CSR_TVM       (1 << 3) /* illegal in S-mode when mstatus.TVM is set */
+#define CSR_FLUSH_TLB (1 << 4) /* writes flush the TLBs */
+
+typedef int (*RISCVCSRRead)(RISCVCPUState *s, uint32_t csr, target_ulong *pval);
+typedef int (*RISCVCSRWrite)(RISCVCPUState *s, uint32_t csr, target_ulong val);
+
+typedef struct RISCVCSRDesc {
+    RISCVCSRRead  read; /* NULL if not implemented, the machine hooks get it */
+    RISCVCSRWrite write; /* NULL if read-only */
+    uint32_t      flags;
+    void *        opaque; /* for the handlers */
+} RISCVCSRDesc;
+
+/* Registers the standard CSRs */
+void riscv_csr_init(RISCVMachine *m);
+/* Replaces the handlers of csr, also for the standard CSRs; read NULL
+ * removes it.  opaque is left in the descriptor for the handlers. */
+void riscv_csr_register(RISCVMachine *m, uint32_t csr, RISCVCSRRead read, RISCVCSRWrite write, uint32_t flags,
+                        void *opaque);
+
+/* Physical address range whose writes are logged */
+typedef struct RISCVWatch {
+    uint64_t lo, hi; /* inclusive */
+} RISCVWatch;
+
+/* Logs every CPU write to [paddr, paddr + size) to dromajo_stderr with the
+ * hart, PC, instruction count and value.  Watched pages are kept out of
+ * the write TLBs, the other pages run at full speed. */
+void riscv_watch_add(RISCVMachine *m, uint64_t paddr, uint64_t size);
+
 RISCVCPUState *riscv_cpu_init(RISCVMachine *machine, int hartid);
 void           riscv_cpu_end(RISCVCPUState *s);
 int            riscv_cpu_interp(RISCVCPUState *s, int n_cycles);
@@ -305,7 +403,9 @@ int riscv_benchmark_exit_code(RISCVCPUState *s);
 
 #include "riscv_machine.h"
 void riscv_cpu_serialize(RISCVCPUState *s, const char *dump_name, const uint64_t clint_base_addr);
-void riscv_cpu_deserialize(RISCVCPUState *s, const char *dump_name);
+/* direct loads the registers from the .re_regs files instead of restoring
+ * them by running the .bootram ROM */
+void riscv_cpu_deserialize(RISCVCPUState *s, const char *dump_name, bool direct);
 
 int riscv_cpu_read_memory(RISCVCPUState *s, mem_uint_t *pval, target_ulong addr, int size_log2);
 int riscv_cpu_write_memory(RISCVCPUState *s, target_ulong addr, mem_uint_t val, int size_log2);
@@ -0,0 +1,113 @@
+/*
+ * Block cache of instruction words shared by all harts
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_DBCACHE_H
+#define RISCV_DBCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A block is the straight-line run of instructions starting at a
+ * physical address, up to and including the first control transfer
+ * (or system/fence.i instruction), never crossing a page.  Blocks depend
+ * only on physical memory and a few mode bits, so a single machine-wide
+ * cache serves every hart running the same kernel or library code.
+ *
+ * Blocks hold the raw instruction words, which the interpreter decodes
+ * as usual: fetching from a block only saves the TLB and memory lookups
+ * of the regular fetch path.  The cache exists to find the idioms below
+ * once per block rather than once per instruction.
+ *
+ * The table is direct mapped and every slot is guarded by a sequence
+ * counter: lookups are lock-free copies that retry while a slot is being
+ * written, and a writer that finds a slot busy simply drops its block.
+ * Blocks are never invalidated as a whole: fence.i has nothing to do, as
+ * every write to RAM, by the harts or by the devices, is tracked below.
+ *
+ * Self-modifying code is tracked per physical RAM page.  Every page has
+ * a word whose low bit says that blocks were built from it and whose
+ * upper bits count the invalidations.  Blocks remember the word they
+ * were built under, and a write to a code page (see riscv_dbcache_write)
+ * bumps it, which makes exactly the blocks of that page stale.  The CPU
+ * never maps code pages in its tlb_write, so only the slow write paths
+ * need to check, and data pages cost nothing.
+ *
+ * Blocks that are a whole memset or memcpy style loop, a unit stride
+ * store of x0 or a load/store pair with the pointers bumped by the access
+ * size and a bne/bltu back to the block start, are recognized when built
+ * so that the CPU can run their iterations as bulk host operations.
+ */
+
+#define DBCACHE_MAX_INSNS 16
+
+typedef enum {
+    DBCACHE_IDIOM_NONE,
+    DBCACHE_IDIOM_ZERO, /* s{b,h,w,d} x0, 0(dst) */
+    DBCACHE_IDIOM_COPY, /* l* tmp, 0(src); s* tmp, 0(dst) */
+} RISCVIdiomKind;
+
+typedef struct RISCVBlockIdiom {
+    uint8_t kind;        /* RISCVIdiomKind */
+    uint8_t width;       /* bytes per iteration, both pointers advance by it */
+    uint8_t dst, src, tmp, end;
+    uint8_t cmp;         /* dst or src, compared with end after the bump */
+    uint8_t load_funct3; /* of the load, for the value left in tmp */
+    bool    bltu;        /* loop while cmp < end, otherwise while cmp != end */
+} RISCVBlockIdiom;
+
+typedef struct RISCVCodeBlock {
+    uint64_t        paddr; /* first instruction */
+    uint32_t        mode;  /* DBCACHE_MODE() at build time */
+    const uint32_t *page;     /* code page word */
+    uint32_t        page_tag; /* value of *page the block is valid for */
+    uint32_t        n_insns;
+    uint32_t        insn[DBCACHE_MAX_INSNS]; /* compressed instructions in the low 16 bits */
+    uint32_t        size;                    /* bytes */
+    RISCVBlockIdiom idiom;
+} RISCVCodeBlock;
+
+#define DBCACHE_MODE(priv, rvc) ((uint32_t)(priv) | ((rvc) ? 4 : 0))
+
+typedef struct RISCVDBCache  RISCVDBCache;
+typedef struct PhysMemoryMap PhysMemoryMap;
+
+/* Code pages are tracked for the RAM ranges of mem_map */
+RISCVDBCache *riscv_dbcache_init(int bits, PhysMemoryMap *mem_map);
+void          riscv_dbcache_end(RISCVDBCache *c);
+
+/* Copies the valid block for (paddr, mode) into *b */
+bool riscv_dbcache_lookup(RISCVDBCache *c, uint64_t paddr, uint32_t mode, RISCVCodeBlock *b);
+
+/* Copies the block at ptr, the host address of paddr, into *b and
+ * publishes it; returns false if not even one instruction fits.
+ * *new_code_page is set when this made the page a code page, in which
+ * case the write TLBs mapping it must be flushed. */
+bool riscv_dbcache_build(RISCVDBCache *c, const uint8_t *ptr, uint64_t paddr, uint32_t mode, RISCVCodeBlock *b,
+                         bool *new_code_page);
+
+/* Still valid as far as writes to its page go */
+static inline bool riscv_dbcache_block_valid(const RISCVCodeBlock *b) {
+    return __atomic_load_n(b->page, __ATOMIC_ACQUIRE) == b->page_tag;
+}
+
+/* Must be called after [ptr, ptr + size) of RAM was written; returns true
+ * if that hit a code page (the page is no longer one afterwards) */
+bool riscv_dbcache_write(RISCVDBCache *c, const uint8_t *ptr, size_t size);
+
+#endif
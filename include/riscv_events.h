@@ -0,0 +1,54 @@
+/*
+ * Scheduled interrupt and device events
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_EVENTS_H
+#define RISCV_EVENTS_H
+
+#include <stdint.h>
+
+/*
+ * Events are queued per hart, ordered by instruction count, and fire
+ * before the hart executes the instruction that would take its
+ * instruction counter past that count.  The hart only compares its
+ * counter with next_event, the count of the earliest queued event, so an
+ * empty queue costs nothing.
+ *
+ * The schedule file has one event per line, "#" starts a comment:
+ *
+ *   <hart> <insn_counter> mip <mask>        set mip bits
+ *   <hart> <insn_counter> mip_clear <mask>  clear mip bits
+ *   <hart> <insn_counter> irq <n> <level>   drive PLIC interrupt source n
+ */
+
+typedef enum {
+    RISCV_EVENT_MIP_SET,
+    RISCV_EVENT_MIP_CLEAR,
+    RISCV_EVENT_IRQ,
+} RISCVEventKind;
+
+typedef struct RISCVCPUState   RISCVCPUState;
+typedef struct RISCVMachine    RISCVMachine;
+typedef struct RISCVEventQueue RISCVEventQueue;
+
+void riscv_events_schedule(RISCVCPUState *s, uint64_t icount, RISCVEventKind kind, uint32_t value, int level);
+int  riscv_events_load(RISCVMachine *m, const char *filename);
+
+/* Fires the events due at the current instruction count */
+void riscv_events_fire(RISCVCPUState *s);
+void riscv_events_end(RISCVCPUState *s);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Rolling hashes of the committed architectural state
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_HASH_H
+#define RISCV_HASH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Every committed instruction (one that did not raise an exception) is
+ * folded into a 64-bit FNV-1a style hash as three words: its pc, the
+ * register it wrote (n for xn, 32 + n for fn, 0 if none) and the value
+ * written (0 if none):
+ *
+ *     for w in (pc, rd, wdata): hash = (hash ^ w) * RISCV_HASH_PRIME
+ *
+ * starting from RISCV_HASH_INIT.  The hash is never reset, so two runs
+ * that diverge differ in every later hash.  After every `interval`
+ * commits, and at the end, a line "<commits> <hash>" is written, with
+ * the hash in hex; a DUT computing the same stream can be compared with
+ * dromajo_hashcmp.
+ */
+
+#define RISCV_HASH_INIT  0xcbf29ce484222325ULL
+#define RISCV_HASH_PRIME 0x100000001b3ULL
+
+typedef struct RISCVHash {
+    FILE *   f;
+    uint64_t interval;
+    uint64_t hash;
+    uint64_t count; /* commits */
+} RISCVHash;
+
+RISCVHash *riscv_hash_init(const char *filename, int hartid, uint64_t interval);
+void       riscv_hash_end(RISCVHash *h);
+
+void riscv_hash_emit(RISCVHash *h);
+
+static inline void riscv_hash_commit(RISCVHash *h, uint64_t pc, uint64_t rd, uint64_t wdata) {
+    uint64_t hash = h->hash;
+    hash          = (hash ^ pc) * RISCV_HASH_PRIME;
+    hash          = (hash ^ rd) * RISCV_HASH_PRIME;
+    hash          = (hash ^ wdata) * RISCV_HASH_PRIME;
+    h->hash       = hash;
+    if (++h->count % h->interval == 0)
+        riscv_hash_emit(h);
+}
+
+#endif
@@ -42,6 +42,9 @@
 
 #include "machine.h"
 #include "riscv_cpu.h"
+#include "riscv_procstats.h"
+#include "riscv_selfcheck.h"
+#include "riscv_telemetry.h"
 #include "virtio.h"
 
 #ifdef LIVECACHE
@@ -52,7 +55,8 @@
 
 /* Hooks */
 typedef struct RISCVMachineHooks {
-    /* Returns -1 if invalid CSR, 0 if OK. */
+    /* For the CSRs without a descriptor (see riscv_csr_register).
+       Returns -1 if invalid CSR, 0 if OK. */
     int (*csr_read)(RISCVCPUState *s, uint32_t csr, uint64_t *pval);
     int (*csr_write)(RISCVCPUState *s, uint32_t csr, uint64_t val);
 } RISCVMachineHooks;
@@ -60,12 +64,17 @@ typedef struct RISCVMachineHooks {
 struct RISCVMachine {
     VirtMachine       common;
     RISCVMachineHooks hooks;
+    RISCVCSRDesc      csrs[4096];
     PhysMemoryMap *   mem_map;
 #ifdef LIVECACHE
     LiveCache *llc;
 #endif
     RISCVCPUState *cpu_state[MAX_CPUS];
     int            ncpus;
+
+    /* Block cache shared by the harts, NULL unless enabled */
+    RISCVDBCache *dbcache;
+    bool          idioms;
     uint64_t       ram_size;
     uint64_t       ram_base_addr;
     /* PLIC */
@@ -81,6 +90,23 @@ struct RISCVMachine {
 
     int virtio_count;
 
+    /* Physical ranges whose writes are logged, see riscv_watch_add */
+    RISCVWatch *watch;
+    int         n_watch;
+
+    /* Lockstep check of the accelerated tiers, NULL unless running; all
+     * the writes take the slow paths then */
+    RISCVSelfCheck *selfcheck;
+
+    /* Instructions by process and system call, NULL unless enabled */
+    RISCVProcStats *procstats;
+
+    /* Shared memory page of the monitors, NULL unless enabled */
+    RISCVTelemetry *telemetry;
+
+    /* Steps so far, the console input is polled every CONSOLE_POLL_STEPS */
+    uint64_t console_steps;
+
     /* MMIO range (for co-simulation only) */
     uint64_t    mmio_start;
     uint64_t    mmio_end;
@@ -0,0 +1,59 @@
+/*
+ * Per-process and per-syscall instruction accounting for Linux guests
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_PROCSTATS_H
+#define RISCV_PROCSTATS_H
+
+#include <stdint.h>
+
+/*
+ * A process is an address space, the satp value (mode, ASID and root
+ * page table) it runs under.  Linux runs the kernel under the satp of
+ * the current process, so the instructions of each process are split by
+ * privilege level: user code, the kernel working for it, and the SBI.
+ * Nothing is done per instruction: the instruction counter is sampled
+ * whenever a hart changes privilege or satp.
+ *
+ * A U-mode ecall starts a system call, numbered by a7, that ends when
+ * the same hart next returns to U-mode under the same satp.  Its
+ * duration is in instructions of that hart, blocking included, so other
+ * processes scheduled meanwhile count as well.  A call that resumes on
+ * another hart is not counted.
+ *
+ * Both tables are written for every interval of hart 0 instructions and,
+ * for the whole run, at the end.
+ */
+
+typedef struct RISCVCPUState  RISCVCPUState;
+typedef struct RISCVMachine   RISCVMachine;
+typedef struct RISCVProcStats RISCVProcStats;
+
+/* Accounts from the current state of the harts, so it must come after a
+ * checkpoint is loaded; interval 0 only writes the tables of the whole run */
+RISCVProcStats *riscv_procstats_init(RISCVMachine *m, const char *filename, uint64_t interval);
+void            riscv_procstats_end(RISCVProcStats *p);
+
+/* s is about to run at priv under satp */
+void riscv_procstats_switch(RISCVCPUState *s, int priv, uint64_t satp);
+
+/* s raised a U-mode ecall */
+void riscv_procstats_ecall(RISCVCPUState *s);
+
+/* After every step of hart 0, writes the tables at interval ends */
+void riscv_procstats_step(RISCVProcStats *p);
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * Lockstep self-check of the accelerated execution tiers
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_SELFCHECK_H
+#define RISCV_SELFCHECK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * riscv_selfcheck_start forks the machine.  The copy-on-write child is
+ * the reference: it runs the plain interpreter, without the block
+ * cache and the idioms, and its output is discarded.  The parent goes on
+ * with the accelerated tiers and sends every step it takes (hart and
+ * instruction count) through a ring in shared memory, so that the child
+ * steps the harts in the same order; a parent step that retired a whole
+ * loop is as many plain steps in the child.
+ *
+ * At the end of every block (a step that does not fall through to the
+ * next instruction) the parent also sends the hart's pc, privilege,
+ * registers, main CSRs and a sum of the bytes it wrote during the block,
+ * which the child compares with its own.  Writes are summed per byte and
+ * independently of their order, so a bulk copy matches the stores of the
+ * loop it replaces.  The child reports the first mismatch and exits,
+ * which stops the parent.
+ *
+ * Console input is disabled in both processes: nothing else differs
+ * between two runs of the same machine (see replay.h).
+ */
+
+typedef struct RISCVMachine   RISCVMachine;
+typedef struct RISCVSelfCheck RISCVSelfCheck;
+
+/* Forks the reference, only returns in the parent (NULL if that failed) */
+RISCVSelfCheck *riscv_selfcheck_start(RISCVMachine *m);
+
+/* After every step of hartid; false once the reference found a mismatch */
+bool riscv_selfcheck_step(RISCVSelfCheck *c, int hartid);
+
+/* Compares the final states and waits for the reference; false if the
+ * tiers diverged */
+bool riscv_selfcheck_end(RISCVSelfCheck *c);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * Live statistics in shared memory for external monitors
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_TELEMETRY_H
+#define RISCV_TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The page is a POSIX shared memory object (/dev/shm on Linux) that
+ * dromajo rewrites every interval of hart 0 steps and once more at the
+ * end; it is only read by the monitors, see dromajo_top.  Nothing is
+ * written to a file and nothing is done per instruction: the privilege
+ * split and the traps are counted when a hart changes privilege level.
+ *
+ * The page is a seqlock: seq is odd while dromajo updates the page, and
+ * a reader retries a copy that did not start and end with the same even
+ * seq (riscv_telemetry_read).  The layout only grows at the end;
+ * anything else bumps the version.
+ */
+
+#define RISCV_TELEMETRY_MAGIC     0x4a4d5244 /* "DRMJ" */
+#define RISCV_TELEMETRY_VERSION   1
+#define RISCV_TELEMETRY_MAX_HARTS 8
+
+typedef struct RISCVTelemetryHart {
+    uint64_t insns;
+    uint64_t insns_by_priv[4]; /* by privilege level, [2] unused */
+    uint64_t exceptions;
+    uint64_t interrupts;
+    uint64_t pc;
+    uint64_t priv;
+
+    /* --timing caches, 0 without */
+    uint64_t icache_accesses;
+    uint64_t icache_misses;
+    uint64_t dcache_accesses;
+    uint64_t dcache_misses;
+} RISCVTelemetryHart;
+
+typedef struct RISCVTelemetryPage {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; /* of the page */
+    uint32_t seq;
+    uint32_t pid;
+    uint32_t running; /* 0 once the run is over */
+    uint32_t nharts;
+    uint32_t pad;
+
+    uint64_t updates;
+    uint64_t start_ns;  /* CLOCK_MONOTONIC of the start */
+    uint64_t update_ns; /* and of this update */
+    double   mips;      /* all the harts, since the previous update */
+
+    int64_t  simpoint;        /* id of the next checkpoint, -1 for none */
+    uint64_t simpoints_done;  /* checkpoints written */
+    uint64_t simpoints_total; /* checkpoints of --simpoint */
+
+    /* the machine-wide LiveCache, 0 unless built with LIVECACHE */
+    uint64_t llc_accesses;
+    uint64_t llc_misses;
+
+    RISCVTelemetryHart harts[RISCV_TELEMETRY_MAX_HARTS];
+} RISCVTelemetryPage;
+
+/* Copies a consistent page; false if it is being written, to try again */
+static inline bool riscv_telemetry_read(const RISCVTelemetryPage *page, RISCVTelemetryPage *copy) {
+    uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+        return false;
+    memcpy(copy, page, sizeof *copy);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq;
+}
+
+typedef struct RISCVCPUState  RISCVCPUState;
+typedef struct RISCVMachine   RISCVMachine;
+typedef struct RISCVTelemetry RISCVTelemetry;
+
+/* Creates the shared memory object name, "/name" if it has no slash */
+RISCVTelemetry *riscv_telemetry_init(RISCVMachine *m, const char *name, uint64_t interval);
+
+/* Publishes the final values and removes the name; mapped pages remain.
+ * Done at exit if the run ends before virt_machine_end. */
+void riscv_telemetry_end(RISCVTelemetry *t);
+
+/* After every round of steps over all the harts */
+void riscv_telemetry_step(RISCVTelemetry *t);
+
+/* s is about to change privilege level */
+void riscv_telemetry_priv(RISCVCPUState *s);
+
+/* s takes a trap */
+void riscv_telemetry_trap(RISCVCPUState *s, uint64_t cause);
+
+#endif
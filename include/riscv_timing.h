@@ -0,0 +1,89 @@
+/*
+ * Approximate timing model
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_TIMING_H
+#define RISCV_TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The timing model is a simple in-order approximation: every retired
+ * instruction costs the latency of its class, and cache misses and
+ * branch mispredictions add a fixed penalty on top.  The extra cycles
+ * (everything beyond one cycle per instruction) are accumulated in
+ * `stall` and folded into mcycle by the interpreter, so rdcycle and
+ * mtime (derived from mcycle) advance with the modelled time.
+ */
+
+typedef enum {
+    TIMING_CLASS_ALU,
+    TIMING_CLASS_MUL,
+    TIMING_CLASS_DIV,
+    TIMING_CLASS_LOAD,
+    TIMING_CLASS_STORE,
+    TIMING_CLASS_AMO,
+    TIMING_CLASS_FP,
+    TIMING_CLASS_FDIV,
+    TIMING_CLASS_BRANCH,
+    TIMING_CLASS_SYSTEM,
+
+    TIMING_CLASS_COUNT,
+} RISCVTimingClass;
+
+typedef struct RISCVTimingParams {
+    int latency[TIMING_CLASS_COUNT];
+    int icache_size;         /* bytes, 0 disables the I-cache model */
+    int dcache_size;         /* bytes, 0 disables the D-cache model */
+    int miss_penalty;        /* cycles added per I/D-cache miss */
+    int mispredict_penalty;  /* cycles added per mispredicted control transfer */
+} RISCVTimingParams;
+
+class LiveCache;
+
+typedef struct RISCVTiming {
+    RISCVTimingParams p;
+    LiveCache *       icache;
+    LiveCache *       dcache;
+    uint64_t          last_fetch_line;
+
+    /* Cycles beyond one per instruction not yet added to mcycle */
+    uint64_t stall;
+
+    /* Statistics */
+    uint64_t n_insn[TIMING_CLASS_COUNT];
+    uint64_t n_cycles;
+    uint64_t n_imiss;
+    uint64_t n_dmiss;
+    uint64_t n_branch;
+    uint64_t n_mispredict;
+} RISCVTiming;
+
+void         riscv_timing_set_defaults(RISCVTimingParams *p);
+RISCVTiming *riscv_timing_init(const RISCVTimingParams *p);
+void         riscv_timing_end(RISCVTiming *t, int hartid);
+void         riscv_timing_insn(RISCVTiming *t, uint64_t pc, uint32_t insn);
+void         riscv_timing_dmem(RISCVTiming *t, uint64_t paddr, bool is_write);
+
+/* Cache block operations: cbo.flush/cbo.inval drop the D-cache line */
+void riscv_timing_dmem_inval(RISCVTiming *t, uint64_t paddr);
+
+/* Called for every control transfer with the verdict of the branch
+ * predictor (see riscv_bpred.h) */
+void riscv_timing_ctf(RISCVTiming *t, bool mispredict);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Target TLB model
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RISCV_TLBMODEL_H
+#define RISCV_TLBMODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Unlike the software TLB (tlb_read/tlb_write/tlb_code), which only
+ * exists to make the interpreter fast, this models the TLBs of a target
+ * core: a set-associative ITLB and DTLB backed by an optional shared L2
+ * TLB.  It is purely observational; every translated access is looked
+ * up and misses are filled from a side-effect free page walk.
+ */
+
+typedef struct RISCVTLBModelParams {
+    int  itlb_entries;
+    int  itlb_ways;
+    int  dtlb_entries;
+    int  dtlb_ways;
+    int  l2tlb_entries; /* 0 disables the L2 TLB */
+    int  l2tlb_ways;
+    bool superpages;    /* entries map 64K/2M/1G pages, otherwise larger pages are split into 4K entries */
+    bool asid;          /* entries are ASID tagged, otherwise satp writes flush the TLBs */
+    bool walk_to_cache; /* page walk PTE reads are sent to the timing model D-cache */
+} RISCVTLBModelParams;
+
+typedef struct RISCVTLBModel RISCVTLBModel;
+
+void           riscv_tlbmodel_set_defaults(RISCVTLBModelParams *p);
+RISCVTLBModel *riscv_tlbmodel_init(const RISCVTLBModelParams *p);
+void           riscv_tlbmodel_end(RISCVTLBModel *tm, int hartid);
+
+/* Returns true if vaddr hits in the ITLB (is_code) or DTLB, or in the L2 TLB */
+bool riscv_tlbmodel_lookup(RISCVTLBModel *tm, bool is_code, uint64_t vaddr, uint32_t asid);
+
+/* Fills the TLBs after a miss; walk_refs is the number of PTEs read */
+void riscv_tlbmodel_fill(RISCVTLBModel *tm, bool is_code, uint64_t vaddr, uint32_t asid, int page_shift, bool global,
+                         int walk_refs);
+
+/* sfence.vma semantics: has_vaddr/has_asid select what is flushed */
+void riscv_tlbmodel_flush(RISCVTLBModel *tm, bool has_vaddr, uint64_t vaddr, bool has_asid, uint32_t asid);
+
+/* satp was written */
+void riscv_tlbmodel_set_satp(RISCVTLBModel *tm);
+
+bool riscv_tlbmodel_walk_to_cache(const RISCVTLBModel *tm);
+
+#endif
@@ -40,6 +40,8 @@
 #ifndef VIRTIO_H
 #define VIRTIO_H
 
+#include <sys/uio.h>
+
 #include "cutils.h"
 #include "iomem.h"
 #include "pci.h"
@@ -106,6 +108,9 @@ typedef struct {
     void *opaque;
     void (*write_data)(void *opaque, const uint8_t *buf, int len);
     int (*read_data)(void *opaque, uint8_t *buf, int len);
+    /* optional: the output of one request at once, straight from guest
+     * memory; write_data is called for every segment otherwise */
+    void (*writev_data)(void *opaque, const struct iovec *iov, int iovcnt);
 } CharacterDevice;
 
 VIRTIODevice *virtio_console_init(VIRTIOBusDef *bus, CharacterDevice *cs);
@@ -113,6 +118,8 @@ BOOL          virtio_console_can_write_data(VIRTIODevice *s);
 int           virtio_console_get_write_len(VIRTIODevice *s);
 int           virtio_console_write_data(VIRTIODevice *s, const uint8_t *buf, int buf_len);
 void          virtio_console_resize_event(VIRTIODevice *s, int width, int height);
+/* Fills the available receive buffers with the console input at hand */
+void virtio_console_poll(VIRTIODevice *s);
 
 /* input device */
 
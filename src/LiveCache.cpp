@@ -91,34 +91,45 @@ LiveCache::~LiveCache() {
     cacheBank->destroy();
 }
 
-void LiveCache::read(uint64_t addr) {
+bool LiveCache::read(uint64_t addr) {
     Line *l = cacheBank->findLine(addr);
     if (l) {
         l->order = maxOrder++;
         nReadHit++;
-        return;
+        return true;
     }
     nReadMiss++;
 
     l        = cacheBank->fillLine(addr);
     l->st    = false;
     l->order = maxOrder++;
+    return false;
 }
 
-void LiveCache::write(uint64_t addr) {
+bool LiveCache::write(uint64_t addr) {
     Line *l = cacheBank->findLine(addr);
     if (l) {
         l->order = maxOrder++;
         l->st    = true;
 
         nWriteHit++;
-        return;
+        return true;
     }
     nWriteMiss++;
 
     l        = cacheBank->fillLine(addr);
     l->st    = true;
     l->order = maxOrder++;
+    return false;
+}
+
+void LiveCache::invalidate(uint64_t addr) {
+    Line *l = cacheBank->findLine(addr);
+    if (l) {
+        l->clearTag();
+        l->st    = false;
+        l->order = 0;
+    }
 }
 
 uint64_t *LiveCache::traverse(int &n_entries) {
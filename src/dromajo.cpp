@@ -29,11 +29,13 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <unordered_map>
+#include <algorithm>
+#include <deque>
 
 #include "LiveCacheCore.h"
 #include "cutils.h"
@@ -46,80 +48,110 @@
 #include "dromajo_cosim.h"
 #endif
 
-#ifdef SIMPOINT_BB
-FILE *simpoint_bb_file = nullptr;
-int   simpoint_roi     = 0;  // start without ROI enabled
+/* Checkpoint creation at the selected simpoints (--simpoint); the BBV
+ * collection itself is done by the interpreter (riscv_bbv.h).  The
+ * checkpoints are placed by instruction count, or with markers by the
+ * block execution counts of simpoint_hart. */
+/* With simpoint_jobs, checkpoints are written by forked children: the
+ * copy-on-write address space is the snapshot and execution continues
+ * while they write it.  At most simpoint_jobs are in flight, oldest
+ * first: (pid, simpoint id) */
+static std::deque<std::pair<pid_t, int>> simpoint_writers;
+
+/* Waits for the oldest writer, or for all of them */
+static void simpoint_wait(bool all) {
+    while (!simpoint_writers.empty()) {
+        pid_t pid = simpoint_writers.front().first;
+        int   id  = simpoint_writers.front().second;
+        int   status;
+        simpoint_writers.pop_front();
+
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fprintf(dromajo_stderr, "ERROR: writing the checkpoint sp%d failed\n", id);
+        if (!all)
+            break;
+    }
+}
 
-int simpoint_step(RISCVMachine *m, int hartid) {
-    assert(hartid == 0);  // Only single core for simpoint creation
+static void simpoint_checkpoint(RISCVMachine *m, int id) {
+    char str[100];
+    sprintf(str, "sp%d", id);
 
-    static uint64_t ninst = 0;  // ninst in BB
-    ninst++;
+    if (m->common.simpoint_jobs == 0) {
+        virt_machine_serialize(m, str);
+        return;
+    }
 
-    if (simpoint_bb_file == 0) {  // Creating checkpoints mode
+    if ((int)simpoint_writers.size() >= m->common.simpoint_jobs)
+        simpoint_wait(false);
+
+    // the child must not write out buffered output a second time
+    fflush(dromajo_stdout);
+    fflush(dromajo_stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        virt_machine_serialize(m, str);
+    } else if (pid == 0) {
+        virt_machine_serialize(m, str);
+        fflush(dromajo_stderr);
+        _exit(0);
+    } else {
+        simpoint_writers.push_back({pid, id});
+    }
+}
 
-        assert(!m->common.simpoints.empty());
+static int simpoint_step(RISCVMachine *m) {
+    if (m->common.simpoint_hart >= 0) {
+        RISCVCPUState *cpu = m->cpu_state[m->common.simpoint_hart];
+        RISCVBBV *     bbv = cpu->bbv;
+        uint64_t       pc  = virt_machine_get_pc(m, m->common.simpoint_hart);
+
+        /* the restored boot ROM replaces this one */
+        if (!bbv->hit_pending || cpu->insn_counter < bbv->hit_icount
+            || (ROM_BASE_ADDR <= pc && pc < ROM_BASE_ADDR + ROM_SIZE))
+            return 1;
+
+        bbv->hit_pending = false;
+        simpoint_checkpoint(m, bbv->hit_id);
+    } else {
+        m->common.simpoint_ninst++;
 
         auto &sp = m->common.simpoints[m->common.simpoint_next];
-        if (ninst > sp.start) {
-            char str[100];
-            sprintf(str, "sp%d", sp.id);
-            virt_machine_serialize(m, str);
-
-            m->common.simpoint_next++;
-            if (m->common.simpoint_next == m->common.simpoints.size()) {
-                return 0;  // notify to terminate nicely
-            }
-        }
-        return 1;
+        if (m->common.simpoint_ninst <= sp.start)
+            return 1;
+
+        simpoint_checkpoint(m, sp.id);
     }
 
-    // Creating bb trace mode
-    assert(m->common.simpoints.empty());
-
-    uint64_t                                 pc            = virt_machine_get_pc(m, hartid);
-    static uint64_t                          next_bbv_dump = UINT64_MAX;
-    static std::unordered_map<uint64_t, int> bbv;
-    static std::unordered_map<uint64_t, int> pc2id;
-    static int                               next_id = 1;
-    if (m->common.maxinsns <= next_bbv_dump) {
-        if (m->common.maxinsns > SIMPOINT_SIZE)
-            next_bbv_dump = m->common.maxinsns - SIMPOINT_SIZE;
-        else
-            next_bbv_dump = 0;
-
-        if (bbv.size()) {
-            fprintf(simpoint_bb_file, "T");
-            for (const auto ent : bbv) {
-                auto it = pc2id.find(ent.first);
-                int  id = 0;
-                if (it == pc2id.end()) {
-                    id = next_id;
-                    next_id++;
-                    pc2id[ent.first] = next_id;
-                } else {
-                    id = it->second;
-                }
-
-                fprintf(simpoint_bb_file, ":%d:%d ", id, ent.second);
-            }
-            fprintf(simpoint_bb_file, "\n");
-            fflush(simpoint_bb_file);
-            bbv.clear();
-        }
+    m->common.simpoint_next++;
+    if (m->common.simpoint_next == m->common.simpoints.size()) {
+        return 0;  // notify to terminate nicely
     }
+    return 1;
+}
 
-    static uint64_t last_pc = 0;
-    if ((last_pc + 2) != pc && (last_pc + 4) != pc) {
-        bbv[last_pc] += ninst;
-        // fprintf(simpoint_bb_file,"xxxBB 0x%" PRIx64 " %d\n", pc, ninst);
-        ninst = 0;
+/* Whether the step of hartid at pc is printed, the trace window being open */
+static bool trace_match(TraceFilter *f, int hartid, int priv, uint64_t pc) {
+    if (!f->on.empty() || !f->off.empty()) {
+        if (std::find(f->on.begin(), f->on.end(), pc) != f->on.end())
+            f->active = true;
+        else if (std::find(f->off.begin(), f->off.end(), pc) != f->off.end())
+            f->active = false;
+        if (!f->active)
+            return false;
     }
-    last_pc = pc;
 
-    return 1;
+    if (!(f->harts >> hartid & 1) || !(f->privs >> priv & 1))
+        return false;
+    if (f->pcs.empty())
+        return true;
+    for (const auto &r : f->pcs)
+        if (r.first <= pc && pc < r.second)
+            return true;
+    return false;
 }
-#endif
 
 int iterate_core(RISCVMachine *m, int hartid) {
     if (m->common.maxinsns-- <= 0)
@@ -133,17 +165,44 @@ int iterate_core(RISCVMachine *m, int hartid) {
      */
     uint64_t last_pc  = virt_machine_get_pc(m, hartid);
     int      priv     = riscv_get_priv_level(cpu);
+    bool     traced   = m->common.trace == 0 && trace_match(&m->common.trace_filter, hartid, priv, last_pc);
     uint32_t insn_raw = -1;
-    (void)riscv_read_insn(cpu, &insn_raw, last_pc);
+    if (traced)
+        (void)riscv_read_insn(cpu, &insn_raw, last_pc);
     int keep_going = virt_machine_run(m, hartid);
+
+    if (m->selfcheck && !riscv_selfcheck_step(m->selfcheck, hartid))
+        return 0;
+    if (m->procstats && hartid == 0)
+        riscv_procstats_step(m->procstats);
     if (last_pc == virt_machine_get_pc(m, hartid))
         return 0;
 
+    int iregno = riscv_get_most_recently_written_reg(cpu);
+    int fregno = riscv_get_most_recently_written_fp_reg(cpu);
+
+    /* traps commit nothing */
+    if (cpu->hash && cpu->pending_exception == -1 && !cpu->took_interrupt) {
+        if (iregno > 0)
+            riscv_hash_commit(cpu->hash, last_pc, iregno, virt_machine_get_reg(m, hartid, iregno));
+        else if (fregno >= 0)
+            riscv_hash_commit(cpu->hash, last_pc, 32 + fregno, virt_machine_get_fpreg(m, hartid, fregno));
+        else
+            riscv_hash_commit(cpu->hash, last_pc, 0, 0);
+    }
+
     if (m->common.trace) {
         --m->common.trace;
         return keep_going;
     }
 
+    /* --trace_stop closes the window for good */
+    if (--m->common.trace_filter.left == 0)
+        m->common.trace = UINT64_MAX;
+
+    if (!traced)
+        return keep_going;
+
     fprintf(dromajo_stderr,
             "%d %d 0x%016" PRIx64 " (0x%08x)",
             hartid,
@@ -151,9 +210,6 @@ int iterate_core(RISCVMachine *m, int hartid) {
             last_pc,
             (insn_raw & 3) == 3 ? insn_raw : (uint16_t)insn_raw);
 
-    int iregno = riscv_get_most_recently_written_reg(cpu);
-    int fregno = riscv_get_most_recently_written_fp_reg(cpu);
-
     if (cpu->pending_exception != -1)
         fprintf(dromajo_stderr,
                 " exception %d, tval %016" PRIx64,
@@ -183,16 +239,6 @@ int main(int argc, char **argv) {
 #else
     RISCVMachine *m = virt_machine_main(argc, argv);
 
-#ifdef SIMPOINT_BB
-    if (m->common.simpoints.empty()) {
-        simpoint_bb_file = fopen("dromajo_simpoint.bb", "w");
-        if (simpoint_bb_file == nullptr) {
-            fprintf(dromajo_stderr, "\nerror: could not open dromajo_simpoint.bb for dumping trace\n");
-            exit(-3);
-        }
-    }
-#endif
-
 #ifdef LIVECACHE
     // m->llc = new LiveCache("LLC", 1024*1024*32); // 32MB LLC (should be ~2x larger than real)
     m->llc = new LiveCache("LLC", 1024 * 32);  // Small 32KB for testing
@@ -201,18 +247,26 @@ int main(int argc, char **argv) {
     if (!m)
         return 1;
 
+    if (m->common.selfcheck && !riscv_selfcheck_start(m))
+        return 1;
+
     int keep_going;
     do {
         keep_going = 0;
         for (int i = 0; i < m->ncpus; ++i) keep_going |= iterate_core(m, i);
-#ifdef SIMPOINT_BB
-        if (simpoint_roi) {
-            if (!simpoint_step(m, 0))
+        if (m->telemetry)
+            riscv_telemetry_step(m->telemetry);
+        if (m->common.simpoint_roi && !m->common.simpoints.empty()) {
+            if (!simpoint_step(m))
                 break;
         }
-#endif
     } while (keep_going);
 
+    simpoint_wait(true);
+
+    if (m->selfcheck && !riscv_selfcheck_end(m->selfcheck))
+        return 1;
+
     for (int i = 0; i < m->ncpus; ++i) {
         int benchmark_exit_code = riscv_benchmark_exit_code(m->cpu_state[i]);
         if (benchmark_exit_code != 0) {
@@ -48,7 +48,51 @@ dromajo_cosim_state_t *dromajo_cosim_init(int argc, char *argv[]) {
     return (dromajo_cosim_state_t *)m;
 }
 
-void dromajo_cosim_fini(dromajo_cosim_state_t *state) { virt_machine_end((RISCVMachine *)state); }
+struct CosimCSR {
+    dromajo_cosim_csr_read_t  read;
+    dromajo_cosim_csr_write_t write;
+    void *                    opaque;
+};
+
+static int cosim_csr_read(RISCVCPUState *s, uint32_t csr, uint64_t *pval) {
+    CosimCSR *c = (CosimCSR *)s->machine->csrs[csr].opaque;
+    return c->read(c->opaque, s->mhartid, csr, pval) < 0 ? -1 : 0;
+}
+
+static int cosim_csr_write(RISCVCPUState *s, uint32_t csr, uint64_t val) {
+    CosimCSR *c = (CosimCSR *)s->machine->csrs[csr].opaque;
+    return c->write(c->opaque, s->mhartid, csr, val) < 0 ? -1 : 0;
+}
+
+static void cosim_csr_free(RISCVMachine *m, uint32_t csr) {
+    if (m->csrs[csr].read == cosim_csr_read)
+        free(m->csrs[csr].opaque);
+}
+
+void dromajo_cosim_register_csr(dromajo_cosim_state_t *state, uint32_t csr, dromajo_cosim_csr_read_t read,
+                                dromajo_cosim_csr_write_t write, void *opaque) {
+    RISCVMachine *m = (RISCVMachine *)state;
+    CosimCSR *    c = (CosimCSR *)malloc(sizeof *c);
+
+    assert(csr < 4096 && read);
+    c->read   = read;
+    c->write  = write;
+    c->opaque = opaque;
+    cosim_csr_free(m, csr);
+    riscv_csr_register(m, csr, cosim_csr_read, write ? cosim_csr_write : NULL, 0, c);
+}
+
+void dromajo_cosim_watch(dromajo_cosim_state_t *state, uint64_t paddr, uint64_t size) {
+    assert(size > 0);
+    riscv_watch_add((RISCVMachine *)state, paddr, size);
+}
+
+void dromajo_cosim_fini(dromajo_cosim_state_t *state) {
+    RISCVMachine *m = (RISCVMachine *)state;
+
+    for (uint32_t csr = 0; csr < 4096; ++csr) cosim_csr_free(m, csr);
+    virt_machine_end(m);
+}
 
 static bool is_store_conditional(uint32_t insn) {
     int opcode = insn & 0x7f, funct3 = insn >> 12 & 7;
@@ -206,6 +250,7 @@ int dromajo_cosim_step(dromajo_cosim_state_t *state, int hartid, uint64_t dut_pc
     bool           emu_wrote_data = false;
     int            exit_code      = 0;
     bool           verbose        = true;
+    bool           trapped        = false;
     int            iregno, fregno;
 
     /* Succeed after N instructions without failure. */
@@ -227,6 +272,9 @@ int dromajo_cosim_step(dromajo_cosim_state_t *state, int hartid, uint64_t dut_pc
     iregno = -1;
     fregno = -1;
 
+    if (unlikely(s->next_event <= s->insn_counter))
+        riscv_events_fire(s);
+
     for (;;) {
         emu_priv = riscv_get_priv_level(s);
         emu_pc   = riscv_get_pc(s);
@@ -276,8 +324,9 @@ int dromajo_cosim_step(dromajo_cosim_state_t *state, int hartid, uint64_t dut_pc
             riscv_cpu_set_mip(s, riscv_cpu_get_mip(s) | 1 << r->common.pending_interrupt);
 
         if (riscv_cpu_interp64(s, 1) != 0) {
-            iregno = riscv_get_most_recently_written_reg(s);
-            fregno = riscv_get_most_recently_written_fp_reg(s);
+            iregno  = riscv_get_most_recently_written_reg(s);
+            fregno  = riscv_get_most_recently_written_fp_reg(s);
+            trapped = s->pending_exception != -1 || s->took_interrupt;
             break;
         }
 
@@ -306,6 +355,16 @@ int dromajo_cosim_step(dromajo_cosim_state_t *state, int hartid, uint64_t dut_pc
     } else
         fprintf(dromajo_stderr, "                      ");
 
+    /* the same commits as iterate_core, for a DUT commit monitor */
+    if (s->hash && !trapped) {
+        if (iregno > 0)
+            riscv_hash_commit(s->hash, emu_pc, iregno, emu_wdata);
+        else if (fregno >= 0)
+            riscv_hash_commit(s->hash, emu_pc, 32 + fregno, emu_wdata);
+        else
+            riscv_hash_commit(s->hash, emu_pc, 0, 0);
+    }
+
     if (verbose)
         fprintf(dromajo_stderr, " DASM(0x%08x)\n", emu_insn);
 
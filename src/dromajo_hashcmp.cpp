@@ -0,0 +1,113 @@
+/*
+ * First divergence between two state hash streams written by --hash
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * The hashes are cumulative, so once two streams differ every later line
+ * differs as well and the first differing line can be binary searched.
+ * The result is the range of commits holding the first divergence, to be
+ * narrowed down with a full trace of just that range.  Exits with 0 if
+ * the streams are identical, 1 if they diverge and 2 on errors.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+struct HashLine {
+    uint64_t count;
+    uint64_t hash;
+};
+
+static bool read_hashes(const char *filename, uint64_t *interval, std::vector<HashLine> *lines) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        fprintf(stderr, "could not open %s\n", filename);
+        return false;
+    }
+
+    char buf[256];
+    int  hartid;
+    if (!fgets(buf, sizeof buf, f)
+        || sscanf(buf, "# dromajo state hash, interval %" SCNu64 ", hart %d", interval, &hartid) != 2) {
+        fprintf(stderr, "%s is not a state hash file\n", filename);
+        fclose(f);
+        return false;
+    }
+
+    int lineno = 1;
+    while (fgets(buf, sizeof buf, f)) {
+        HashLine l;
+        ++lineno;
+        if (sscanf(buf, "%" SCNu64 " %" SCNx64, &l.count, &l.hash) != 2) {
+            fprintf(stderr, "%s:%d: malformed line\n", filename, lineno);
+            fclose(f);
+            return false;
+        }
+        lines->push_back(l);
+    }
+    fclose(f);
+
+    return true;
+}
+
+static bool same(const HashLine &a, const HashLine &b) { return a.count == b.count && a.hash == b.hash; }
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s hash-file hash-file\n", argv[0]);
+        return 2;
+    }
+
+    uint64_t              interval_a, interval_b;
+    std::vector<HashLine> a, b;
+    if (!read_hashes(argv[1], &interval_a, &a) || !read_hashes(argv[2], &interval_b, &b))
+        return 2;
+    if (interval_a != interval_b) {
+        fprintf(stderr, "the intervals differ (%" PRIu64 " and %" PRIu64 ")\n", interval_a, interval_b);
+        return 2;
+    }
+
+    /* the first line that differs, or n if the common part matches */
+    size_t n  = a.size() < b.size() ? a.size() : b.size();
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (same(a[mid], b[mid]))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == n && a.size() == b.size()) {
+        printf("identical, %" PRIu64 " commits\n", n ? a[n - 1].count : 0);
+        return 0;
+    }
+
+    uint64_t start = lo ? a[lo - 1].count : 0;
+    if (lo == n) {
+        const char *longer = a.size() > b.size() ? argv[1] : argv[2];
+        printf("identical for %" PRIu64 " commits, then only %s goes on\n", start, longer);
+        return 1;
+    }
+
+    printf("diverged between commits %" PRIu64 " and %" PRIu64 " (line %zu)\n",
+           start + 1,
+           start + interval_a,
+           lo + 2);
+    return 1;
+}
@@ -39,6 +39,7 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
@@ -63,6 +64,8 @@
 #include <sys/stat.h>
 
 #include <algorithm>
+#include <map>
+#include <vector>
 
 #include "cutils.h"
 #include "iomem.h"
@@ -71,6 +74,7 @@
 #include "fs_utils.h"
 #include "fs_wget.h"
 #endif
+#include "replay.h"
 #include "riscv_machine.h"
 #ifdef CONFIG_SLIRP
 #include "slirp/libslirp.h"
@@ -124,13 +128,42 @@ static void console_write(void *opaque, const uint8_t *buf, int len) {
     fflush(s->out);
 }
 
+static void console_writev(void *opaque, const struct iovec *iov, int iovcnt) {
+    STDIODevice *s = (STDIODevice *)opaque;
+    struct iovec v[64];
+
+    if (iovcnt > 64) {
+        for (int i = 0; i < iovcnt; ++i) console_write(opaque, (const uint8_t *)iov[i].iov_base, iov[i].iov_len);
+        return;
+    }
+    memcpy(v, iov, iovcnt * sizeof *v);
+    fflush(s->out);
+
+    /* the output may be a pipe, retry after partial writes */
+    int i = 0;
+    while (i < iovcnt) {
+        ssize_t n = writev(fileno(s->out), v + i, iovcnt - i);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return;
+        }
+        while (i < iovcnt && (size_t)n >= v[i].iov_len) n -= v[i++].iov_len;
+        if (i < iovcnt) {
+            v[i].iov_base = (uint8_t *)v[i].iov_base + n;
+            v[i].iov_len -= n;
+        }
+    }
+}
+
 static int console_read(void *opaque, uint8_t *buf, int len) {
     STDIODevice *s = (STDIODevice *)opaque;
 
     if (len <= 0)
         return 0;
 
-    int ret = fread(buf, len, 1, s->stdin);
+    /* whatever is available, stdin is non blocking */
+    int ret = read(fileno(s->stdin), buf, len);
     if (ret <= 0)
         return 0;
 
@@ -191,8 +224,9 @@ CharacterDevice *console_init(BOOL allow_ctrlc, FILE *stdin, FILE *out) {
     sigaction(SIGWINCH, &sig, NULL);
 
     dev->opaque     = s;
-    dev->write_data = console_write;
-    dev->read_data  = console_read;
+    dev->write_data  = console_write;
+    dev->read_data   = console_read;
+    dev->writev_data = console_writev;
     return dev;
 }
 
@@ -234,9 +268,9 @@ static int bf_read_async(BlockDevice *bs, uint64_t sector_num, uint8_t *buf, int
         int i;
         for (i = 0; i < n; i++) {
             if (!bf->sector_table[sector_num]) {
-                fseek(bf->f, sector_num * SECTOR_SIZE, SEEK_SET);
-                size_t got = fread(buf, 1, SECTOR_SIZE, bf->f);
-                assert(got == SECTOR_SIZE);
+                /* the file offset is shared with the --selfcheck reference */
+                if (pread(fileno(bf->f), buf, SECTOR_SIZE, sector_num * SECTOR_SIZE) != SECTOR_SIZE)
+                    return -1;
             } else {
                 memcpy(buf, bf->sector_table[sector_num], SECTOR_SIZE);
             }
@@ -485,17 +519,46 @@ static EthernetDevice *slirp_open(void) {
 
 #endif /* CONFIG_SLIRP */
 
+#define CONSOLE_POLL_STEPS (1 << 14)
+
+static void console_poll(RISCVMachine *s) {
+    STDIODevice *stdio = global_stdio_device;
+
+    /* a resize is not in the input log, only pass it on when live */
+    if (stdio && stdio->resize_pending && !s->common.replay) {
+        struct winsize ws;
+        if (ioctl(0, TIOCGWINSZ, &ws) == 0 && ws.ws_col >= 4 && ws.ws_row >= 4)
+            virtio_console_resize_event(s->common.console_dev, ws.ws_col, ws.ws_row);
+        stdio->resize_pending = FALSE;
+    }
+
+    virtio_console_poll(s->common.console_dev);
+}
+
 BOOL virt_machine_run(RISCVMachine *s, int hartid) {
     (void)virt_machine_get_sleep_duration(s, hartid, MAX_SLEEP_TIME);
 
-    riscv_cpu_interp64(s->cpu_state[hartid], 1);
+    s->common.current_hart = hartid;
+
+    RISCVCPUState *cpu = s->cpu_state[hartid];
+    if (unlikely(cpu->next_event <= cpu->insn_counter))
+        riscv_events_fire(cpu);
+
+    riscv_cpu_interp64(cpu, 1);
+
+    /* The console input is delivered at fixed step counts, which keeps
+     * the runs with --replay identical */
+    if (s->common.console_dev && (++s->console_steps & (CONSOLE_POLL_STEPS - 1)) == 0)
+        console_poll(s);
 
     if (s->htif_tohost_addr) {
-        uint32_t tohost;
-        bool     fail = true;
-        tohost        = riscv_phys_read_u32(s->cpu_state[hartid], s->htif_tohost_addr, &fail);
-        if (!fail && tohost & 1)
-            return false;
+        /* Host-side poll, bypasses PMP and the cache/timing models */
+        PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, s->htif_tohost_addr);
+        if (pr && pr->is_ram) {
+            uint32_t tohost = *(uint32_t *)(pr->phys_mem + (uintptr_t)(s->htif_tohost_addr - pr->addr));
+            if (tohost & 1)
+                return false;
+        }
     }
 
     return !riscv_terminated(s->cpu_state[hartid]) && s->common.maxinsns > 0;
@@ -539,6 +602,94 @@ static BOOL net_poll_cb(void *arg) { return net_completed; }
 
 #endif
 
+/* The simpoint control CSR, reads as 0.  Writes of (n << 2) | 3 set
+ * maxinsns to n, (code << 2) | 2 terminates and bit 0 starts or ends the
+ * ROI. */
+static int simpoint_csr_read(RISCVCPUState *s, uint32_t csr, uint64_t *pval) {
+    *pval = 0;
+    return 0;
+}
+
+static int simpoint_csr_write(RISCVCPUState *s, uint32_t csr, uint64_t val) {
+    VirtMachine *m = &s->machine->common;
+
+    if ((val & 3) == 3) {
+        fprintf(dromajo_stderr, "simpoint adjust maxinsns to %lld\n", (long long)val >> 2);
+        m->maxinsns = val >> 2;
+    } else if ((val & 3) == 2) {
+        fprintf(dromajo_stderr, "simpoint terminate\n");
+        s->benchmark_exit_code  = val >> 2;
+        s->terminate_simulation = 1;
+    } else if ((val & 1) && m->simpoint_roi) {
+        fprintf(dromajo_stderr, "simpoint ROI already started\n");
+    } else if ((val & 1) == 0 && m->simpoint_roi) {
+        fprintf(dromajo_stderr, "simpoint ROI finished\n");
+        m->simpoint_roi = false;
+    } else if ((val & 1) == 0 && !m->simpoint_roi) {
+        fprintf(dromajo_stderr, "simpoint ROI already finished\n");
+    } else {
+        fprintf(dromajo_stderr, "simpoint ROI started\n");
+        m->simpoint_roi = true;
+    }
+    return 0;
+}
+
+/* FILE[.gz|.zst] -> FILE.<hartid>[.gz|.zst] when there are several harts */
+static char *bbv_hart_file(const char *file, int hartid, int ncpus) {
+    size_t len = strlen(file);
+    size_t ext = 0;
+    char * name;
+
+    if (ncpus == 1)
+        return strdup(file);
+
+    if (len > 3 && !strcmp(file + len - 3, ".gz"))
+        ext = 3;
+    else if (len > 4 && !strcmp(file + len - 4, ".zst"))
+        ext = 4;
+
+    name = (char *)malloc(len + 16);
+    sprintf(name, "%.*s.%d%s", (int)(len - ext), file, hartid, file + len - ext);
+    return name;
+}
+
+struct Marker {
+    uint64_t pc;
+    uint64_t count;
+    uint64_t offset;
+};
+
+/* Reads the interval -> marker map written next to the BBVs */
+static bool read_simpoint_markers(const char *file, std::map<int, Marker> *markers, int *hartid) {
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        fprintf(dromajo_stderr, "could not open simpoint markers file %s\n", file);
+        return false;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof line, f)) {
+        int    interval;
+        Marker m;
+
+        if (sscanf(line, "# hart %d", hartid) == 1 || line[0] == '#')
+            continue;
+        if (sscanf(line, "%d %" SCNx64 " %" SCNu64 " %" SCNu64, &interval, &m.pc, &m.count, &m.offset) != 4) {
+            fprintf(dromajo_stderr, "invalid simpoint marker: %s", line);
+            fclose(f);
+            return false;
+        }
+        (*markers)[interval] = m;
+    }
+    fclose(f);
+
+    if (*hartid < 0) {
+        fprintf(dromajo_stderr, "simpoint markers file %s has no hart\n", file);
+        return false;
+    }
+    return true;
+}
+
 static void usage(const char *prog, const char *msg) {
     fprintf(dromajo_stderr,
             "error: %s\n"
@@ -548,11 +699,26 @@ static void usage(const char *prog, const char *msg) {
             "       --cmdline Kernel command line arguments to append\n"
             "       --ncpus number of cpus to simulate (default 1)\n"
             "       --load resumes a previously saved snapshot\n"
+            "       --events FILE schedule interrupts and device events by instruction count (see riscv_events.h)\n"
+            "       --record FILE log the console input to FILE\n"
+            "       --replay FILE take the console input from a --record log instead of the terminal\n"
+            "       --direct_restore --load sets the registers directly instead of running the snapshot boot ROM\n"
             "       --simpoint reads a simpoint file to create multiple checkpoints\n"
+            "       --bbv FILE write SimPoint basic block vectors to FILE (gzip/zstd compressed if it ends in .gz/.zst)\n"
+            "       --simpoint_markers FILE place the --simpoint checkpoints at the markers written by --bbv\n"
+            "       --simpoint_jobs N checkpoints written in the background at once (default 4, 0 writes them in line)\n"
+            "       --simpoint_size N instructions per SimPoint interval (default 100000000)\n"
+            "       --simpoint_roi only count instructions inside the ROI marked with CSR 0x8c2 (--bbv/--simpoint)\n"
             "       --save saves a snapshot upon exit\n"
             "       --maxinsns terminates execution after a number of instructions\n"
             "       --terminate-event name of the validate event to terminate execution\n"
             "       --trace start trace dump after a number of instructions. Trace disabled by default\n"
+            "       --trace_stop N end the trace dump after a number of instructions\n"
+            "       --trace_pc START:END|SYMBOL only trace the pcs in [START, END) or in function SYMBOL (repeatable)\n"
+            "       --trace_priv LIST only trace these privilege modes, a combination of m, s and u\n"
+            "       --trace_hart LIST only trace these comma separated harts\n"
+            "       --trace_on PC|SYMBOL start tracing when a hart reaches PC (repeatable)\n"
+            "       --trace_off PC|SYMBOL stop tracing when a hart reaches PC (repeatable)\n"
             "       --ignore_sbi_shutdown continue simulation even upon seeing the SBI_SHUTDOWN call\n"
             "       --dump_memories dump memories that could be used to load a cosimulation\n"
             "       --memory_size sets the memory size in MiB (default 256 MiB)\n"
@@ -564,7 +730,20 @@ static void usage(const char *prog, const char *msg) {
             "       --mmio_range START:END [START,END) mmio range for cosim (overridden by config file)\n"
             "       --plic START:SIZE set PLIC start address and size (defaults to 0x%lx:0x%lx)\n"
             "       --clint START:SIZE set CLINT start address and size (defaults to 0x%lx:0x%lx)\n"
-            "       --custom_extension add X extension to isa\n",
+            "       --custom_extension add X extension to isa\n"
+            "       --timing enable the approximate timing model (mcycle/mtime follow modelled cycles)\n"
+            "       --bpred TYPE enable the branch predictor model (bimodal, gshare or tage)\n"
+            "       --tlb enable the target TLB model (sizes from the \"tlb\" config object)\n"
+            "       --dbcache fetch through a cache of instruction blocks shared by all harts\n"
+            "       --idioms run memset/memcpy style loops as bulk copies (implies --dbcache)\n"
+            "       --watch START:SIZE log every write to the physical range [START, START+SIZE) (repeatable)\n"
+            "       --hash FILE write a rolling hash of the committed state to FILE (FILE.<hartid> with several harts)\n"
+            "       --hash_interval N commits between --hash lines (default 1000000)\n"
+            "       --selfcheck run a plain interpreter in lockstep and stop where --dbcache/--idioms diverge from it\n"
+            "       --proc_stats FILE write the instructions of every process and system call to FILE at the end\n"
+            "       --proc_interval N also write them every N instructions of hart 0\n"
+            "       --telemetry NAME publish live statistics in the shared memory object NAME (see dromajo_top)\n"
+            "       --telemetry_interval N steps of hart 0 between updates (default 1000000)\n",
             msg,
             CONFIG_VERSION,
             prog,
@@ -599,9 +778,37 @@ static bool load_elf_and_fake_the_config(VirtMachineParams *p, const char *path)
     return false;
 }
 
+/* PC, START:END or the name of a symbol of the BIOS or kernel ELF, whose
+ * range covers the symbol's size */
+static bool trace_pc_range(const VirtMachineParams *p, const char *arg, uint64_t *lo, uint64_t *hi) {
+    if (isdigit((unsigned char)arg[0])) {
+        char *end;
+        *lo = strtoull(arg, &end, 0);
+        *hi = *lo + 1;
+        if (*end == ':')
+            *hi = strtoull(end + 1, &end, 0);
+        return *end == 0 && *lo < *hi;
+    }
+
+    for (int i : {VM_FILE_BIOS, VM_FILE_KERNEL}) {
+        const VMFileEntry *f = &p->files[i];
+        uint64_t           size;
+        if (f->buf && elf64_is_riscv64(f->buf, f->len) && elf64_find_symbol(f->buf, f->len, arg, lo, &size)) {
+            *hi = *lo + std::max<uint64_t>(size, 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 RISCVMachine *virt_machine_main(int argc, char **argv) {
     const char *prog                     = argv[0];
     char *      snapshot_load_name       = 0;
+    bool        snapshot_direct          = false;
+    const char *record_file              = 0;
+    const char *events_file              = 0;
+    const char *replay_file              = 0;
     char *      snapshot_save_name       = 0;
     const char *path                     = NULL;
     const char *cmdline                  = NULL;
@@ -624,6 +831,29 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
     uint64_t    clint_size_override      = 0;
     bool        custom_extension         = false;
     const char *simpoint_file            = 0;
+    const char *bbv_file                 = 0;
+    const char *markers_file             = 0;
+    int         simpoint_jobs            = 4;
+    bool        simpoint_roi             = false;
+    uint64_t    simpoint_size            = SIMPOINT_SIZE;
+    bool        timing                   = false;
+    const char *bpred                    = 0;
+    bool        tlbmodel                 = false;
+    bool        dbcache                  = false;
+    bool        idioms                   = false;
+    const char *hash_file                = 0;
+    uint64_t    hash_interval            = 1000000;
+    bool        selfcheck                = false;
+    const char *proc_stats_file          = 0;
+    uint64_t    proc_interval            = 0;
+    const char *telemetry_name           = 0;
+    uint64_t    telemetry_interval       = 1000000;
+    uint32_t    trace_privs              = 0;
+    uint32_t    trace_harts              = 0;
+    uint64_t    trace_stop               = UINT64_MAX;
+
+    std::vector<RISCVWatch>   watches;
+    std::vector<const char *> trace_pcs, trace_on, trace_off;
 
     dromajo_stdout = stdout;
     dromajo_stderr = stderr;
@@ -637,10 +867,25 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
             {"cmdline",                 required_argument, 0,  'c' }, // CFG
             {"ncpus",                   required_argument, 0,  'n' }, // CFG
             {"load",                    required_argument, 0,  'l' },
+            {"direct_restore",                no_argument, 0,  'G' },
+            {"events",                  required_argument, 0,  'X' },
+            {"record",                  required_argument, 0,  'E' },
+            {"replay",                  required_argument, 0,  'Y' },
             {"save",                    required_argument, 0,  's' },
             {"simpoint",                required_argument, 0,  'S' },
+            {"bbv",                     required_argument, 0,  'V' },
+            {"simpoint_markers",        required_argument, 0,  'K' },
+            {"simpoint_jobs",           required_argument, 0,  'J' },
+            {"simpoint_roi",                  no_argument, 0,  'I' },
+            {"simpoint_size",           required_argument, 0,  'Z' },
             {"maxinsns",                required_argument, 0,  'm' }, // CFG
-            {"trace   ",                required_argument, 0,  't' },
+            {"trace",                   required_argument, 0,  't' },
+            {"trace_stop",              required_argument, 0,  'z' },
+            {"trace_pc",                required_argument, 0,  'x' },
+            {"trace_priv",              required_argument, 0,  'v' },
+            {"trace_hart",              required_argument, 0,  'h' },
+            {"trace_on",                required_argument, 0,  'N' },
+            {"trace_off",               required_argument, 0,  'F' },
             {"ignore_sbi_shutdown",     required_argument, 0,  'P' }, // CFG
             {"dump_memories",           required_argument, 0,  'D' }, // CFG
             {"memory_size",             required_argument, 0,  'M' }, // CFG
@@ -653,6 +898,19 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
             {"plic",                    required_argument, 0,  'p' }, // CFG
             {"clint",                   required_argument, 0,  'C' }, // CFG
             {"custom_extension",              no_argument, 0,  'u' }, // CFG
+            {"timing",                        no_argument, 0,  'T' }, // CFG
+            {"bpred",                   required_argument, 0,  'B' }, // CFG
+            {"tlb",                           no_argument, 0,  'L' }, // CFG
+            {"dbcache",                       no_argument, 0,  'Q' },
+            {"idioms",                        no_argument, 0,  'W' },
+            {"watch",                   required_argument, 0,  'w' },
+            {"hash",                    required_argument, 0,  'H' },
+            {"hash_interval",           required_argument, 0,  'i' },
+            {"selfcheck",                     no_argument, 0,  'k' },
+            {"proc_stats",              required_argument, 0,  'a' },
+            {"proc_interval",           required_argument, 0,  'e' },
+            {"telemetry",               required_argument, 0,  'O' },
+            {"telemetry_interval",      required_argument, 0,  'U' },
             {0,                         0,                 0,  0 }
         };
         // clang-format on
@@ -680,6 +938,26 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
                 snapshot_load_name = strdup(optarg);
                 break;
 
+            case 'G': snapshot_direct = true; break;
+
+            case 'X':
+                if (events_file)
+                    usage(prog, "already had an event schedule");
+                events_file = strdup(optarg);
+                break;
+
+            case 'E':
+                if (record_file || replay_file)
+                    usage(prog, "already had a record or replay file");
+                record_file = strdup(optarg);
+                break;
+
+            case 'Y':
+                if (record_file || replay_file)
+                    usage(prog, "already had a record or replay file");
+                replay_file = strdup(optarg);
+                break;
+
             case 's':
                 if (snapshot_save_name)
                     usage(prog, "already had a snapshot to save");
@@ -692,6 +970,32 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
                 simpoint_file = strdup(optarg);
                 break;
 
+            case 'V':
+                if (bbv_file)
+                    usage(prog, "already had a bbv file");
+                bbv_file = strdup(optarg);
+                break;
+
+            case 'K':
+                if (markers_file)
+                    usage(prog, "already had a simpoint markers file");
+                markers_file = strdup(optarg);
+                break;
+
+            case 'J':
+                simpoint_jobs = atoi(optarg);
+                if (simpoint_jobs < 0)
+                    usage(prog, "--simpoint_jobs must not be negative");
+                break;
+
+            case 'I': simpoint_roi = true; break;
+
+            case 'Z':
+                simpoint_size = (uint64_t)atoll(optarg);
+                if (simpoint_size == 0)
+                    usage(prog, "--simpoint_size must be positive");
+                break;
+
             case 'm':
                 if (maxinsns)
                     usage(prog, "already had a max instructions");
@@ -713,6 +1017,37 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
                 trace = (uint64_t)atoll(optarg);
                 break;
 
+            case 'z': trace_stop = strtoull(optarg, NULL, 0); break;
+
+            case 'x': trace_pcs.push_back(optarg); break;
+
+            case 'v':
+                for (const char *c = optarg; *c; ++c) {
+                    switch (*c) {
+                        case 'm': trace_privs |= 1 << PRV_M; break;
+                        case 's': trace_privs |= 1 << PRV_S; break;
+                        case 'u': trace_privs |= 1 << PRV_U; break;
+                        case ',': break;
+                        default: usage(prog, "--trace_priv takes a combination of m, s and u");
+                    }
+                }
+                break;
+
+            case 'h':
+                for (char *c = optarg; *c;) {
+                    char *end;
+                    long  hart = strtol(c, &end, 0);
+                    if (end == c || hart < 0 || hart >= MAX_CPUS || (*end && *end != ','))
+                        usage(prog, "--trace_hart takes comma separated hart numbers");
+                    trace_harts |= 1u << hart;
+                    c = *end ? end + 1 : end;
+                }
+                break;
+
+            case 'N': trace_on.push_back(optarg); break;
+
+            case 'F': trace_off.push_back(optarg); break;
+
             case 'P': ignore_sbi_shutdown = true; break;
 
             case 'D': dump_memories = true; break;
@@ -795,6 +1130,68 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
 
             case 'u': custom_extension = true; break;
 
+            case 'T': timing = true; break;
+
+            case 'B': bpred = strdup(optarg); break;
+
+            case 'L': tlbmodel = true; break;
+
+            case 'Q': dbcache = true; break;
+
+            case 'W': idioms = true; break;
+
+            case 'k': selfcheck = true; break;
+
+            case 'w': {
+                char *   end;
+                uint64_t start = strtoull(optarg, &end, 0);
+                if (end == optarg || *end != ':')
+                    usage(prog, "--watch expects an argument like START:SIZE");
+                char *   size_str = end + 1;
+                uint64_t size     = strtoull(size_str, &end, 0);
+                if (end == size_str || *end || size == 0)
+                    usage(prog, "--watch SIZE must be a positive number");
+                if (size - 1 > UINT64_MAX - start)
+                    usage(prog, "--watch range goes past the end of the address space");
+                watches.push_back(RISCVWatch{start, start + size - 1});
+            } break;
+
+            case 'H':
+                if (hash_file)
+                    usage(prog, "already had a hash file");
+                hash_file = strdup(optarg);
+                break;
+
+            case 'i':
+                hash_interval = strtoull(optarg, NULL, 0);
+                if (hash_interval == 0)
+                    usage(prog, "--hash_interval must be positive");
+                break;
+
+            case 'a':
+                if (proc_stats_file)
+                    usage(prog, "already had a process stats file");
+                proc_stats_file = strdup(optarg);
+                break;
+
+            case 'e':
+                proc_interval = strtoull(optarg, NULL, 0);
+                if (proc_interval == 0)
+                    usage(prog, "--proc_interval must be positive");
+                break;
+
+            case 'O':
+                if (telemetry_name)
+                    usage(prog, "already had a telemetry name");
+                telemetry_name = strdup(optarg);
+                break;
+
+            case 'U':
+                telemetry_interval = strtoull(optarg, NULL, 0);
+                if (telemetry_interval == 0)
+                    usage(prog, "--telemetry_interval must be positive");
+                break;
+
             default: usage(prog, "I'm not having this argument");
         }
     }
@@ -807,6 +1204,12 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
     if (optind < argc)
         usage(prog, "too many arguments");
 
+    if (proc_interval && !proc_stats_file)
+        usage(prog, "--proc_interval needs --proc_stats");
+
+    if (selfcheck && (record_file || replay_file))
+        usage(prog, "--selfcheck runs without console input, it excludes --record and --replay");
+
     assert(path);
     BlockDeviceModeEnum drive_mode = BF_MODE_SNAPSHOT;
     VirtMachineParams   p_s, *p = &p_s;
@@ -925,6 +1328,14 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
     p->console       = console_init(TRUE, stdin, dromajo_stdout);
     p->dump_memories = dump_memories;
 
+    Replay *replay = 0;
+    if (record_file || replay_file) {
+        replay = replay_init(record_file ? record_file : replay_file, record_file != 0, p->console);
+        if (!replay)
+            return NULL;
+        p->console = replay_console(replay);
+    }
+
     // Setup bootrom params
     if (bootrom_name)
         p->bootrom_name = bootrom_name;
@@ -957,6 +1368,57 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
     // ISA modifications
     p->custom_extension = custom_extension;
 
+    // Timing model, parameters come from the "timing" config object
+    if (timing)
+        p->timing = true;
+
+    // Branch predictor, sizes come from the "bpred" config object
+    if (bpred && riscv_bpred_parse_type(bpred, &p->bpred_params.type) < 0)
+        usage(prog, "--bpred TYPE must be bimodal, gshare or tage");
+
+    // Target TLB model, sizes come from the "tlb" config object
+    if (tlbmodel)
+        p->tlbmodel = true;
+
+    p->dbcache = dbcache;
+    p->idioms  = idioms;
+
+    // Trace filters, symbols come from the ELF files
+    TraceFilter trace_filter;
+    trace_filter.privs  = trace_privs ? trace_privs : ~0u;
+    trace_filter.harts  = trace_harts ? trace_harts : ~0u;
+    trace_filter.active = false;
+    trace_filter.left   = UINT64_MAX;
+    for (const char *arg : trace_pcs) {
+        uint64_t lo, hi;
+        if (!trace_pc_range(p, arg, &lo, &hi))
+            usage(prog, "--trace_pc expects START:END or a symbol of the ELF file");
+        trace_filter.pcs.push_back(std::make_pair(lo, hi));
+    }
+    for (int off = 0; off < 2; ++off) {
+        for (const char *arg : off ? trace_off : trace_on) {
+            uint64_t lo, hi;
+            if (!trace_pc_range(p, arg, &lo, &hi))
+                usage(prog, "--trace_on and --trace_off expect a PC or a symbol of the ELF file");
+            (off ? trace_filter.off : trace_filter.on).push_back(lo);
+        }
+    }
+    // Any filter alone traces from the start
+    if (trace == UINT64_MAX && (trace_privs || trace_harts || trace_stop != UINT64_MAX || !trace_pcs.empty()
+                                || !trace_on.empty() || !trace_off.empty()))
+        trace = 0;
+    if (trace_stop != UINT64_MAX) {
+        if (trace_stop <= trace)
+            usage(prog, "--trace_stop must come after the --trace start");
+        trace_filter.left = trace_stop - trace;
+    }
+
+    /* the reference process must not touch the host beyond its console */
+    if (selfcheck && (p->fs_count || p->eth_count)) {
+        vm_error("--selfcheck does not support host file systems and network devices\n");
+        return NULL;
+    }
+
     RISCVMachine *s = virt_machine_init(p);
     if (!s)
         return NULL;
@@ -965,20 +1427,76 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
     if (snapshot_load_name) {
         s->common.snapshot_load_name = snapshot_load_name;
     }
+    s->common.snapshot_direct = snapshot_direct;
+    s->common.selfcheck       = selfcheck;
+
+    for (const RISCVWatch &w : watches) riscv_watch_add(s, w.lo, w.hi - w.lo + 1);
+
+    if (events_file && riscv_events_load(s, events_file) < 0)
+        return NULL;
+
+    if (replay) {
+        s->common.replay = replay;
+        replay_set_machine(replay, s);
+    }
+
+    if (simpoint_file && bbv_file)
+        usage(prog, "--bbv and --simpoint are exclusive");
+
+    if (markers_file && !simpoint_file)
+        usage(prog, "--simpoint_markers needs --simpoint");
+
+    std::map<int, Marker> markers;
+    int                   markers_hart = -1;
+    if (markers_file && !read_simpoint_markers(markers_file, &markers, &markers_hart))
+        return NULL;
+    if (markers_file && s->ncpus <= markers_hart) {
+        fprintf(stderr, "simpoint markers file %s is for hart %d\n", markers_file, markers_hart);
+        exit(1);
+    }
+
+    /* The BBVs and the process statistics start from the pc, privilege
+     * level, satp and instruction count of the harts, which a checkpoint
+     * replaces */
+    if (s->common.snapshot_load_name) {
+        /* the boot ROM of a checkpoint only restores hart 0 */
+        if (s->ncpus > 1 && !s->common.snapshot_direct) {
+            vm_error("the boot ROM of %s only restores hart 0, load checkpoints of %d harts with --direct_restore\n",
+                     s->common.snapshot_load_name,
+                     s->ncpus);
+            return NULL;
+        }
+        virt_machine_deserialize(s, s->common.snapshot_load_name);
+    }
 
     if (simpoint_file) {
-#ifdef SIMPOINT_BB
         FILE *file = fopen(simpoint_file, "r");
         if (file == 0) {
             fprintf(stderr, "could not open simpoint file %s\n", simpoint_file);
             exit(1);
         }
+        if (markers_file) {
+            RISCVCPUState *cpu = s->cpu_state[markers_hart];
+            cpu->bbv           = riscv_bbv_init(NULL, markers_hart, simpoint_size, cpu->pc, cpu->insn_counter);
+        }
         int distance;
         int num;
         while (fscanf(file, "%d %d", &distance, &num) == 2) {
-            uint64_t start = distance * SIMPOINT_SIZE;
+            uint64_t start = distance * simpoint_size;
 
-            if (start == 0) {  // skip boot ROM
+            if (markers_file) {
+                auto it = markers.find(distance);
+                if (it == markers.end()) {
+                    fprintf(stderr, "no marker for simpoint interval %d in %s\n", distance, markers_file);
+                    exit(1);
+                }
+                riscv_bbv_watch(s->cpu_state[markers_hart]->bbv, it->second.pc, it->second.count, it->second.offset, num);
+                printf("simpoint %d starts at execution %" PRIu64 " of 0x%" PRIx64 " on hart %d\n",
+                       num,
+                       it->second.count,
+                       it->second.pc,
+                       markers_hart);
+            } else if (start == 0) {  // skip boot ROM
                 start = ROM_SIZE;
             }
 
@@ -986,8 +1504,10 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
         }
 
         std::sort(s->common.simpoints.begin(), s->common.simpoints.end());
-        for (auto sp : s->common.simpoints) {
-            printf("simpoint %d starts at %dK\n", sp.id, (int)sp.start / 1000);
+        if (!markers_file) {
+            for (auto sp : s->common.simpoints) {
+                printf("simpoint %d starts at %" PRIu64 "K\n", sp.id, sp.start / 1000);
+            }
         }
 
         if (s->common.simpoints.empty()) {
@@ -995,14 +1515,55 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
             exit(1);
         }
         s->common.simpoint_next = 0;
-#else
-        fprintf(stderr, "simpoint flag requires to recompile with SIMPOINT_BB\n");
-        exit(1);
-#endif
+        s->common.simpoint_hart = markers_hart;
+        s->common.simpoint_jobs = simpoint_jobs;
+    }
+
+    if (bbv_file) {
+        // Every hart has its own vectors, FILE.<hartid>[.gz|.zst] with more than one
+        for (int i = 0; i < s->ncpus; ++i) {
+            RISCVCPUState *cpu  = s->cpu_state[i];
+            char *         name = bbv_hart_file(bbv_file, i, s->ncpus);
+            cpu->bbv            = riscv_bbv_init(name, i, simpoint_size, cpu->pc, cpu->insn_counter);
+            free(name);
+            if (!cpu->bbv)
+                return NULL;
+        }
+    }
+
+    if (hash_file) {
+        for (int i = 0; i < s->ncpus; ++i) {
+            char *name            = bbv_hart_file(hash_file, i, s->ncpus);
+            s->cpu_state[i]->hash = riscv_hash_init(name, i, hash_interval);
+            free(name);
+            if (!s->cpu_state[i]->hash)
+                return NULL;
+        }
+    }
+
+    if (proc_stats_file) {
+        s->procstats = riscv_procstats_init(s, proc_stats_file, proc_interval);
+        if (!s->procstats)
+            return NULL;
+    }
+
+    if (telemetry_name) {
+        s->telemetry = riscv_telemetry_init(s, telemetry_name, telemetry_interval);
+        if (!s->telemetry)
+            return NULL;
     }
 
+    if (simpoint_file || bbv_file) {
+        s->common.simpoint      = true;
+        s->common.simpoint_roi  = !simpoint_roi;
+        s->common.simpoint_size = simpoint_size;
+    }
+    /* guests may mark their ROI or stop the run whether or not it is profiled */
+    riscv_csr_register(s, 0x8C2, simpoint_csr_read, simpoint_csr_write, 0, NULL);
+
     s->common.snapshot_save_name = snapshot_save_name;
     s->common.trace              = trace;
+    s->common.trace_filter       = trace_filter;
 
     // Allow the command option argument to overwrite the value
     // specified in the configuration file
@@ -1022,8 +1583,5 @@ RISCVMachine *virt_machine_main(int argc, char **argv) {
     if (s->common.net)
         s->common.net->device_set_carrier(s->common.net, TRUE);
 
-    if (s->common.snapshot_load_name)
-        virt_machine_deserialize(s, s->common.snapshot_load_name);
-
     return s;
 }
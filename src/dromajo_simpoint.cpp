@@ -0,0 +1,396 @@
+/*
+ * SimPoint clustering of the basic block vectors written by --bbv
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Follows SimPoint 3: every interval's vector is normalized and reduced
+ * by a random projection, k-means runs for every k up to --maxk from
+ * several random starts, and the smallest k whose BIC score reaches
+ * --bic_threshold of the best spread is selected.  Each cluster is
+ * represented by the interval closest to its centroid, weighted by the
+ * cluster size.  The (k, seed) runs are independent and spread over
+ * threads; the result does not depend on the number of threads.
+ */
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct Options {
+    int         maxk          = 30;
+    int         dim           = 15;
+    int         seeds         = 5;
+    int         iters         = 100;
+    int         threads       = 0;
+    uint64_t    seed          = 1;
+    double      bic_threshold = 0.9;
+    const char *simpoints     = "simpoints";
+    const char *weights       = "weights";
+    const char *labels        = NULL;
+};
+
+struct Clustering {
+    int              k;
+    double           distortion;
+    double           bic;
+    std::vector<int> label;
+};
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z          = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Projection matrix entry in [-1, 1], computed instead of stored since
+ * the block IDs are unbounded */
+static double projection(uint64_t seed, uint64_t id, int d) {
+    uint64_t x = seed ^ (id * 0x100000001B3ULL + d);
+    return (double)(splitmix64(&x) >> 11) / (double)(1ULL << 52) - 1.0;
+}
+
+/* Opens the vectors, through a decompressor for .gz and .zst names */
+static FILE *open_bbv(const char *filename, bool *is_pipe) {
+    const char *decompressor = NULL;
+    size_t      len          = strlen(filename);
+    char        cmd[1024];
+
+    if (len > 3 && !strcmp(filename + len - 3, ".gz"))
+        decompressor = "gzip -dc";
+    else if (len > 4 && !strcmp(filename + len - 4, ".zst"))
+        decompressor = "zstd -q -dc";
+
+    *is_pipe = decompressor != NULL;
+    if (!decompressor)
+        return fopen(filename, "r");
+
+    if (strchr(filename, '\'') || snprintf(cmd, sizeof cmd, "%s '%s'", decompressor, filename) >= (int)sizeof cmd)
+        return NULL;
+    return popen(cmd, "r");
+}
+
+/* Reads the "T:id:count :id:count ..." lines into projected, normalized
+ * vectors of o.dim dimensions */
+static bool read_bbv(const char *filename, const Options &o, std::vector<double> *points, int *n_points) {
+    bool  is_pipe;
+    FILE *f = open_bbv(filename, &is_pipe);
+    if (!f) {
+        fprintf(stderr, "could not open %s\n", filename);
+        return false;
+    }
+
+    std::vector<std::pair<uint64_t, uint64_t>> v;
+    std::vector<double>                        p(o.dim);
+    int                                        c;
+
+    *n_points = 0;
+    while ((c = getc(f)) != EOF) {
+        if (c != 'T') {
+            /* comments and blank lines */
+            while (c != '\n' && c != EOF) c = getc(f);
+            continue;
+        }
+
+        uint64_t id, count, total = 0;
+        v.clear();
+        while (fscanf(f, " :%" SCNu64 ":%" SCNu64, &id, &count) == 2) {
+            v.push_back({id, count});
+            total += count;
+        }
+
+        std::fill(p.begin(), p.end(), 0.0);
+        for (auto &e : v)
+            for (int d = 0; d < o.dim; ++d) p[d] += (double)e.second / total * projection(o.seed, e.first, d);
+        points->insert(points->end(), p.begin(), p.end());
+        ++*n_points;
+    }
+
+    if (is_pipe)
+        pclose(f);
+    else
+        fclose(f);
+
+    return true;
+}
+
+static double dist2(const double *a, const double *b, int dim) {
+    double s = 0;
+    for (int d = 0; d < dim; ++d) s += (a[d] - b[d]) * (a[d] - b[d]);
+    return s;
+}
+
+/* Lloyd's algorithm from k distinct random intervals */
+static void kmeans(const std::vector<double> &x, int n, int dim, int k, uint64_t seed, int iters, Clustering *r,
+                   std::vector<double> *centers) {
+    std::vector<int> count(k);
+    uint64_t         rng = seed;
+
+    r->k = k;
+    r->label.assign(n, -1);
+    centers->assign((size_t)k * dim, 0.0);
+
+    std::vector<int> picked;
+    while ((int)picked.size() < k) {
+        int i = (int)(splitmix64(&rng) % n);
+        if (std::find(picked.begin(), picked.end(), i) == picked.end())
+            picked.push_back(i);
+    }
+    for (int j = 0; j < k; ++j) {
+        const double *p = &x[(size_t)picked[j] * dim];
+        std::copy(p, p + dim, &(*centers)[(size_t)j * dim]);
+    }
+
+    for (int it = 0; it < iters; ++it) {
+        bool changed = false;
+        for (int i = 0; i < n; ++i) {
+            int    best   = 0;
+            double best_d = dist2(&x[(size_t)i * dim], &(*centers)[0], dim);
+            for (int j = 1; j < k; ++j) {
+                double d = dist2(&x[(size_t)i * dim], &(*centers)[(size_t)j * dim], dim);
+                if (d < best_d) {
+                    best   = j;
+                    best_d = d;
+                }
+            }
+            if (r->label[i] != best) {
+                r->label[i] = best;
+                changed     = true;
+            }
+        }
+        if (!changed)
+            break;
+
+        /* empty clusters keep their previous center */
+        std::vector<double> sum((size_t)k * dim, 0.0);
+        std::fill(count.begin(), count.end(), 0);
+        for (int i = 0; i < n; ++i) {
+            count[r->label[i]]++;
+            for (int d = 0; d < dim; ++d) sum[(size_t)r->label[i] * dim + d] += x[(size_t)i * dim + d];
+        }
+        for (int j = 0; j < k; ++j)
+            if (count[j])
+                for (int d = 0; d < dim; ++d) (*centers)[(size_t)j * dim + d] = sum[(size_t)j * dim + d] / count[j];
+    }
+
+    r->distortion = 0;
+    for (int i = 0; i < n; ++i) r->distortion += dist2(&x[(size_t)i * dim], &(*centers)[(size_t)r->label[i] * dim], dim);
+}
+
+/* BIC of a spherical Gaussian mixture, as in X-means (Pelleg and Moore) */
+static double bic(const Clustering &r, int n, int dim) {
+    std::vector<int> count(r.k);
+    for (int i = 0; i < n; ++i) count[r.label[i]]++;
+
+    double variance = n > r.k ? r.distortion / (n - r.k) : 0.0;
+    if (variance <= 0)
+        variance = 1e-300;
+
+    double loglik = 0;
+    for (int j = 0; j < r.k; ++j) {
+        if (!count[j])
+            continue;
+        loglik += count[j] * log((double)count[j]) - count[j] * log((double)n)
+                  - count[j] * dim / 2.0 * log(2 * M_PI * variance) - (count[j] - 1) * dim / 2.0;
+    }
+
+    double params = (r.k - 1) + (double)r.k * dim + 1;
+    return loglik - params / 2.0 * log((double)n);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s {options} bbv-file\n"
+            "       --maxk N largest number of clusters (default 30)\n"
+            "       --dim N dimensions of the random projection (default 15)\n"
+            "       --seeds N k-means starts per k (default 5)\n"
+            "       --iters N k-means iterations limit (default 100)\n"
+            "       --threads N worker threads (default all cores)\n"
+            "       --seed N random seed (default 1)\n"
+            "       --bic_threshold F pick the smallest k within F of the BIC spread (default 0.9)\n"
+            "       --simpoints FILE selected intervals (default simpoints)\n"
+            "       --weights FILE cluster weights (default weights)\n"
+            "       --labels FILE cluster and distance to its centroid of every interval\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    Options o;
+
+    for (;;) {
+        int option_index = 0;
+        // clang-format off
+        static struct option long_options[] = {
+            {"maxk",                    required_argument, 0,  'k' },
+            {"dim",                     required_argument, 0,  'd' },
+            {"seeds",                   required_argument, 0,  'n' },
+            {"iters",                   required_argument, 0,  'i' },
+            {"threads",                 required_argument, 0,  'j' },
+            {"seed",                    required_argument, 0,  'r' },
+            {"bic_threshold",           required_argument, 0,  'b' },
+            {"simpoints",               required_argument, 0,  's' },
+            {"weights",                 required_argument, 0,  'w' },
+            {"labels",                  required_argument, 0,  'l' },
+            {0,                         0,                 0,  0 }
+        };
+        // clang-format on
+
+        int c = getopt_long(argc, argv, "", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'k': o.maxk = atoi(optarg); break;
+            case 'd': o.dim = atoi(optarg); break;
+            case 'n': o.seeds = atoi(optarg); break;
+            case 'i': o.iters = atoi(optarg); break;
+            case 'j': o.threads = atoi(optarg); break;
+            case 'r': o.seed = strtoull(optarg, NULL, 0); break;
+            case 'b': o.bic_threshold = atof(optarg); break;
+            case 's': o.simpoints = optarg; break;
+            case 'w': o.weights = optarg; break;
+            case 'l': o.labels = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc || o.maxk < 1 || o.dim < 1 || o.seeds < 1 || o.iters < 1)
+        usage(argv[0]);
+
+    std::vector<double> x;
+    int                 n;
+    if (!read_bbv(argv[optind], o, &x, &n))
+        return EXIT_FAILURE;
+    if (n == 0) {
+        fprintf(stderr, "%s has no intervals\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    int maxk      = std::min(o.maxk, n);
+    int n_threads = o.threads > 0 ? o.threads : (int)std::thread::hardware_concurrency();
+    if (n_threads < 1)
+        n_threads = 1;
+
+    /* one job per (k, seed), the best of the seeds is kept for every k */
+    int                      n_jobs = maxk * o.seeds;
+    std::vector<Clustering>  runs(n_jobs);
+    std::atomic<int>         next_job(0);
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < std::min(n_threads, n_jobs); ++t)
+        workers.emplace_back([&]() {
+            std::vector<double> centers;
+            for (int job; (job = next_job++) < n_jobs;) {
+                int      k    = job / o.seeds + 1;
+                uint64_t seed = o.seed * 1000003 + job;
+                kmeans(x, n, o.dim, k, seed, o.iters, &runs[job], &centers);
+                runs[job].bic = bic(runs[job], n, o.dim);
+            }
+        });
+    for (auto &w : workers) w.join();
+
+    std::vector<Clustering *> best(maxk + 1);
+    for (auto &r : runs)
+        if (!best[r.k] || r.distortion < best[r.k]->distortion)
+            best[r.k] = &r;
+
+    double min_bic = best[1]->bic, max_bic = best[1]->bic;
+    for (int k = 2; k <= maxk; ++k) {
+        min_bic = std::min(min_bic, best[k]->bic);
+        max_bic = std::max(max_bic, best[k]->bic);
+    }
+
+    Clustering *pick = best[maxk];
+    for (int k = 1; k <= maxk; ++k)
+        if (best[k]->bic >= min_bic + o.bic_threshold * (max_bic - min_bic)) {
+            pick = best[k];
+            break;
+        }
+
+    /* the representative of every cluster is the interval nearest its centroid */
+    std::vector<double> centers((size_t)pick->k * o.dim, 0.0);
+    std::vector<int>    count(pick->k);
+    for (int i = 0; i < n; ++i) {
+        count[pick->label[i]]++;
+        for (int d = 0; d < o.dim; ++d) centers[(size_t)pick->label[i] * o.dim + d] += x[(size_t)i * o.dim + d];
+    }
+    for (int j = 0; j < pick->k; ++j)
+        for (int d = 0; d < o.dim && count[j]; ++d) centers[(size_t)j * o.dim + d] /= count[j];
+
+    std::vector<int>    rep(pick->k, -1);
+    std::vector<double> rep_d(pick->k);
+    for (int i = 0; i < n; ++i) {
+        int    j = pick->label[i];
+        double d = dist2(&x[(size_t)i * o.dim], &centers[(size_t)j * o.dim], o.dim);
+        if (rep[j] < 0 || d < rep_d[j]) {
+            rep[j]   = i;
+            rep_d[j] = d;
+        }
+    }
+
+    FILE *sf = fopen(o.simpoints, "w");
+    FILE *wf = fopen(o.weights, "w");
+    if (!sf || !wf) {
+        fprintf(stderr, "could not open %s/%s for writing\n", o.simpoints, o.weights);
+        return EXIT_FAILURE;
+    }
+    /* empty clusters are dropped, the others are numbered from 0 */
+    std::vector<int> cluster_id(pick->k, -1);
+    int              id = 0;
+    for (int j = 0; j < pick->k; ++j) {
+        if (!count[j])
+            continue;
+        cluster_id[j] = id;
+        fprintf(sf, "%d %d\n", rep[j], id);
+        fprintf(wf, "%.6f %d\n", (double)count[j] / n, id);
+        ++id;
+    }
+    fclose(sf);
+    fclose(wf);
+
+    if (o.labels) {
+        FILE *lf = fopen(o.labels, "w");
+        if (!lf) {
+            fprintf(stderr, "could not open %s for writing\n", o.labels);
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < n; ++i) {
+            int j = pick->label[i];
+            fprintf(lf, "%d %g\n", cluster_id[j], sqrt(dist2(&x[(size_t)i * o.dim], &centers[(size_t)j * o.dim], o.dim)));
+        }
+        fclose(lf);
+    }
+
+    fprintf(stderr,
+            "%d intervals, k=%d (BIC %.1f, range %.1f..%.1f), %d runs on %d threads\n",
+            n,
+            id,
+            pick->bic,
+            min_bic,
+            max_bic,
+            n_jobs,
+            std::min(n_threads, n_jobs));
+
+    return EXIT_SUCCESS;
+}
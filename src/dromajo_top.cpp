@@ -0,0 +1,146 @@
+/*
+ * Live view of a dromajo run published with --telemetry
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Maps the telemetry page read-only and prints it every few seconds,
+ * until the run is over or the count of refreshes is reached.  Only the
+ * page is read, so any number of monitors can watch the same run.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "riscv_telemetry.h"
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-d SECONDS] [-n COUNT] NAME\n"
+            "       shows the statistics of the dromajo run started with --telemetry NAME\n"
+            "       -d SECONDS between refreshes (default 1)\n"
+            "       -n COUNT refreshes, then exit (default until the run is over)\n",
+            prog);
+    exit(2);
+}
+
+static double percent(uint64_t n, uint64_t total) { return total ? 100.0 * n / total : 0; }
+
+static void show(const RISCVTelemetryPage *p, bool clear) {
+    static const char prv[] = "US?M";
+
+    if (clear)
+        fputs("\033[H\033[2J", stdout);
+
+    double elapsed = (p->update_ns - p->start_ns) / 1e9;
+    printf("dromajo pid %u, %s, %.1f s, %.2f MIPS\n", p->pid, p->running ? "running" : "over", elapsed, p->mips);
+    if (p->simpoints_total)
+        printf("simpoints %" PRIu64 "/%" PRIu64 " written, next id %" PRId64 "\n",
+               p->simpoints_done,
+               p->simpoints_total,
+               p->simpoint);
+    if (p->llc_accesses)
+        printf("LLC %" PRIu64 " accesses, %.2f%% misses\n", p->llc_accesses, percent(p->llc_misses, p->llc_accesses));
+
+    printf("\n%4s %14s %6s %6s %6s %10s %10s %4s %-18s %7s %7s\n",
+           "hart", "instructions", "user%", "sup%", "mach%", "exceptions", "interrupts", "priv", "pc", "imiss%", "dmiss%");
+    for (uint32_t i = 0; i < p->nharts && i < RISCV_TELEMETRY_MAX_HARTS; ++i) {
+        const RISCVTelemetryHart *h = &p->harts[i];
+        uint64_t                  n = h->insns_by_priv[0] + h->insns_by_priv[1] + h->insns_by_priv[3];
+
+        printf("%4u %14" PRIu64 " %6.1f %6.1f %6.1f %10" PRIu64 " %10" PRIu64 " %4c 0x%016" PRIx64,
+               i,
+               h->insns,
+               percent(h->insns_by_priv[0], n),
+               percent(h->insns_by_priv[1], n),
+               percent(h->insns_by_priv[3], n),
+               h->exceptions,
+               h->interrupts,
+               prv[h->priv & 3],
+               h->pc);
+        if (h->icache_accesses || h->dcache_accesses)
+            printf(" %7.2f %7.2f",
+                   percent(h->icache_misses, h->icache_accesses),
+                   percent(h->dcache_misses, h->dcache_accesses));
+        putchar('\n');
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    double delay = 1;
+    long   count = -1;
+    int    c;
+
+    while ((c = getopt(argc, argv, "d:n:")) != -1) {
+        switch (c) {
+            case 'd': delay = atof(optarg); break;
+            case 'n': count = atol(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || delay <= 0)
+        usage(argv[0]);
+
+    const char *name = argv[optind];
+    char *      path = (char *)malloc(strlen(name) + 2);
+    sprintf(path, "%s%s", strchr(name, '/') ? "" : "/", name);
+
+    int         fd = shm_open(path, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "no dromajo run publishes %s\n", path);
+        return 2;
+    }
+    if ((size_t)st.st_size < sizeof(RISCVTelemetryPage)) {
+        fprintf(stderr, "%s is not a dromajo telemetry page\n", path);
+        return 2;
+    }
+    const RISCVTelemetryPage *page
+        = (const RISCVTelemetryPage *)mmap(NULL, sizeof(RISCVTelemetryPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        fprintf(stderr, "could not map %s\n", path);
+        return 2;
+    }
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != RISCV_TELEMETRY_MAGIC
+        || page->version != RISCV_TELEMETRY_VERSION) {
+        fprintf(stderr, "%s is not a version %d dromajo telemetry page\n", path, RISCV_TELEMETRY_VERSION);
+        return 2;
+    }
+
+    bool clear = isatty(STDOUT_FILENO);
+    for (long i = 0; count < 0 || i < count; ++i) {
+        RISCVTelemetryPage p;
+        while (!riscv_telemetry_read(page, &p)) usleep(100);
+
+        if (i && !clear)
+            putchar('\n');
+        show(&p, clear);
+
+        /* the page stays mapped after a crash, which never says so */
+        if (!p.running || (kill(p.pid, 0) < 0 && errno == ESRCH))
+            break;
+        usleep(delay * 1e6);
+    }
+
+    return 0;
+}
@@ -60,24 +60,24 @@ uint64_t elf64_get_entrypoint(const uint8_t *image) {
     return ehdr->e_entry;
 }
 
-bool elf64_find_global(const uint8_t *image, size_t image_size, const char *key, uint64_t *value) {
+static const Elf64_Sym *find_symbol(const uint8_t *image, size_t image_size, const char *key, bool global_only) {
     const uint8_t *image_end = image + image_size;
     Elf64_Ehdr *   ehdr      = (Elf64_Ehdr *)image;
 
     if (ehdr->e_shoff + sizeof(Elf64_Shdr) - 1 > image_size)
-        return false;
+        return NULL;
 
     Elf64_Shdr *shdr = (Elf64_Shdr *)&image[ehdr->e_shoff];
 
     if ((const uint8_t *)&shdr[ehdr->e_shstrndx + 1] > image_end)
-        return false;
+        return NULL;
 
     const Elf64_Sym *symtab     = 0;
     int              symtab_len = 0;
     const char *     strtab     = 0;
 
     if ((const uint8_t *)&shdr[ehdr->e_shnum] > image_end)
-        return false;
+        return NULL;
 
     /* Look for symbol table */
     for (int i = 0; i < ehdr->e_shnum; ++i) {
@@ -94,17 +94,36 @@ bool elf64_find_global(const uint8_t *image, size_t image_size, const char *key,
 
     if (symtab && strtab) {
         if ((const uint8_t *)&symtab[symtab_len] > image_end)
-            return false;
+            return NULL;
 
         for (int i = 0; i < symtab_len; ++i) {
             const Elf64_Sym *sym = &symtab[i];
 
-            if (strcmp(key, strtab + sym->st_name) == 0 && ELF32_ST_BIND(sym->st_info) == STB_GLOBAL) {
-                *value = sym->st_value;
-                return true;
-            }
+            if (strcmp(key, strtab + sym->st_name) != 0)
+                continue;
+            if (global_only ? ELF32_ST_BIND(sym->st_info) == STB_GLOBAL : sym->st_shndx != SHN_UNDEF)
+                return sym;
         }
     }
 
-    return false;
+    return NULL;
+}
+
+bool elf64_find_global(const uint8_t *image, size_t image_size, const char *key, uint64_t *value) {
+    const Elf64_Sym *sym = find_symbol(image, image_size, key, true);
+
+    if (!sym)
+        return false;
+    *value = sym->st_value;
+    return true;
+}
+
+bool elf64_find_symbol(const uint8_t *image, size_t image_size, const char *key, uint64_t *value, uint64_t *size) {
+    const Elf64_Sym *sym = find_symbol(image, image_size, key, false);
+
+    if (!sym)
+        return false;
+    *value = sym->st_value;
+    *size  = sym->st_size;
+    return true;
 }
@@ -125,6 +125,61 @@ static void vm_get_uint64_opt(JSONValue obj, const char *name, uint64_t *pval) {
     *pval = (uint64_t)val.u.int64;
 }
 
+static void vm_get_int_opt(JSONValue obj, const char *name, int *pval) {
+    uint64_t val = *pval;
+    vm_get_uint64_opt(obj, name, &val);
+    *pval = (int)val;
+}
+
+static void vm_get_bool_opt(JSONValue obj, const char *name, bool *pval) {
+    JSONValue val = json_object_get(obj, name);
+
+    if (json_is_undefined(val))
+        return;
+
+    if (val.type != JSON_BOOL) {
+        vm_error("%s: boolean expected\n", name);
+        return;
+    }
+
+    *pval = val.u.b;
+}
+
+/*
+ * Optional "timing" object enabling the approximate timing model.
+ * Every field is optional and defaults to riscv_timing_set_defaults().
+ */
+static int vm_get_timing_opt(JSONValue cfg, VirtMachineParams *p) {
+    JSONValue obj = json_object_get(cfg, "timing");
+
+    if (json_is_undefined(obj))
+        return 0;
+
+    if (obj.type != JSON_OBJ) {
+        vm_error("%s: object expected\n", "timing");
+        return -1;
+    }
+
+    RISCVTimingParams *t = &p->timing_params;
+    vm_get_int_opt(obj, "alu", &t->latency[TIMING_CLASS_ALU]);
+    vm_get_int_opt(obj, "mul", &t->latency[TIMING_CLASS_MUL]);
+    vm_get_int_opt(obj, "div", &t->latency[TIMING_CLASS_DIV]);
+    vm_get_int_opt(obj, "load", &t->latency[TIMING_CLASS_LOAD]);
+    vm_get_int_opt(obj, "store", &t->latency[TIMING_CLASS_STORE]);
+    vm_get_int_opt(obj, "amo", &t->latency[TIMING_CLASS_AMO]);
+    vm_get_int_opt(obj, "fp", &t->latency[TIMING_CLASS_FP]);
+    vm_get_int_opt(obj, "fdiv", &t->latency[TIMING_CLASS_FDIV]);
+    vm_get_int_opt(obj, "branch", &t->latency[TIMING_CLASS_BRANCH]);
+    vm_get_int_opt(obj, "system", &t->latency[TIMING_CLASS_SYSTEM]);
+    vm_get_int_opt(obj, "icache_size", &t->icache_size);
+    vm_get_int_opt(obj, "dcache_size", &t->dcache_size);
+    vm_get_int_opt(obj, "miss_penalty", &t->miss_penalty);
+    vm_get_int_opt(obj, "mispredict_penalty", &t->mispredict_penalty);
+
+    p->timing = true;
+    return 0;
+}
+
 /*
  * Look for string property in the JSON object and allocate a copy if
  * found.  The parameter is_opt dermines if abscene is a failure, or
@@ -157,6 +212,77 @@ static int vm_get_str(JSONValue obj, const char *name, char **pstr) { return vm_
 
 static int vm_get_str_opt(JSONValue obj, const char *name, char **pstr) { return vm_get_str2(obj, name, pstr, TRUE); }
 
+/*
+ * Optional "bpred" object selecting and sizing the branch predictor
+ * model, see riscv_bpred_set_defaults() for the defaults.
+ */
+static int vm_get_bpred_opt(JSONValue cfg, VirtMachineParams *p) {
+    JSONValue obj = json_object_get(cfg, "bpred");
+
+    if (json_is_undefined(obj))
+        return 0;
+
+    if (obj.type != JSON_OBJ) {
+        vm_error("%s: object expected\n", "bpred");
+        return -1;
+    }
+
+    RISCVBPredParams *b    = &p->bpred_params;
+    char *            type = NULL;
+    if (vm_get_str_opt(obj, "type", &type) < 0)
+        return -1;
+    b->type = BPRED_BIMODAL;
+    if (type && riscv_bpred_parse_type(type, &b->type) < 0) {
+        vm_error("bpred: unknown type '%s'\n", type);
+        free(type);
+        return -1;
+    }
+    free(type);
+
+    vm_get_int_opt(obj, "entries", &b->entries);
+    vm_get_int_opt(obj, "history", &b->history);
+    vm_get_int_opt(obj, "tage_tables", &b->tage_tables);
+    vm_get_int_opt(obj, "tage_entries", &b->tage_entries);
+    vm_get_int_opt(obj, "btb_entries", &b->btb_entries);
+    vm_get_int_opt(obj, "btb_ways", &b->btb_ways);
+    vm_get_int_opt(obj, "ras_entries", &b->ras_entries);
+    vm_get_int_opt(obj, "report", &b->report);
+    if (vm_get_str_opt(obj, "stats_file", &b->stats_file) < 0)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Optional "tlb" object enabling the target TLB model, see
+ * riscv_tlbmodel_set_defaults() for the defaults.
+ */
+static int vm_get_tlbmodel_opt(JSONValue cfg, VirtMachineParams *p) {
+    JSONValue obj = json_object_get(cfg, "tlb");
+
+    if (json_is_undefined(obj))
+        return 0;
+
+    if (obj.type != JSON_OBJ) {
+        vm_error("%s: object expected\n", "tlb");
+        return -1;
+    }
+
+    RISCVTLBModelParams *t = &p->tlbmodel_params;
+    vm_get_int_opt(obj, "itlb_entries", &t->itlb_entries);
+    vm_get_int_opt(obj, "itlb_ways", &t->itlb_ways);
+    vm_get_int_opt(obj, "dtlb_entries", &t->dtlb_entries);
+    vm_get_int_opt(obj, "dtlb_ways", &t->dtlb_ways);
+    vm_get_int_opt(obj, "l2tlb_entries", &t->l2tlb_entries);
+    vm_get_int_opt(obj, "l2tlb_ways", &t->l2tlb_ways);
+    vm_get_bool_opt(obj, "superpages", &t->superpages);
+    vm_get_bool_opt(obj, "asid", &t->asid);
+    vm_get_bool_opt(obj, "walk_to_cache", &t->walk_to_cache);
+
+    p->tlbmodel = true;
+    return 0;
+}
+
 /* currently only for "TZ" */
 static char *cmdline_subst(const char *cmdline) {
     DynBuf      dbuf;
@@ -368,6 +494,13 @@ static int virt_machine_parse_config(VirtMachineParams *p, char *config_file_str
 
     vm_get_uint64_opt(cfg, "physical_addr_len", &p->physical_addr_len);
 
+    if (vm_get_timing_opt(cfg, p) < 0)
+        goto tag_fail;
+    if (vm_get_bpred_opt(cfg, p) < 0)
+        goto tag_fail;
+    if (vm_get_tlbmodel_opt(cfg, p) < 0)
+        goto tag_fail;
+
     if (vm_get_str_opt(cfg, "logfile", &p->logfile) < 0)
         goto tag_fail;
     if (vm_get_str_opt(cfg, "bootrom", &p->bootrom_name) < 0)
@@ -0,0 +1,165 @@
+/*
+ * Record and replay of the nondeterministic inputs
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "replay.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cutils.h"
+#include "dromajo.h"
+#include "riscv_machine.h"
+
+#define REPLAY_MAX_DATA 256
+
+/* Log lines: "console <read index> <hart> <insn_counter> <hex data>" */
+struct Replay {
+    FILE *           f;
+    bool             record;
+    CharacterDevice  dev;
+    CharacterDevice *host;
+    RISCVMachine *   m;
+    uint64_t         reads;
+    bool             diverged;
+
+    /* replay: the next logged read */
+    bool     has_next;
+    uint64_t next_read;
+    int      next_hart;
+    uint64_t next_icount;
+    uint8_t  next_data[REPLAY_MAX_DATA];
+    int      next_len;
+};
+
+static void replay_position(Replay *r, int *hart, uint64_t *icount) {
+    *hart   = r->m ? r->m->common.current_hart : 0;
+    *icount = r->m ? r->m->cpu_state[*hart]->insn_counter : 0;
+}
+
+static void replay_load_next(Replay *r) {
+    char line[32 + 2 * REPLAY_MAX_DATA + 64];
+    char hex[2 * REPLAY_MAX_DATA + 1];
+
+    r->has_next = false;
+    while (fgets(line, sizeof line, r->f)) {
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "console %" SCNu64 " %d %" SCNu64 " %512s", &r->next_read, &r->next_hart, &r->next_icount, hex) != 4) {
+            fprintf(dromajo_stderr, "replay: invalid event: %s", line);
+            return;
+        }
+        r->next_len = 0;
+        for (const char *p = hex; p[0] && p[1] && r->next_len < REPLAY_MAX_DATA; p += 2) {
+            unsigned v;
+            sscanf(p, "%2x", &v);
+            r->next_data[r->next_len++] = v;
+        }
+        r->has_next = true;
+        return;
+    }
+}
+
+static int replay_read_data(void *opaque, uint8_t *buf, int len) {
+    Replay * r = (Replay *)opaque;
+    int      hart;
+    uint64_t icount;
+
+    r->reads++;
+
+    if (r->record) {
+        int n = r->host->read_data(r->host->opaque, buf, len);
+        if (n > 0) {
+            replay_position(r, &hart, &icount);
+            fprintf(r->f, "console %" PRIu64 " %d %" PRIu64 " ", r->reads, hart, icount);
+            for (int i = 0; i < n; ++i) fprintf(r->f, "%02x", buf[i]);
+            fputc('\n', r->f);
+        }
+        return n;
+    }
+
+    if (!r->has_next || r->next_read != r->reads)
+        return 0;
+
+    replay_position(r, &hart, &icount);
+    if (!r->diverged && (hart != r->next_hart || icount != r->next_icount)) {
+        fprintf(dromajo_stderr,
+                "replay: diverged at console read %" PRIu64 ": hart %d instruction %" PRIu64 ", recorded hart %d instruction %" PRIu64
+                "\n",
+                r->reads,
+                hart,
+                icount,
+                r->next_hart,
+                r->next_icount);
+        r->diverged = true;
+    }
+
+    int n = r->next_len < len ? r->next_len : len;
+    memcpy(buf, r->next_data, n);
+    replay_load_next(r);
+    return n;
+}
+
+static void replay_write_data(void *opaque, const uint8_t *buf, int len) {
+    Replay *r = (Replay *)opaque;
+    r->host->write_data(r->host->opaque, buf, len);
+}
+
+static void replay_writev_data(void *opaque, const struct iovec *iov, int iovcnt) {
+    Replay *r = (Replay *)opaque;
+    if (r->host->writev_data)
+        r->host->writev_data(r->host->opaque, iov, iovcnt);
+    else
+        for (int i = 0; i < iovcnt; ++i) r->host->write_data(r->host->opaque, (const uint8_t *)iov[i].iov_base, iov[i].iov_len);
+}
+
+Replay *replay_init(const char *filename, bool record, CharacterDevice *console) {
+    FILE *f = fopen(filename, record ? "w" : "r");
+    if (!f) {
+        vm_error("could not open %s to %s\n", filename, record ? "record" : "replay");
+        return NULL;
+    }
+
+    Replay *r = (Replay *)mallocz(sizeof *r);
+
+    r->f              = f;
+    r->record         = record;
+    r->host           = console;
+    r->dev.opaque      = r;
+    r->dev.write_data  = replay_write_data;
+    r->dev.read_data   = replay_read_data;
+    r->dev.writev_data = replay_writev_data;
+
+    if (record)
+        fprintf(f, "# dromajo input log: console <read> <hart> <insn_counter> <data>\n");
+    else
+        replay_load_next(r);
+
+    return r;
+}
+
+void replay_end(Replay *r) {
+    if (!r->record && r->has_next)
+        fprintf(dromajo_stderr, "replay: the run ended before console read %" PRIu64 "\n", r->next_read);
+    fclose(r->f);
+    free(r);
+}
+
+CharacterDevice *replay_console(Replay *r) { return &r->dev; }
+
+void replay_set_machine(Replay *r, RISCVMachine *m) { r->m = m; }
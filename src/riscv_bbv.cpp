@@ -0,0 +1,295 @@
+/*
+ * Basic block vector collection for SimPoint
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_bbv.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "cutils.h"
+#include "dromajo.h"
+#include "riscv_machine.h"
+
+#define BBV_INITIAL_BITS 12
+#define BBV_EMPTY        (~(uint64_t)0)
+#define BBV_BUF_SIZE     (1 << 20)
+
+static inline uint32_t bbv_hash(uint64_t pc, uint32_t bits) {
+    return (uint32_t)(((pc >> 1) * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+static void bbv_alloc_table(RISCVBBV *bbv, uint32_t bits) {
+    uint32_t size = 1u << bits;
+
+    bbv->table_bits = bits;
+    bbv->table      = (RISCVBBVSlot *)malloc(size * sizeof *bbv->table);
+    bbv->touched    = (uint32_t *)malloc(size / 2 * sizeof *bbv->touched);
+    for (uint32_t i = 0; i < size; ++i) bbv->table[i].pc = BBV_EMPTY;
+}
+
+static uint32_t bbv_find(RISCVBBV *bbv, uint64_t pc) {
+    uint32_t mask = (1u << bbv->table_bits) - 1;
+    uint32_t i    = bbv_hash(pc, bbv->table_bits);
+
+    while (bbv->table[i].pc != pc && bbv->table[i].pc != BBV_EMPTY) i = (i + 1) & mask;
+
+    return i;
+}
+
+/* Doubles the table, keeping the IDs and counts */
+static void bbv_grow(RISCVBBV *bbv) {
+    RISCVBBVSlot *old      = bbv->table;
+    uint32_t      old_size = 1u << bbv->table_bits;
+
+    free(bbv->touched);
+    bbv_alloc_table(bbv, bbv->table_bits + 1);
+    bbv->n_touched = 0;
+
+    for (uint32_t i = 0; i < old_size; ++i) {
+        if (old[i].pc == BBV_EMPTY)
+            continue;
+        uint32_t j    = bbv_find(bbv, old[i].pc);
+        bbv->table[j] = old[i];
+        if (old[i].count)
+            bbv->touched[bbv->n_touched++] = j;
+    }
+    free(old);
+}
+
+static void bbv_flush(RISCVBBV *bbv) {
+    if (bbv->buf_len && fwrite(bbv->buf, 1, bbv->buf_len, bbv->f) != bbv->buf_len)
+        vm_error("bbv: write error\n");
+    bbv->buf_len = 0;
+}
+
+static inline void bbv_put_char(RISCVBBV *bbv, char c) { bbv->buf[bbv->buf_len++] = c; }
+
+static inline void bbv_put_u64(RISCVBBV *bbv, uint64_t v) {
+    char  tmp[20];
+    char *p = tmp + sizeof tmp;
+
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    memcpy(bbv->buf + bbv->buf_len, p, tmp + sizeof tmp - p);
+    bbv->buf_len += tmp + sizeof tmp - p;
+}
+
+static void bbv_dump(RISCVBBV *bbv) {
+    if (bbv->n_touched == 0)
+        return;
+
+    bbv_put_char(bbv, 'T');
+    for (uint32_t i = 0; i < bbv->n_touched; ++i) {
+        RISCVBBVSlot *e = &bbv->table[bbv->touched[i]];
+
+        /* ":id:count " is at most 33 characters */
+        if (bbv->buf_len + 34 > BBV_BUF_SIZE)
+            bbv_flush(bbv);
+        bbv_put_char(bbv, ':');
+        bbv_put_u64(bbv, e->id);
+        bbv_put_char(bbv, ':');
+        bbv_put_u64(bbv, e->count);
+        bbv_put_char(bbv, ' ');
+        e->count = 0;
+    }
+    bbv_put_char(bbv, '\n');
+
+    bbv->n_touched = 0;
+    bbv->n_intervals++;
+}
+
+/* Opens the output, through a compressor for .gz and .zst names */
+static FILE *bbv_open(const char *filename, bool *is_pipe) {
+    const char *compressor = NULL;
+    size_t      len        = strlen(filename);
+    char        cmd[1024];
+
+    if (len > 3 && !strcmp(filename + len - 3, ".gz"))
+        compressor = "gzip -c";
+    else if (len > 4 && !strcmp(filename + len - 4, ".zst"))
+        compressor = "zstd -q -c";
+
+    *is_pipe = compressor != NULL;
+    if (!compressor)
+        return fopen(filename, "w");
+
+    if (strchr(filename, '\'') || snprintf(cmd, sizeof cmd, "%s > '%s'", compressor, filename) >= (int)sizeof cmd)
+        return NULL;
+    return popen(cmd, "w");
+}
+
+/* The markers are never compressed: FILE[.gz|.zst] -> FILE.markers */
+static FILE *bbv_open_markers(const char *filename, int hartid) {
+    size_t len = strlen(filename);
+    char * name;
+
+    if (len > 3 && !strcmp(filename + len - 3, ".gz"))
+        len -= 3;
+    else if (len > 4 && !strcmp(filename + len - 4, ".zst"))
+        len -= 4;
+
+    name = (char *)alloca(len + 16);
+    memcpy(name, filename, len);
+    strcpy(name + len, ".markers");
+
+    FILE *f = fopen(name, "w");
+    if (!f) {
+        vm_error("could not open %s for the simpoint markers\n", name);
+        return NULL;
+    }
+    fprintf(f, "# interval pc count offset\n");
+    fprintf(f, "# hart %d\n", hartid);
+
+    return f;
+}
+
+RISCVBBV *riscv_bbv_init(const char *filename, int hartid, uint64_t interval, uint64_t pc, uint64_t icount) {
+    RISCVBBV *bbv = (RISCVBBV *)mallocz(sizeof *bbv);
+
+    bbv->interval     = interval;
+    bbv->block_pc     = pc;
+    bbv->block_icount = icount;
+    if (!filename)
+        return bbv;
+
+    bool is_pipe;
+    bbv->f = bbv_open(filename, &is_pipe);
+    if (!bbv->f) {
+        vm_error("could not open %s for the basic block vectors\n", filename);
+        free(bbv);
+        return NULL;
+    }
+    bbv->markers = bbv_open_markers(filename, hartid);
+    if (!bbv->markers) {
+        if (is_pipe)
+            pclose(bbv->f);
+        else
+            fclose(bbv->f);
+        free(bbv);
+        return NULL;
+    }
+
+    bbv->f_is_pipe = is_pipe;
+    bbv->buf       = (char *)malloc(BBV_BUF_SIZE);
+    bbv_alloc_table(bbv, BBV_INITIAL_BITS);
+
+    return bbv;
+}
+
+void riscv_bbv_end(RISCVBBV *bbv) {
+    if (bbv->f) {
+        /* the last, partial, interval */
+        bbv_dump(bbv);
+        fprintf(dromajo_stderr,
+                "bbv: %" PRIu64 " intervals of %" PRIu64 " instructions, %u basic blocks\n",
+                bbv->n_intervals,
+                bbv->interval,
+                bbv->n_blocks);
+
+        bbv_flush(bbv);
+        if (bbv->f_is_pipe)
+            pclose(bbv->f);
+        else
+            fclose(bbv->f);
+        fclose(bbv->markers);
+    }
+    free(bbv->buf);
+    free(bbv->table);
+    free(bbv->touched);
+    free(bbv->watch);
+    free(bbv);
+}
+
+void riscv_bbv_watch(RISCVBBV *bbv, uint64_t pc, uint64_t count, uint64_t offset, int id) {
+    bbv->watch = (RISCVBBVMarker *)realloc(bbv->watch, (bbv->n_watch + 1) * sizeof *bbv->watch);
+    bbv->watch[bbv->n_watch++] = RISCVBBVMarker{pc, count, offset, 0, id};
+}
+
+/* Counts the executions of the watched blocks the same way as the
+ * profile does: blocks entered inside the ROI that retire at least one
+ * instruction (a fault on the first instruction is not an execution). */
+static void bbv_watch_exit(RISCVBBV *bbv, uint64_t next_pc, uint64_t icount, uint64_t n_insn, bool in_roi) {
+    for (int i = 0; i < bbv->n_watch; ++i) {
+        RISCVBBVMarker *w = &bbv->watch[i];
+
+        if (w->pc == bbv->block_pc && bbv->block_in_roi && n_insn == 0 && w->seen <= w->count)
+            w->seen--;
+
+        if (in_roi && w->pc == next_pc && ++w->seen == w->count) {
+            bbv->hit_pending = true;
+            bbv->hit_id      = w->id;
+            bbv->hit_icount  = icount + w->offset;
+        }
+    }
+}
+
+void riscv_bbv_block_exit(RISCVBBV *bbv, uint64_t next_pc, uint64_t icount, bool in_roi) {
+    uint64_t n_insn = icount - bbv->block_icount;
+
+    if (bbv->n_watch)
+        bbv_watch_exit(bbv, next_pc, icount, n_insn, in_roi);
+
+    if (bbv->f && in_roi && n_insn) {
+        uint32_t i = bbv_find(bbv, bbv->block_pc);
+        if (bbv->table[i].pc == BBV_EMPTY) {
+            /* keep the load factor at or below 1/2 */
+            if (bbv->n_blocks + 1 > (1u << bbv->table_bits) / 2) {
+                bbv_grow(bbv);
+                i = bbv_find(bbv, bbv->block_pc);
+            }
+            bbv->table[i].pc    = bbv->block_pc;
+            bbv->table[i].count = 0;
+            bbv->table[i].execs = 0;
+            bbv->table[i].id    = ++bbv->n_blocks;
+        }
+        bbv->table[i].execs++;
+
+        /* blocks crossing an interval boundary are split so that every
+         * interval holds exactly `interval` instructions */
+        uint64_t offset = 0;
+        while (n_insn) {
+            uint64_t n = std::min(n_insn, bbv->interval - bbv->interval_insns);
+            if (bbv->interval_insns == 0)
+                fprintf(bbv->markers,
+                        "%" PRIu64 " 0x%" PRIx64 " %" PRIu64 " %" PRIu64 "\n",
+                        bbv->n_intervals,
+                        bbv->block_pc,
+                        bbv->table[i].execs,
+                        offset);
+            if (bbv->table[i].count == 0)
+                bbv->touched[bbv->n_touched++] = i;
+            bbv->table[i].count += n;
+            bbv->interval_insns += n;
+            n_insn -= n;
+            offset += n;
+
+            if (bbv->interval_insns == bbv->interval) {
+                bbv_dump(bbv);
+                bbv->interval_insns = 0;
+            }
+        }
+    }
+
+    bbv->block_pc     = next_pc;
+    bbv->block_icount = icount;
+    bbv->block_in_roi = in_roi;
+}
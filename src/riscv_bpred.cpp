@@ -0,0 +1,446 @@
+/*
+ * Branch predictor models
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_bpred.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "cutils.h"
+#include "dromajo.h"
+#include "riscv_machine.h"
+
+static bool is_power_of_2(int n) { return n > 0 && (n & (n - 1)) == 0; }
+
+static inline void ctr2_update(uint8_t &c, bool taken) {
+    if (taken && c < 3)
+        ++c;
+    else if (!taken && c > 0)
+        --c;
+}
+
+/* Direction predictors.  update() is always called right after
+ * predict() for the same branch. */
+class DirPredictor {
+  public:
+    virtual ~DirPredictor() {}
+    virtual bool predict(uint64_t pc)              = 0;
+    virtual void update(uint64_t pc, bool taken)   = 0;
+    virtual const char *name() const               = 0;
+};
+
+class BimodalPredictor : public DirPredictor {
+    std::vector<uint8_t> table;
+    uint64_t             mask;
+
+  public:
+    BimodalPredictor(int entries) : table(entries, 1), mask(entries - 1) {}
+
+    bool        predict(uint64_t pc) { return table[(pc >> 1) & mask] >= 2; }
+    void        update(uint64_t pc, bool taken) { ctr2_update(table[(pc >> 1) & mask], taken); }
+    const char *name() const { return "bimodal"; }
+};
+
+class GsharePredictor : public DirPredictor {
+    std::vector<uint8_t> table;
+    uint64_t             mask;
+    uint64_t             ghr;
+    uint64_t             ghr_mask;
+
+    uint64_t index(uint64_t pc) const { return ((pc >> 1) ^ ghr) & mask; }
+
+  public:
+    GsharePredictor(int entries, int history)
+        : table(entries, 1), mask(entries - 1), ghr(0), ghr_mask(history >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << history) - 1) {}
+
+    bool predict(uint64_t pc) { return table[index(pc)] >= 2; }
+    void update(uint64_t pc, bool taken) {
+        ctr2_update(table[index(pc)], taken);
+        ghr = ((ghr << 1) | taken) & ghr_mask;
+    }
+    const char *name() const { return "gshare"; }
+};
+
+/* A small TAGE: a bimodal base predictor plus up to 8 tagged tables
+ * indexed with geometrically increasing global history lengths (at
+ * most 64 bits). */
+class TagePredictor : public DirPredictor {
+    enum { MAX_TABLES = 8, TAG_BITS = 10 };
+
+    struct Entry {
+        int8_t   ctr; /* -4..3, taken if >= 0 */
+        uint16_t tag;
+        uint8_t  u;
+    };
+
+    BimodalPredictor   base;
+    std::vector<Entry> table[MAX_TABLES];
+    int                hist_len[MAX_TABLES];
+    int                n_tables;
+    int                index_bits;
+    uint64_t           ghr;
+    uint64_t           n_updates;
+
+    /* State of the last prediction */
+    uint64_t idx[MAX_TABLES];
+    uint16_t tag[MAX_TABLES];
+    int      provider, alt;
+    bool     provider_pred, alt_pred;
+
+    uint64_t fold(int len, int bits) const {
+        uint64_t h = len >= 64 ? ghr : ghr & (((uint64_t)1 << len) - 1);
+        uint64_t r = 0;
+        while (h) {
+            r ^= h & (((uint64_t)1 << bits) - 1);
+            h >>= bits;
+        }
+        return r;
+    }
+
+  public:
+    TagePredictor(int base_entries, int tables, int entries) : base(base_entries), ghr(0), n_updates(0) {
+        n_tables   = std::min(std::max(tables, 1), (int)MAX_TABLES);
+        index_bits = ctz32(entries);
+        for (int i = 0; i < n_tables; ++i) {
+            table[i].assign(entries, Entry{0, 0xffff, 0});
+            /* geometric series from 4 to 64 */
+            hist_len[i] = n_tables == 1 ? 16 : (int)(4.0 * pow(16.0, (double)i / (n_tables - 1)) + 0.5);
+        }
+    }
+
+    bool predict(uint64_t pc) {
+        provider = alt = -1;
+        for (int i = 0; i < n_tables; ++i) {
+            idx[i] = ((pc >> 1) ^ (pc >> (index_bits + 1)) ^ fold(hist_len[i], index_bits)) & ((1 << index_bits) - 1);
+            tag[i] = ((pc >> 1) ^ fold(hist_len[i], TAG_BITS) ^ (fold(hist_len[i], TAG_BITS - 1) << 1)) & ((1 << TAG_BITS) - 1);
+        }
+        for (int i = n_tables - 1; i >= 0; --i) {
+            if (table[i][idx[i]].tag == tag[i]) {
+                if (provider < 0)
+                    provider = i;
+                else {
+                    alt = i;
+                    break;
+                }
+            }
+        }
+        alt_pred      = alt >= 0 ? table[alt][idx[alt]].ctr >= 0 : base.predict(pc);
+        provider_pred = provider >= 0 ? table[provider][idx[provider]].ctr >= 0 : alt_pred;
+        return provider_pred;
+    }
+
+    void update(uint64_t pc, bool taken) {
+        if (provider >= 0) {
+            Entry &e = table[provider][idx[provider]];
+            if (provider_pred != alt_pred) {
+                if (provider_pred == taken && e.u < 3)
+                    e.u++;
+                else if (provider_pred != taken && e.u > 0)
+                    e.u--;
+            }
+            if (taken && e.ctr < 3)
+                e.ctr++;
+            else if (!taken && e.ctr > -4)
+                e.ctr--;
+        } else {
+            base.update(pc, taken);
+        }
+
+        /* allocate in a longer history table on a misprediction */
+        if (provider_pred != taken && provider < n_tables - 1) {
+            bool allocated = false;
+            for (int i = provider + 1; i < n_tables; ++i) {
+                Entry &e = table[i][idx[i]];
+                if (e.u == 0) {
+                    e.tag     = tag[i];
+                    e.ctr     = taken ? 0 : -1;
+                    allocated = true;
+                    break;
+                }
+            }
+            if (!allocated)
+                for (int i = provider + 1; i < n_tables; ++i) {
+                    Entry &e = table[i][idx[i]];
+                    if (e.u > 0)
+                        e.u--;
+                }
+        }
+
+        /* periodically age the useful bits */
+        if ((++n_updates & ((1 << 18) - 1)) == 0)
+            for (int i = 0; i < n_tables; ++i)
+                for (auto &e : table[i]) e.u >>= 1;
+
+        ghr = (ghr << 1) | taken;
+    }
+
+    const char *name() const { return "tage"; }
+};
+
+/* Set-associative branch target buffer with LRU replacement */
+class BTB {
+    struct Entry {
+        uint64_t pc;
+        uint64_t target;
+        uint64_t stamp;
+    };
+
+    std::vector<Entry> entries;
+    int                ways;
+    uint64_t           set_mask;
+    uint64_t           clock;
+
+    Entry *set(uint64_t pc) { return &entries[((pc >> 1) & set_mask) * ways]; }
+
+  public:
+    BTB(int n, int w) : entries(n, Entry{~(uint64_t)0, 0, 0}), ways(w), set_mask(n / w - 1), clock(0) {}
+
+    bool lookup(uint64_t pc, uint64_t *target) {
+        Entry *e = set(pc);
+        for (int i = 0; i < ways; ++i)
+            if (e[i].pc == pc) {
+                e[i].stamp = ++clock;
+                *target    = e[i].target;
+                return true;
+            }
+        return false;
+    }
+
+    void update(uint64_t pc, uint64_t target) {
+        Entry *e = set(pc), *victim = e;
+        for (int i = 0; i < ways; ++i) {
+            if (e[i].pc == pc) {
+                victim = &e[i];
+                break;
+            }
+            if (e[i].stamp < victim->stamp)
+                victim = &e[i];
+        }
+        victim->pc     = pc;
+        victim->target = target;
+        victim->stamp  = ++clock;
+    }
+};
+
+enum { BP_COND, BP_JUMP, BP_CALL, BP_RET, BP_IND, BP_KINDS };
+
+static const char *bp_kind_name[BP_KINDS] = {"cond", "jump", "call", "ret", "indirect"};
+
+struct PCStat {
+    uint64_t count;
+    uint64_t mispredict;
+    int      kind;
+};
+
+struct RISCVBPred {
+    RISCVBPredParams      p;
+    DirPredictor *        dir;
+    BTB *                 btb;
+    std::vector<uint64_t> ras;
+    int                   ras_top;
+
+    uint64_t                             n[BP_KINDS];
+    uint64_t                             n_miss[BP_KINDS];
+    std::unordered_map<uint64_t, PCStat> pc_stats;
+};
+
+void riscv_bpred_set_defaults(RISCVBPredParams *p) {
+    p->type         = BPRED_NONE;
+    p->entries      = 4096;
+    p->history      = 12;
+    p->tage_tables  = 4;
+    p->tage_entries = 1024;
+    p->btb_entries  = 512;
+    p->btb_ways     = 4;
+    p->ras_entries  = 16;
+    p->report       = 10;
+    p->stats_file   = NULL;
+}
+
+int riscv_bpred_parse_type(const char *name, RISCVBPredType *type) {
+    if (!strcmp(name, "bimodal"))
+        *type = BPRED_BIMODAL;
+    else if (!strcmp(name, "gshare"))
+        *type = BPRED_GSHARE;
+    else if (!strcmp(name, "tage"))
+        *type = BPRED_TAGE;
+    else
+        return -1;
+    return 0;
+}
+
+RISCVBPred *riscv_bpred_init(const RISCVBPredParams *p) {
+    /* nothing is allocated until the parameters are known to be valid */
+    if (!is_power_of_2(p->entries) || !is_power_of_2(p->tage_entries)) {
+        vm_error("bpred: predictor entries must be a power of 2\n");
+        return NULL;
+    }
+    if (p->btb_entries
+        && (p->btb_ways <= 0 || !is_power_of_2(p->btb_entries / p->btb_ways) || p->btb_entries % p->btb_ways)) {
+        vm_error("bpred: btb_entries/btb_ways must be a power of 2\n");
+        return NULL;
+    }
+
+    RISCVBPred *bp = new RISCVBPred();
+    bp->p          = *p;
+
+    switch (bp->p.type) {
+        case BPRED_GSHARE: bp->dir = new GsharePredictor(bp->p.entries, bp->p.history); break;
+        case BPRED_TAGE: bp->dir = new TagePredictor(bp->p.entries, bp->p.tage_tables, bp->p.tage_entries); break;
+        default: bp->dir = new BimodalPredictor(bp->p.entries); break;
+    }
+    if (bp->p.btb_entries)
+        bp->btb = new BTB(bp->p.btb_entries, bp->p.btb_ways);
+    bp->ras.assign(std::max(bp->p.ras_entries, 1), 0);
+
+    return bp;
+}
+
+void riscv_bpred_end(RISCVBPred *bp, int hartid) {
+    fprintf(dromajo_stderr, "bpred hart %d %s:", hartid, bp->dir->name());
+    for (int k = 0; k < BP_KINDS; ++k)
+        fprintf(dromajo_stderr,
+                " %s %" PRIu64 "/%" PRIu64 " (%.2f%%)",
+                bp_kind_name[k],
+                bp->n_miss[k],
+                bp->n[k],
+                bp->n[k] ? 100.0 * bp->n_miss[k] / bp->n[k] : 0.0);
+    fprintf(dromajo_stderr, "\n");
+
+    std::vector<std::pair<uint64_t, PCStat>> v(bp->pc_stats.begin(), bp->pc_stats.end());
+    std::sort(v.begin(), v.end(), [](const std::pair<uint64_t, PCStat> &a, const std::pair<uint64_t, PCStat> &b) {
+        return a.second.mispredict > b.second.mispredict || (a.second.mispredict == b.second.mispredict && a.first < b.first);
+    });
+
+    for (int i = 0; i < bp->p.report && i < (int)v.size() && v[i].second.mispredict; ++i)
+        fprintf(dromajo_stderr,
+                "bpred hart %d   pc 0x%016" PRIx64 " %-8s %" PRIu64 "/%" PRIu64 "\n",
+                hartid,
+                v[i].first,
+                bp_kind_name[v[i].second.kind],
+                v[i].second.mispredict,
+                v[i].second.count);
+
+    if (bp->p.stats_file) {
+        char  name[1024];
+        FILE *f;
+        snprintf(name, sizeof name, "%s.%d", bp->p.stats_file, hartid);
+        f = fopen(name, "w");
+        if (!f) {
+            vm_error("bpred: could not open %s\n", name);
+        } else {
+            fprintf(f, "pc,kind,count,mispredict\n");
+            for (auto &e : v)
+                fprintf(f,
+                        "0x%" PRIx64 ",%s,%" PRIu64 ",%" PRIu64 "\n",
+                        e.first,
+                        bp_kind_name[e.second.kind],
+                        e.second.count,
+                        e.second.mispredict);
+            fclose(f);
+        }
+    }
+
+    delete bp->dir;
+    delete bp->btb;
+    delete bp;
+}
+
+static inline void ras_push(RISCVBPred *bp, uint64_t addr) {
+    bp->ras[bp->ras_top] = addr;
+    bp->ras_top          = (bp->ras_top + 1) % bp->ras.size();
+}
+
+static inline uint64_t ras_pop(RISCVBPred *bp) {
+    bp->ras_top = (bp->ras_top + bp->ras.size() - 1) % bp->ras.size();
+    return bp->ras[bp->ras_top];
+}
+
+/* Without a BTB, direct targets are considered known at fetch and
+ * indirect ones always miss. */
+static bool btb_hit(RISCVBPred *bp, uint64_t pc, uint64_t target, bool direct) {
+    uint64_t predicted;
+
+    if (!bp->btb)
+        return direct;
+
+    bool hit = bp->btb->lookup(pc, &predicted) && predicted == target;
+    bp->btb->update(pc, target);
+    return hit;
+}
+
+bool riscv_bpred_ctf(RISCVBPred *bp, uint64_t pc, uint32_t insn, int info, bool taken, uint64_t target) {
+    int  len  = (insn & 3) == 3 ? 4 : 2;
+    bool miss = false;
+    int  kind;
+
+    switch (info) {
+        case ctf_taken_branch: {
+            kind = BP_COND;
+            miss = bp->dir->predict(pc) != taken;
+            bp->dir->update(pc, taken);
+            if (taken && !btb_hit(bp, pc, target, true))
+                miss = true;
+        } break;
+
+        case ctf_taken_jump: {
+            int rd = (insn >> 7) & 0x1f;
+            /* jal with a link register is a call (c.jal is RV32 only) */
+            kind = (insn & 0x7f) == 0x6f && (rd == 1 || rd == 5) ? BP_CALL : BP_JUMP;
+            miss = !btb_hit(bp, pc, target, true);
+            if (kind == BP_CALL)
+                ras_push(bp, pc + len);
+        } break;
+
+        case ctf_taken_jalr_pop:
+        case ctf_taken_jalr_pop_push:
+            kind = BP_RET;
+            miss = ras_pop(bp) != target;
+            if (info == ctf_taken_jalr_pop_push)
+                ras_push(bp, pc + len);
+            break;
+
+        case ctf_taken_jalr_push:
+            kind = BP_CALL;
+            miss = !btb_hit(bp, pc, target, false);
+            ras_push(bp, pc + len);
+            break;
+
+        default: /* ctf_taken_jalr */
+            kind = BP_IND;
+            miss = !btb_hit(bp, pc, target, false);
+            break;
+    }
+
+    bp->n[kind]++;
+    bp->n_miss[kind] += miss;
+
+    PCStat &st = bp->pc_stats[pc];
+    st.kind    = kind;
+    st.count++;
+    st.mispredict += miss;
+
+    return miss;
+}
@@ -48,6 +48,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "LiveCacheCore.h"
 #include "cutils.h"
 #include "dromajo.h"
@@ -147,16 +149,27 @@ static void         dump_regs(RISCVCPUState *s) {
 #endif
 }
 
+static void tlbmodel_access(RISCVCPUState *s, target_ulong vaddr, riscv_memory_access_t access);
+
+static inline void track_tlbmodel(RISCVCPUState *s, target_ulong vaddr, riscv_memory_access_t access) {
+    if (unlikely(s->tlbmodel))
+        tlbmodel_access(s, vaddr, access);
+}
+
 static inline void track_write(RISCVCPUState *s, uint64_t vaddr, uint64_t paddr, uint64_t data, int size) {
 #ifdef LIVECACHE
     s->machine->llc->write(paddr);
 #endif
+    if (unlikely(s->timing))
+        riscv_timing_dmem(s->timing, paddr, true);
 }
 
 static inline uint64_t track_dread(RISCVCPUState *s, uint64_t vaddr, uint64_t paddr, uint64_t data, int size) {
 #ifdef LIVECACHE
     s->machine->llc->read(paddr);
 #endif
+    if (unlikely(s->timing))
+        riscv_timing_dmem(s->timing, paddr, false);
 
     return data;
 }
@@ -170,6 +183,35 @@ static inline uint64_t track_iread(RISCVCPUState *s, uint64_t vaddr, uint64_t pa
     return data;
 }
 
+/* Fold the cycles the timing model added beyond one per instruction
+ * into mcycle (and thereby mtime). */
+static inline void timing_flush_stall(RISCVCPUState *s) {
+    if (likely(!s->timing))
+        return;
+    if (!s->stop_the_counter)
+        s->mcycle += s->timing->stall;
+    s->timing->stall = 0;
+}
+
+static no_inline void bpred_ctf_event(RISCVCPUState *s, target_ulong pc, uint32_t insn, int info, bool taken,
+                                      target_ulong target) {
+    bool mispredict = riscv_bpred_ctf(s->bpred, pc, insn, info, taken, target);
+    if (s->timing)
+        riscv_timing_ctf(s->timing, mispredict);
+}
+
+/* Basic block exits for the BBV collection.  All users run the
+ * interpreter one instruction at a time, so a block ends whenever the
+ * next PC does not follow the instruction that started this call.  Only
+ * block exits are counted: taken branches and jumps, but also traps and
+ * xRET, which no single control transfer site sees.  Other steps only
+ * pay for the test. */
+static inline void bbv_retire(RISCVCPUState *s, target_ulong insn_pc) {
+    if (likely(!s->bbv) || s->pc == insn_pc + 4 || s->pc == insn_pc + 2)
+        return;
+    riscv_bbv_block_exit(s->bbv, s->pc, s->insn_counter, s->machine->common.simpoint_roi);
+}
+
 /* "PMP checks are applied to all accesses when the hart is running in
  * S or U modes, and for loads and stores when the MPRV bit is set in
  * the mstatus register and the MPP field in the mstatus register
@@ -214,6 +256,50 @@ static inline PhysMemoryRange *get_phys_mem_range_pmp(RISCVCPUState *s, uint64_t
         return get_phys_mem_range(s->mem_map, paddr);
 }
 
+/*
+ * Watchpoints on physical memory, see riscv_watch_add
+ *
+ * Pages with watched bytes never enter tlb_write, so the write slow paths
+ * are the only places that need to check the ranges.
+ */
+
+/* [paddr, paddr + size) holds watched bytes */
+static bool watch_hit(RISCVMachine *m, uint64_t paddr, uint64_t size) {
+    for (int i = 0; i < m->n_watch; ++i)
+        if (paddr <= m->watch[i].hi && paddr + size - 1 >= m->watch[i].lo)
+            return true;
+    return false;
+}
+
+/* The instruction count is the one at the start of the current step */
+static no_inline void watch_write(RISCVCPUState *s, uint64_t paddr, int size, uint64_t val) {
+    if (!watch_hit(s->machine, paddr, size))
+        return;
+
+    fprintf(dromajo_stderr,
+            "watch: hart %d pc 0x%016" PRIx64 " insn %" PRIu64 " paddr 0x%" PRIx64 " size %d val 0x%" PRIx64 "\n",
+            (int)s->mhartid,
+            (uint64_t)s->pc,
+            s->insn_counter,
+            paddr,
+            size,
+            val);
+}
+
+/* Sums the bytes written for --selfcheck, one term per byte so that the
+ * sum does not depend on how the bytes were split into accesses */
+static no_inline void selfcheck_write(RISCVCPUState *s, uint64_t paddr, const void *data, uint64_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    for (uint64_t i = 0; i < size; ++i) {
+        uint64_t z = (paddr + i) << 8 | p[i];
+        z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z          = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        s->selfcheck_wsum += z ^ (z >> 31);
+    }
+    s->selfcheck_wbytes += size;
+}
+
 /* addr must be aligned. Only RAM accesses are supported */
 #define PHYS_MEM_READ_WRITE(size, uint_type)                                                         \
     void riscv_phys_write_u##size(RISCVCPUState *s, target_ulong paddr, uint_type val, bool *fail) { \
@@ -222,9 +308,16 @@ static inline PhysMemoryRange *get_phys_mem_range_pmp(RISCVCPUState *s, uint64_t
             *fail = true;                                                                            \
             return;                                                                                  \
         }                                                                                            \
+        if (unlikely(s->machine->n_watch))                                                           \
+            watch_write(s, paddr, size / 8, val);                                                    \
+        if (unlikely(s->machine->selfcheck))                                                         \
+            selfcheck_write(s, paddr, &val, size / 8);                                               \
         track_write(s, paddr, paddr, val, size);                                                     \
-        *(uint_type *)(pr->phys_mem + (uintptr_t)(paddr - pr->addr)) = val;                          \
-        *fail                                                        = false;                        \
+        uint8_t *ptr      = pr->phys_mem + (uintptr_t)(paddr - pr->addr);                            \
+        *(uint_type *)ptr = val;                                                                     \
+        if (s->machine->dbcache)                                                                     \
+            riscv_dbcache_write(s->machine->dbcache, ptr, size / 8);                                 \
+        *fail = false;                                                                               \
     }                                                                                                \
                                                                                                      \
     uint_type riscv_phys_read_u##size(RISCVCPUState *s, target_ulong paddr, bool *fail) {            \
@@ -256,7 +349,8 @@ PHYS_MEM_READ_WRITE(64, uint64_t)
         if (likely(s->tlb_read[tlb_idx].vaddr == (addr & ~(PG_MASK & ~((size / 8) - 1))))) {                                \
             uint64_t data  = *(uint_type *)(s->tlb_read[tlb_idx].mem_addend + (uintptr_t)addr);                             \
             uint64_t paddr = s->tlb_read_paddr_addend[tlb_idx] + addr;                                                      \
-            *pval          = track_dread(s, addr, paddr, data, size);                                                       \
+            track_tlbmodel(s, addr, ACCESS_READ);                                                                           \
+            *pval = track_dread(s, addr, paddr, data, size);                                                                \
             return 0;                                                                                                       \
         }                                                                                                                   \
                                                                                                                             \
@@ -279,6 +373,7 @@ PHYS_MEM_READ_WRITE(64, uint64_t)
         if (likely(s->tlb_write[tlb_idx].vaddr == (addr & ~(PG_MASK & ~((size / 8) - 1))))) {                               \
             *(uint_type *)(s->tlb_write[tlb_idx].mem_addend + (uintptr_t)addr) = val;                                       \
             uint64_t paddr                                                     = s->tlb_write_paddr_addend[tlb_idx] + addr; \
+            track_tlbmodel(s, addr, ACCESS_WRITE);                                                                          \
             track_write(s, addr, paddr, val, size);                                                                         \
             return 0;                                                                                                       \
         }                                                                                                                   \
@@ -299,12 +394,27 @@ TARGET_READ_WRITE(128, uint128_t, 4)
 #define PTE_V_MASK (1 << 0)
 #define PTE_U_MASK (1 << 4)
 #define PTE_A_MASK (1 << 6)
+#define PTE_G_MASK (1 << 5)
 #define PTE_D_MASK (1 << 7)
 
+/* Sv39/Sv48 PTE bits above the PPN */
+#define PTE_PPN_MASK  (((uint64_t)1 << 44) - 1) /* after >> 10 */
+#define PTE_RSVD_MASK ((uint64_t)0x7f << 54)
+#define PTE_PBMT_MASK ((uint64_t)3 << 61)
+#define PTE_N_MASK    ((uint64_t)1 << 63)
+
+/* Svnapot: the only defined size, 16 contiguous 4 KiB pages */
+#define NAPOT_SHIFT 16
+
+/* Svpbmt memory types */
+enum { PBMT_PMA, PBMT_NC, PBMT_IO, PBMT_RESERVED };
+
 /* access = 0: read, 1 = write, 2 = code. Set the exception_pending
    field if necessary. return 0 if OK, -1 if translation error, -2 if
-   the physical address is illegal. */
-int riscv_cpu_get_phys_addr(RISCVCPUState *s, target_ulong vaddr, riscv_memory_access_t access, target_ulong *ppaddr) {
+   the physical address is illegal.  *ppage_shift is set to the size of
+   the leaf mapping (PG_SHIFT without translation). */
+static int get_phys_addr(RISCVCPUState *s, target_ulong vaddr, riscv_memory_access_t access, target_ulong *ppaddr,
+                         int *ppage_shift) {
     int          mode, levels, pte_bits, pte_idx, pte_mask, pte_size_log2, xwr, priv;
     int          need_write, vaddr_shift, i, pte_addr_bits;
     target_ulong pte_addr, pte, vaddr_mask, paddr;
@@ -316,6 +426,7 @@ int riscv_cpu_get_phys_addr(RISCVCPUState *s, target_ulong vaddr, riscv_memory_a
         priv = s->priv;
     }
 
+    *ppage_shift = PG_SHIFT;
     if (priv == PRV_M) {
         *ppaddr = vaddr;
         return 0;
@@ -353,10 +464,23 @@ int riscv_cpu_get_phys_addr(RISCVCPUState *s, target_ulong vaddr, riscv_memory_a
 
         if (!(pte & PTE_V_MASK))
             return -1; /* invalid PTE */
+        if (pte & PTE_RSVD_MASK)
+            return -1;
+
+        uint64_t ppn = (pte >> 10) & PTE_PPN_MASK;
+        paddr        = ppn << PG_SHIFT;
+        xwr          = (pte >> 1) & 7;
+        if (xwr == 0) {
+            /* N and PBMT are reserved in pointers */
+            if (pte & (PTE_N_MASK | PTE_PBMT_MASK))
+                return -1;
+        } else {
+            /* The memory type only matters to caches and ordering, which
+             * are not modelled: it is checked and otherwise ignored */
+            int pbmt = (pte & PTE_PBMT_MASK) >> 61;
+            if (pbmt == PBMT_RESERVED || (pbmt != PBMT_PMA && !(s->menvcfg & ENVCFG_PBMTE)))
+                return -1;
 
-        paddr = (pte >> 10) << PG_SHIFT;
-        xwr   = (pte >> 1) & 7;
-        if (xwr != 0) {
             if (xwr == 2 || xwr == 6)
                 return -1;
 
@@ -377,11 +501,17 @@ int riscv_cpu_get_phys_addr(RISCVCPUState *s, target_ulong vaddr, riscv_memory_a
                 return -1;
 
             /* 6. Check for misaligned superpages */
-            unsigned ppn = pte >> 10;
-            int      j   = levels - 1 - i;
+            int j = levels - 1 - i;
             if (((1 << j) - 1) & ppn)
                 return -1;
 
+            /* Svnapot, only 64 KiB ranges of 4 KiB pages are defined */
+            if (pte & PTE_N_MASK) {
+                if (j != 0 || (ppn & 15) != 8)
+                    return -1;
+                vaddr_shift = NAPOT_SHIFT;
+            }
+
             /*
               RISC-V Priv. Spec 1.11 (draft) Section 4.3.1 offers two
               ways to handle the A and D TLB flags.  Spike uses the
@@ -410,8 +540,9 @@ int riscv_cpu_get_phys_addr(RISCVCPUState *s, target_ulong vaddr, riscv_memory_a
                 }
             }
 
-            vaddr_mask = ((target_ulong)1 << vaddr_shift) - 1;
-            *ppaddr    = paddr & ~vaddr_mask | vaddr & vaddr_mask;
+            vaddr_mask   = ((target_ulong)1 << vaddr_shift) - 1;
+            *ppaddr      = paddr & ~vaddr_mask | vaddr & vaddr_mask;
+            *ppage_shift = vaddr_shift;
             return 0;
         }
 
@@ -421,6 +552,212 @@ int riscv_cpu_get_phys_addr(RISCVCPUState *s, target_ulong vaddr, riscv_memory_a
     return -1;
 }
 
+int riscv_cpu_get_phys_addr(RISCVCPUState *s, target_ulong vaddr, riscv_memory_access_t access, target_ulong *ppaddr) {
+    int page_shift;
+    return get_phys_addr(s, vaddr, access, ppaddr, &page_shift);
+}
+
+/*
+ * Debug triggers, mcontrol address matches before the access
+ *
+ * Unarmed triggers cost nothing: trig_exec, trig_load and trig_store say
+ * which triggers are armed.  Pages that an armed load or store trigger may
+ * match are kept out of tlb_read and tlb_write, so that only the slow
+ * paths need to check, and the fast fetch path of the interpreter ends at
+ * the first address an execute trigger matches (see trigger_exec_limit).
+ */
+
+/* Recomputes the masks and ranges after a tdata write */
+static void triggers_update(RISCVCPUState *s) {
+    s->trig_exec  = 0;
+    s->trig_load  = 0;
+    s->trig_store = 0;
+
+    for (int i = 0; i < MAX_TRIGGERS; ++i) {
+        target_ulong t1 = s->tdata1[i], t2 = s->tdata2[i];
+        target_ulong lo, hi;
+
+        if ((t1 >> 60) != 2 || !(t1 & (MCONTROL_M | MCONTROL_S | MCONTROL_U)))
+            continue;
+
+        switch ((t1 & MCONTROL_MATCH) >> MCONTROL_MATCH_SHIFT) {
+            case MCONTROL_MATCH_EQ: lo = hi = t2; break;
+            case MCONTROL_MATCH_NAPOT: {
+                /* M trailing ones select 2^(M+1) bytes */
+                target_ulong m = t2 ^ (t2 + 1);
+                lo             = t2 & ~m;
+                hi             = t2 | m;
+            } break;
+            case MCONTROL_MATCH_GE:
+                lo = t2;
+                hi = ~(target_ulong)0;
+                break;
+            default: /* MCONTROL_MATCH_LT */
+                if (t2 == 0)
+                    continue;
+                lo = 0;
+                hi = t2 - 1;
+                break;
+        }
+        s->trig_lo[i] = lo;
+        s->trig_hi[i] = hi;
+
+        if (t1 & MCONTROL_EXECUTE)
+            s->trig_exec |= 1u << i;
+        if (t1 & MCONTROL_LOAD)
+            s->trig_load |= 1u << i;
+        if (t1 & MCONTROL_STORE)
+            s->trig_store |= 1u << i;
+    }
+}
+
+/* Takes the breakpoint of the first trigger in mask that matches
+ * [addr, addr + size) in the current mode; false if there is none */
+static bool trigger_fire(RISCVCPUState *s, uint32_t mask, target_ulong addr, int size) {
+    target_ulong mode = MCONTROL_U << s->priv;
+
+    if (s->debug_mode)
+        return false;
+
+    for (; mask; mask &= mask - 1) {
+        int i = ctz32(mask);
+        if ((s->tdata1[i] & mode) && addr <= s->trig_hi[i] && addr + size - 1 >= s->trig_lo[i]) {
+            s->tdata1[i] |= MCONTROL_HIT;
+            s->pending_exception = CAUSE_BREAKPOINT;
+            s->pending_tval      = addr;
+            s->trig_fired        = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* An armed trigger of mask may match an address of the page of vaddr */
+static bool trigger_on_page(RISCVCPUState *s, uint32_t mask, target_ulong vaddr) {
+    target_ulong lo = vaddr & ~PG_MASK;
+    target_ulong hi = lo | PG_MASK;
+
+    for (; mask; mask &= mask - 1) {
+        int i = ctz32(mask);
+        if (lo <= s->trig_hi[i] && hi >= s->trig_lo[i])
+            return true;
+    }
+
+    return false;
+}
+
+/* The lowest address in [pc, limit) that an execute trigger matches in
+ * the current mode, limit if there is none */
+static target_ulong trigger_exec_limit(RISCVCPUState *s, target_ulong pc, target_ulong limit) {
+    target_ulong mode = MCONTROL_U << s->priv;
+
+    for (uint32_t mask = s->trig_exec; mask; mask &= mask - 1) {
+        int i = ctz32(mask);
+        if ((s->tdata1[i] & mode) && s->trig_hi[i] >= pc)
+            limit = std::min(limit, std::max(s->trig_lo[i], pc));
+    }
+
+    return limit;
+}
+
+/* The shift recorded for a new TLB entry, see tlb_flush_vaddr */
+static inline uint8_t tlb_entry_shift(RISCVCPUState *s, int page_shift) {
+    if (page_shift <= NAPOT_SHIFT)
+        return 0;
+    s->tlb_superpages = true;
+    return page_shift;
+}
+
+/* A Svnapot translation holds for its whole 64 KiB range, so the other
+ * pages of the range are entered in the TLB along with the one
+ * accessed when the range is in one RAM range.  PMP is checked page by
+ * page, as the 4 KiB fills do; the pages it denies are left to them. */
+static void tlb_fill_napot(RISCVCPUState *s, TLBEntry *tlb, uint8_t *shift, target_ulong vaddr, target_ulong paddr,
+                           pmpcfg_t perm) {
+    const target_ulong size = (target_ulong)1 << NAPOT_SHIFT;
+    target_ulong       va   = vaddr & ~(size - 1);
+    target_ulong       pa   = paddr & ~(size - 1);
+#ifndef PADDR_INLINE
+    target_ulong *paddr_addend = perm == PMPCFG_R   ? s->tlb_read_paddr_addend
+                                 : perm == PMPCFG_W ? s->tlb_write_paddr_addend
+                                                    : s->tlb_code_paddr_addend;
+#endif
+
+    /* the write TLB must not map code pages, see riscv_dbcache.h */
+    if (perm == PMPCFG_W && s->machine->dbcache)
+        return;
+    if ((perm == PMPCFG_R && s->trig_load)
+        || (perm == PMPCFG_W && (s->trig_store || s->machine->n_watch || s->machine->selfcheck)))
+        return;
+
+    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, pa);
+    if (!pr || !pr->is_ram || pa + size > pr->addr + pr->size)
+        return;
+
+    for (target_ulong off = 0; off < size; off += PG_MASK + 1) {
+        if (!riscv_cpu_pmp_access_ok(s, pa + off, PG_MASK + 1, perm))
+            continue;
+
+        int      idx = ((va + off) >> PG_SHIFT) & (TLB_SIZE - 1);
+        uint8_t *ptr = pr->phys_mem + (uintptr_t)(pa + off - pr->addr);
+        if (perm == PMPCFG_W)
+            phys_mem_set_dirty_bit(pr, pa + off - pr->addr);
+        tlb[idx].vaddr = va + off;
+#ifdef PADDR_INLINE
+        tlb[idx].paddr_addend = pa - va;
+#else
+        paddr_addend[idx] = pa - va;
+#endif
+        tlb[idx].mem_addend = (uintptr_t)ptr - (va + off);
+        shift[idx]          = 0;
+    }
+}
+
+/* Looks up a translated access in the target TLB model.  Misses are
+ * filled from a walk without side effects (no A/D updates, no
+ * permission checks); faulting translations are not cached. */
+static no_inline void tlbmodel_access(RISCVCPUState *s, target_ulong vaddr, riscv_memory_access_t access) {
+    int priv = s->priv;
+    int mode = (s->satp >> 60) & 0xf;
+
+    if ((s->mstatus & MSTATUS_MPRV) && access != ACCESS_CODE)
+        priv = (s->mstatus >> MSTATUS_MPP_SHIFT) & 3;
+    if (priv == PRV_M || mode == 0)
+        return;
+
+    uint32_t asid    = (s->satp >> 44) & 0xffff;
+    bool     is_code = access == ACCESS_CODE;
+    if (riscv_tlbmodel_lookup(s->tlbmodel, is_code, vaddr, asid))
+        return;
+
+    int          levels   = mode - 8 + 3;
+    int          refs     = 0;
+    target_ulong pte_addr = (s->satp & (((target_ulong)1 << 44) - 1)) << PG_SHIFT;
+    for (int i = 0; i < levels; i++) {
+        int vaddr_shift = PG_SHIFT + 9 * (levels - 1 - i);
+        pte_addr += ((vaddr >> vaddr_shift) & 0x1ff) << 3;
+
+        PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, pte_addr);
+        if (!pr || !pr->is_ram)
+            return;
+        uint64_t pte = *(uint64_t *)(pr->phys_mem + (uintptr_t)(pte_addr - pr->addr));
+        refs++;
+        if (s->timing && riscv_tlbmodel_walk_to_cache(s->tlbmodel))
+            riscv_timing_dmem(s->timing, pte_addr, false);
+
+        if (!(pte & PTE_V_MASK))
+            return;
+        if ((pte >> 1) & 7) {
+            if (pte & PTE_N_MASK)
+                vaddr_shift = NAPOT_SHIFT;
+            riscv_tlbmodel_fill(s->tlbmodel, is_code, vaddr, asid, vaddr_shift, pte & PTE_G_MASK, refs);
+            return;
+        }
+        pte_addr = ((pte >> 10) & PTE_PPN_MASK) << PG_SHIFT;
+    }
+}
+
 /* return 0 if OK, != 0 if exception */
 no_inline int riscv_cpu_read_memory(RISCVCPUState *s, mem_uint_t *pval, target_ulong addr, int size_log2) {
     int              size, tlb_idx, err, al;
@@ -429,9 +766,12 @@ no_inline int riscv_cpu_read_memory(RISCVCPUState *s, mem_uint_t *pval, target_u
     PhysMemoryRange *pr;
     mem_uint_t       ret;
 
-    /* first handle unaligned accesses */
     size = 1 << size_log2;
-    al   = addr & (size - 1);
+    if (unlikely(s->trig_load) && trigger_fire(s, s->trig_load, addr, size))
+        return -1;
+
+    /* first handle unaligned accesses */
+    al = addr & (size - 1);
     if (!CONFIG_ALLOW_MISALIGNED_ACCESS && al != 0) {
         s->pending_tval      = addr;
         s->pending_exception = CAUSE_MISALIGNED_LOAD;
@@ -491,7 +831,8 @@ no_inline int riscv_cpu_read_memory(RISCVCPUState *s, mem_uint_t *pval, target_u
         }
         paddr = addr;  // No translation for this request
     } else {
-        int err = riscv_cpu_get_phys_addr(s, addr, ACCESS_READ, &paddr);
+        int page_shift;
+        int err = get_phys_addr(s, addr, ACCESS_READ, &paddr, &page_shift);
 
         if (err) {
             s->pending_tval      = addr;
@@ -514,12 +855,17 @@ no_inline int riscv_cpu_read_memory(RISCVCPUState *s, mem_uint_t *pval, target_u
             tlb_idx                    = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
             ptr                        = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
             s->tlb_read[tlb_idx].vaddr = addr & ~PG_MASK;
+            if (unlikely(s->trig_load) && trigger_on_page(s, s->trig_load, addr))
+                s->tlb_read[tlb_idx].vaddr = -1;
 #ifdef PADDR_INLINE
             s->tlb_read[tlb_idx].paddr_addend = paddr - addr;
 #else
             s->tlb_read_paddr_addend[tlb_idx]  = paddr - addr;
 #endif
             s->tlb_read[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+            s->tlb_read_shift[tlb_idx] = tlb_entry_shift(s, page_shift);
+            if (page_shift == NAPOT_SHIFT)
+                tlb_fill_napot(s, s->tlb_read, s->tlb_read_shift, addr, paddr, PMPCFG_R);
             switch (size_log2) {
                 case 0: ret = *(uint8_t *)ptr; break;
                 case 1: ret = *(uint16_t *)ptr; break;
@@ -554,6 +900,7 @@ no_inline int riscv_cpu_read_memory(RISCVCPUState *s, mem_uint_t *pval, target_u
             }
         }
     }
+    track_tlbmodel(s, addr, ACCESS_READ);
     *pval = track_dread(s, addr, paddr, ret, size);
     return 0;
 }
@@ -565,8 +912,11 @@ no_inline int riscv_cpu_write_memory(RISCVCPUState *s, target_ulong addr, mem_ui
     uint8_t *        ptr;
     PhysMemoryRange *pr;
 
-    /* first handle unaligned accesses */
     size = 1 << size_log2;
+    if (unlikely(s->trig_store) && trigger_fire(s, s->trig_store, addr, size))
+        return -1;
+
+    /* first handle unaligned accesses */
     if (!CONFIG_ALLOW_MISALIGNED_ACCESS && (addr & (size - 1)) != 0) {
         s->pending_tval      = addr;
         s->pending_exception = CAUSE_MISALIGNED_STORE;
@@ -579,7 +929,8 @@ no_inline int riscv_cpu_write_memory(RISCVCPUState *s, target_ulong addr, mem_ui
         }
         paddr = addr;
     } else {
-        int err = riscv_cpu_get_phys_addr(s, addr, ACCESS_WRITE, &paddr);
+        int page_shift;
+        int err = get_phys_addr(s, addr, ACCESS_WRITE, &paddr, &page_shift);
 
         if (err) {
             s->pending_tval      = addr;
@@ -596,17 +947,29 @@ no_inline int riscv_cpu_write_memory(RISCVCPUState *s, target_ulong addr, mem_ui
             s->pending_tval      = addr;
             s->pending_exception = CAUSE_FAULT_STORE;
             return -1;
-        } else if (pr->is_ram) {
+        }
+        if (unlikely(s->machine->n_watch))
+            watch_write(s, paddr, size, val);
+        if (unlikely(s->machine->selfcheck))
+            selfcheck_write(s, paddr, &val, size);
+        if (pr->is_ram) {
             phys_mem_set_dirty_bit(pr, paddr - pr->addr);
             tlb_idx                     = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
             ptr                         = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
             s->tlb_write[tlb_idx].vaddr = addr & ~PG_MASK;
+            if ((unlikely(s->trig_store) && trigger_on_page(s, s->trig_store, addr))
+                || (unlikely(s->machine->n_watch) && watch_hit(s->machine, paddr & ~PG_MASK, PG_MASK + 1))
+                || unlikely(s->machine->selfcheck))
+                s->tlb_write[tlb_idx].vaddr = -1;
 #ifdef PADDR_INLINE
             s->tlb_write[tlb_idx].paddr_addend = paddr - addr;
 #else
             s->tlb_write_paddr_addend[tlb_idx] = paddr - addr;
 #endif
             s->tlb_write[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+            s->tlb_write_shift[tlb_idx] = tlb_entry_shift(s, page_shift);
+            if (page_shift == NAPOT_SHIFT)
+                tlb_fill_napot(s, s->tlb_write, s->tlb_write_shift, addr, paddr, PMPCFG_W);
             switch (size_log2) {
                 case 0: *(uint8_t *)ptr = val; break;
                 case 1: *(uint16_t *)ptr = val; break;
@@ -619,6 +982,10 @@ no_inline int riscv_cpu_write_memory(RISCVCPUState *s, target_ulong addr, mem_ui
 #endif
                 default: abort();
             }
+            /* code pages stay out of the write TLB so that every store
+             * to them comes here */
+            if (s->machine->dbcache && riscv_dbcache_write(s->machine->dbcache, ptr, size))
+                s->tlb_write[tlb_idx].vaddr = -1;
         } else {
             offset = paddr - pr->addr;
             if (((pr->devio_flags >> size_log2) & 1) != 0) {
@@ -640,6 +1007,7 @@ no_inline int riscv_cpu_write_memory(RISCVCPUState *s, target_ulong addr, mem_ui
             }
         }
     }
+    track_tlbmodel(s, addr, ACCESS_WRITE);
     track_write(s, addr, paddr, val, size);
     return 0;
 }
@@ -657,8 +1025,9 @@ static no_inline __must_use_result int target_read_insn_slow(RISCVCPUState *s, u
     target_ulong     paddr;
     uint8_t *        ptr;
     PhysMemoryRange *pr;
+    int              page_shift;
 
-    int err = riscv_cpu_get_phys_addr(s, addr, ACCESS_CODE, &paddr);
+    int err = get_phys_addr(s, addr, ACCESS_CODE, &paddr, &page_shift);
     if (err) {
         s->pending_tval      = addr;
         s->pending_exception = err == -1 ? CAUSE_FETCH_PAGE_FAULT : CAUSE_FAULT_FETCH;
@@ -679,6 +1048,9 @@ static no_inline __must_use_result int target_read_insn_slow(RISCVCPUState *s, u
         s->tlb_code[tlb_idx].vaddr        = addr & ~PG_MASK;
         s->tlb_code_paddr_addend[tlb_idx] = paddr - addr;
         s->tlb_code[tlb_idx].mem_addend   = (uintptr_t)ptr - addr;
+        s->tlb_code_shift[tlb_idx] = tlb_entry_shift(s, page_shift);
+        if (page_shift == NAPOT_SHIFT)
+            tlb_fill_napot(s, s->tlb_code, s->tlb_code_shift, addr, paddr, PMPCFG_X);
     }
 
     /* check for page crossing */
@@ -748,17 +1120,334 @@ static inline __must_use_result int target_read_insn_u16(RISCVCPUState *s, uint1
     return 0;
 }
 
+/* Zicbom/Zicboz enables, menvcfg for S and U, senvcfg for U */
+static bool cbo_enabled(RISCVCPUState *s, uint64_t mask) {
+    if (s->priv == PRV_M)
+        return true;
+    return (s->menvcfg & mask) && (s->priv == PRV_S || (s->senvcfg & mask));
+}
+
+/* Cache block operation op (the imm field of the instruction) on the
+ * block holding vaddr.  Returns 0 if OK, -1 on exception and -2 if the
+ * instruction is illegal. */
+static int target_cbo(RISCVCPUState *s, uint32_t op, target_ulong vaddr) {
+    bool inval   = false;
+    bool is_zero = op == 4;
+
+    switch (op) {
+        case 0: /* cbo.inval */
+            if (!cbo_enabled(s, ENVCFG_CBIE))
+                return -2;
+            /* CBIE=01 at a level that is not M turns it into a flush */
+            inval = s->priv == PRV_M
+                    || ((s->menvcfg & ENVCFG_CBIE) == ENVCFG_CBIE && (s->priv == PRV_S || (s->senvcfg & ENVCFG_CBIE) == ENVCFG_CBIE));
+            break;
+        case 1: /* cbo.clean */
+        case 2: /* cbo.flush */
+            if (!cbo_enabled(s, ENVCFG_CBCFE))
+                return -2;
+            break;
+        case 4: /* cbo.zero */
+            if (!cbo_enabled(s, ENVCFG_CBZE))
+                return -2;
+            break;
+        default: return -2;
+    }
+
+    target_ulong addr = vaddr & ~(target_ulong)(CBO_BLOCK_SIZE - 1);
+    target_ulong paddr;
+    if (is_zero && unlikely(s->trig_store) && trigger_fire(s, s->trig_store, addr, CBO_BLOCK_SIZE))
+        return -1;
+    int          err = riscv_cpu_get_phys_addr(s, addr, is_zero ? ACCESS_WRITE : ACCESS_READ, &paddr);
+    if (err) {
+        s->pending_tval      = vaddr;
+        s->pending_exception = err == -1 ? CAUSE_STORE_PAGE_FAULT : CAUSE_FAULT_STORE;
+        return -1;
+    }
+    PhysMemoryRange *pr = get_phys_mem_range_pmp(s, paddr, CBO_BLOCK_SIZE, is_zero ? PMPCFG_W : PMPCFG_R);
+    /* only RAM is cacheable: management operations on I/O do nothing
+     * and cbo.zero is not supported there */
+    if (!pr || (is_zero && !pr->is_ram)) {
+        s->pending_tval      = vaddr;
+        s->pending_exception = CAUSE_FAULT_STORE;
+        return -1;
+    }
+    track_tlbmodel(s, addr, is_zero ? ACCESS_WRITE : ACCESS_READ);
+    if (!pr->is_ram)
+        return 0;
+
+    if (is_zero) {
+        uint8_t *ptr = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
+        if (unlikely(s->machine->n_watch))
+            watch_write(s, paddr, CBO_BLOCK_SIZE, 0);
+        memset(ptr, 0, CBO_BLOCK_SIZE);
+        if (unlikely(s->machine->selfcheck))
+            selfcheck_write(s, paddr, ptr, CBO_BLOCK_SIZE);
+        phys_mem_set_dirty_bit(pr, paddr - pr->addr);
+        if (s->machine->dbcache)
+            riscv_dbcache_write(s->machine->dbcache, ptr, CBO_BLOCK_SIZE);
+        /* a single access allocates the line in the cache models */
+        track_write(s, addr, paddr, 0, CBO_BLOCK_SIZE * 8);
+    } else if (op == 2 || inval) {
+#ifdef LIVECACHE
+        s->machine->llc->invalidate(paddr);
+#endif
+        if (unlikely(s->timing))
+            riscv_timing_dmem_inval(s->timing, paddr);
+    }
+
+    return 0;
+}
+
 static void tlb_init(RISCVCPUState *s) {
     for (int i = 0; i < TLB_SIZE; i++) {
         s->tlb_read[i].vaddr  = -1;
         s->tlb_write[i].vaddr = -1;
         s->tlb_code[i].vaddr  = -1;
     }
+    s->tlb_superpages = false;
+    /* the current block was found through the old mapping */
+    s->dbc_block.n_insns = 0;
+}
+
+/* Makes the block at pc the current one.  Returns false when the page is
+ * not in the code TLB (or the block would be empty) and the regular fetch
+ * path has to be taken, which also raises the fetch exceptions. */
+static bool dbcache_enter(RISCVCPUState *s, target_ulong pc) {
+    uint32_t tlb_idx = (pc >> PG_SHIFT) & (TLB_SIZE - 1);
+    if (s->tlb_code[tlb_idx].vaddr != (pc & ~PG_MASK))
+        return false;
+
+#ifdef PADDR_INLINE
+    uint64_t paddr = s->tlb_code[tlb_idx].paddr_addend + pc;
+#else
+    uint64_t paddr = s->tlb_code_paddr_addend[tlb_idx] + pc;
+#endif
+    uint32_t mode  = DBCACHE_MODE(s->priv, s->misa & MCPUID_C);
+    if (!riscv_dbcache_lookup(s->machine->dbcache, paddr, mode, &s->dbc_block)) {
+        uint8_t *ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend + (uintptr_t)pc);
+        bool     new_code_page;
+        bool     ok = riscv_dbcache_build(s->machine->dbcache, ptr, paddr, mode, &s->dbc_block, &new_code_page);
+        if (new_code_page) {
+            /* stores to the page must take the slow path from now on */
+            RISCVMachine *m = s->machine;
+            for (int i = 0; i < m->ncpus; ++i)
+                riscv_cpu_flush_tlb_write_range_ram(m->cpu_state[i], ptr - (paddr & PG_MASK), PG_MASK + 1);
+        }
+        if (!ok) {
+            s->dbc_block.n_insns = 0;
+            return false;
+        }
+    }
+    s->dbc_idx   = 0;
+    s->dbc_pc    = pc;
+    s->dbc_start = pc;
+
+    return true;
+}
+
+/* Makes pc the next instruction of the current block, entering the
+ * block at pc if needed */
+static inline bool dbcache_goto(RISCVCPUState *s, target_ulong pc) {
+    if (pc != s->dbc_pc || s->dbc_idx >= s->dbc_block.n_insns) {
+        /* a loop goes back to the start of the block it holds, which is
+         * emptied whenever the TLB or the privilege level changes */
+        if (pc != s->dbc_start || !s->dbc_block.n_insns)
+            return dbcache_enter(s, pc);
+        s->dbc_idx = 0;
+        s->dbc_pc  = pc;
+    }
+    return riscv_dbcache_block_valid(&s->dbc_block) || dbcache_enter(s, pc);
+}
+
+/* Fetches the instruction at pc from the shared block cache */
+static inline bool dbcache_fetch(RISCVCPUState *s, target_ulong pc, uint32_t *insn) {
+    if (!dbcache_goto(s, pc))
+        return false;
+
+    *insn     = s->dbc_block.insn[s->dbc_idx++];
+    s->dbc_pc = pc + ((*insn & 3) == 3 ? 4 : 2);
+    return true;
+}
+
+/* The idioms retire many instructions at once, which only the plain
+ * interpreter can account for */
+static bool dbcache_idiom_allowed(RISCVCPUState *s) {
+    RISCVMachine *m = s->machine;
+
+    if (s->timing || s->tlbmodel || s->bpred || s->bbv || s->hash || s->debug_mode)
+        return false;
+    if (m->common.cosim || m->common.trace == 0 || !m->common.simpoints.empty())
+        return false;
+#ifdef LIVECACHE
+    if (m->llc)
+        return false;
+#endif
+    if (s->trig_exec | s->trig_load | s->trig_store)
+        return false;
+
+    return true;
+}
+
+/* Translates [vaddr, vaddr + size), which does not cross a page, to host
+ * RAM the way the loads or stores of the loop would */
+static uint8_t *dbcache_idiom_map(RISCVCPUState *s, target_ulong vaddr, uint64_t size, int access, uint64_t *paddr) {
+    target_ulong pa;
+    if (riscv_cpu_get_phys_addr(s, vaddr, (riscv_memory_access_t)access, &pa))
+        return NULL;
+
+    PhysMemoryRange *pr = get_phys_mem_range_pmp(s, pa, size, access == ACCESS_WRITE ? PMPCFG_W : PMPCFG_R);
+    if (!pr || !pr->is_ram || pa + size > pr->addr + pr->size)
+        return NULL;
+    if (access == ACCESS_WRITE && s->machine->n_watch && watch_hit(s->machine, pa, size))
+        return NULL;
+    if (access == ACCESS_WRITE)
+        phys_mem_set_dirty_bit(pr, pa - pr->addr);
+
+    *paddr = pa;
+    return pr->phys_mem + (uintptr_t)(pa - pr->addr);
+}
+
+/* Runs the iterations of a memset/memcpy loop block (see riscv_dbcache.h)
+ * starting at pc that stay within the current pages, up to the last
+ * branch, which is left to the interpreter so that the step still moves
+ * the pc.  Returns the number of instructions retired, 0 if the block
+ * has to be interpreted instead. */
+static uint64_t dbcache_idiom(RISCVCPUState *s, target_ulong pc) {
+    if (!dbcache_goto(s, pc))
+        return 0;
+
+    const RISCVCodeBlock * b  = &s->dbc_block;
+    const RISCVBlockIdiom *id = &b->idiom;
+    if (s->dbc_idx != 0 || id->kind == DBCACHE_IDIOM_NONE || !dbcache_idiom_allowed(s))
+        return 0;
+
+    RISCVMachine *m    = s->machine;
+    uint64_t      w    = id->width;
+    target_ulong  dst  = s->reg[id->dst];
+    target_ulong  src  = s->reg[id->src];
+    target_ulong  end  = s->reg[id->end];
+    target_ulong  from = s->reg[id->cmp];
+    if ((dst | src) & (w - 1))
+        return 0;
+
+    /* iterations until the branch falls through */
+    uint64_t total;
+    if (id->bltu) {
+        if (end > (target_ulong)-w)
+            return 0;
+        total = end <= from || end - from <= w ? 1 : (end - from + w - 1) / w;
+    } else {
+        target_ulong d = end - from;
+        if (d == 0 || d % w)
+            return 0;
+        total = d / w;
+    }
+
+    uint64_t n = total;
+    n          = std::min(n, (PG_MASK + 1 - (dst & PG_MASK)) / w);
+    if (id->kind == DBCACHE_IDIOM_COPY)
+        n = std::min(n, (PG_MASK + 1 - (src & PG_MASK)) / w);
+    /* the step counts as one instruction for the step budgets */
+    n = std::min(n, m->common.maxinsns / b->n_insns);
+    n = std::min(n, m->common.trace / b->n_insns);
+    if (s->next_event != UINT64_MAX)
+        n = std::min(n, (s->next_event - s->insn_counter) / b->n_insns);
+    if (n == 0)
+        return 0;
+
+    uint64_t bytes = n * w;
+    uint64_t dst_paddr, src_paddr;
+    uint8_t *hsrc = NULL;
+    if (id->kind == DBCACHE_IDIOM_COPY) {
+        hsrc = dbcache_idiom_map(s, src, bytes, ACCESS_READ, &src_paddr);
+        if (!hsrc)
+            return 0;
+    }
+    uint8_t *hdst = dbcache_idiom_map(s, dst, bytes, ACCESS_WRITE, &dst_paddr);
+    if (!hdst)
+        return 0;
+    /* the loop must not overwrite itself, nor read what it just wrote */
+    if (dst_paddr < b->paddr + b->size && b->paddr < dst_paddr + bytes)
+        return 0;
+    if (hsrc && hsrc < hdst && hdst < hsrc + bytes)
+        return 0;
+
+    if (hsrc) {
+        const uint8_t *last = hsrc + bytes - w;
+        target_ulong   v    = 0;
+        switch (id->load_funct3) {
+            case 0: v = (int8_t)*last; break;
+            case 1: v = (int16_t)*(const uint16_t *)last; break;
+            case 2: v = (int32_t)*(const uint32_t *)last; break;
+            case 3: v = *(const uint64_t *)last; break;
+            case 4: v = *last; break;
+            case 5: v = *(const uint16_t *)last; break;
+            case 6: v = *(const uint32_t *)last; break;
+        }
+        memmove(hdst, hsrc, bytes);
+        s->reg[id->src] += bytes;
+        if (id->tmp)
+            s->reg[id->tmp] = v;
+    } else {
+        memset(hdst, 0, bytes);
+    }
+    s->reg[id->dst] += bytes;
+    riscv_dbcache_write(m->dbcache, hdst, bytes);
+    if (m->selfcheck)
+        selfcheck_write(s, dst_paddr, hdst, bytes);
+
+    uint64_t retired = n * b->n_insns - 1;
+    s->pc            = pc + b->size - ((b->insn[b->n_insns - 1] & 3) == 3 ? 4 : 2);
+    s->dbc_pc        = s->pc;
+    s->dbc_idx       = b->n_insns - 1;
+    m->common.maxinsns -= retired - 1;
+    m->common.trace -= retired - 1;
+
+    return retired;
 }
 
 static void tlb_flush_all(RISCVCPUState *s) { tlb_init(s); }
 
-static void tlb_flush_vaddr(RISCVCPUState *s, target_ulong vaddr) { tlb_flush_all(s); }
+void riscv_watch_add(RISCVMachine *m, uint64_t paddr, uint64_t size) {
+    m->watch = (RISCVWatch *)realloc(m->watch, (m->n_watch + 1) * sizeof *m->watch);
+    m->watch[m->n_watch++] = RISCVWatch{paddr, paddr + size - 1};
+
+    for (int i = 0; i < m->ncpus; ++i) tlb_flush_all(m->cpu_state[i]);
+}
+
+static inline void tlb_flush_entry(TLBEntry *e, const uint8_t *shift, target_ulong vaddr) {
+    if (*shift && e->vaddr != (target_ulong)-1 && ((e->vaddr ^ vaddr) >> *shift) == 0)
+        e->vaddr = -1;
+}
+
+/* Drops the entries that may hold the translation of vaddr.  Entries are
+ * per 4 KiB page: the 16 pages of a Svnapot range go together, and the
+ * entries filled from a 2M/1G page are found by their recorded size.
+ * The block cache is physically addressed, only the current
+ * block, which was reached through the old mapping, has to go. */
+static void tlb_flush_vaddr(RISCVCPUState *s, target_ulong vaddr) {
+    if (s->tlb_superpages) {
+        for (int i = 0; i < TLB_SIZE; i++) {
+            tlb_flush_entry(&s->tlb_read[i], &s->tlb_read_shift[i], vaddr);
+            tlb_flush_entry(&s->tlb_write[i], &s->tlb_write_shift[i], vaddr);
+            tlb_flush_entry(&s->tlb_code[i], &s->tlb_code_shift[i], vaddr);
+        }
+    }
+
+    const target_ulong size = (target_ulong)1 << NAPOT_SHIFT;
+    target_ulong       base = vaddr & ~(size - 1);
+    for (target_ulong va = base; va - base < size; va += PG_MASK + 1) {
+        int idx = (va >> PG_SHIFT) & (TLB_SIZE - 1);
+        if (s->tlb_read[idx].vaddr == va)
+            s->tlb_read[idx].vaddr = -1;
+        if (s->tlb_write[idx].vaddr == va)
+            s->tlb_write[idx].vaddr = -1;
+        if (s->tlb_code[idx].vaddr == va)
+            s->tlb_code[idx].vaddr = -1;
+    }
+    s->dbc_block.n_insns = 0;
+}
 
 void riscv_cpu_flush_tlb_write_range_ram(RISCVCPUState *s, uint8_t *ram_ptr, size_t ram_size) {
     uint8_t *ram_end = ram_ptr + ram_size;
@@ -813,253 +1502,6 @@ static BOOL counter_access_ok(RISCVCPUState *s, uint32_t csr) {
     return (counteren >> (csr & 31)) & 1;
 }
 
-/* return -1 if invalid CSR. 0 if OK. 'will_write' indicate that the
-   csr will be written after (used for CSR access check) */
-static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr, BOOL will_write) {
-    target_ulong val;
-
-    if (((csr & 0xc00) == 0xc00) && will_write)
-        return -1; /* read-only CSR */
-    if (s->priv < ((csr >> 8) & 3))
-        return -1; /* not enough priviledge */
-
-    switch (csr) {
-#if FLEN > 0
-        case 0x001: /* fflags */
-            if (s->fs == 0)
-                return -1;
-            val = s->fflags;
-            break;
-        case 0x002: /* frm */
-            if (s->fs == 0)
-                return -1;
-            val = s->frm;
-            break;
-        case 0x003:
-            if (s->fs == 0)
-                return -1;
-            val = s->fflags | (s->frm << 5);
-            break;
-#endif
-        case 0x100: val = get_mstatus(s, SSTATUS_MASK); break;
-        case 0x104: /* sie */ val = s->mie & s->mideleg; break;
-        case 0x105: val = s->stvec; break;
-        case 0x106: val = s->scounteren; break;
-        case 0x140: val = s->sscratch; break;
-        case 0x141: val = s->sepc; break;
-        case 0x142: val = s->scause; break;
-        case 0x143: val = s->stval; break;
-        case 0x144: /* sip */ val = s->mip & s->mideleg; break;
-        case 0x180:
-            if (s->priv == PRV_S && s->mstatus & MSTATUS_TVM)
-                return -1;
-            val = s->satp;
-            break;
-        case 0x300: val = get_mstatus(s, (target_ulong)-1); break;
-        case 0x301:
-            val = s->misa;
-            val |= (target_ulong)2 << 62;
-            break;
-        case 0x302: val = s->medeleg; break;
-        case 0x303: val = s->mideleg; break;
-        case 0x304: val = s->mie; break;
-        case 0x305: val = s->mtvec; break;
-        case 0x306: val = s->mcounteren; break;
-        case 0x320: val = s->mcountinhibit; break;
-        case 0x340: val = s->mscratch; break;
-        case 0x341: val = s->mepc; break;
-        case 0x342: val = s->mcause; break;
-        case 0x343: val = s->mtval; break;
-        case 0x344: val = s->mip; break;
-
-        case 0x7a0:  // tselect
-            val = s->tselect;
-            break;
-
-        case 0x7a1:  // tdata1
-            val = s->tdata1[s->tselect];
-            break;
-
-        case 0x7a2:  // tdata2
-            val = s->tdata2[s->tselect];
-            break;
-
-        case 0x7a3:  // tdata3
-            val = s->tdata3[s->tselect];
-            break;
-
-        case 0x7b0:
-            if (!s->debug_mode)
-                goto invalid_csr;
-            val = s->dcsr;
-            break;
-
-        case 0x7b1:
-            if (!s->debug_mode)
-                goto invalid_csr;
-            val = s->dpc;
-            break;
-
-        case 0x7b2:
-            if (!s->debug_mode)
-                goto invalid_csr;
-            val = s->dscratch;
-            break;
-
-        case 0xb00: /* mcycle */
-        case 0xc00: /* cycle */
-            if (!counter_access_ok(s, csr))
-                goto invalid_csr;
-            val = (int64_t)s->mcycle;
-            break;
-
-        case 0xb02: /* minstret */
-        case 0xc02: /* uinstret */
-            if (!counter_access_ok(s, csr))
-                goto invalid_csr;
-            val = (int64_t)s->minstret;
-            break;
-        case 0xb03:
-        case 0xc03:
-        case 0xb04:
-        case 0xc04:
-        case 0xb05:
-        case 0xc05:
-        case 0xb06:
-        case 0xc06:
-        case 0xb07:
-        case 0xc07:
-        case 0xb08:
-        case 0xc08:
-        case 0xb09:
-        case 0xc09:
-        case 0xb0a:
-        case 0xc0a:
-        case 0xb0b:
-        case 0xc0b:
-        case 0xb0c:
-        case 0xc0c:
-        case 0xb0d:
-        case 0xc0d:
-        case 0xb0e:
-        case 0xc0e:
-        case 0xb0f:
-        case 0xc0f:
-        case 0xb10:
-        case 0xc10:
-        case 0xb11:
-        case 0xc11:
-        case 0xb12:
-        case 0xc12:
-        case 0xb13:
-        case 0xc13:
-        case 0xb14:
-        case 0xc14:
-        case 0xb15:
-        case 0xc15:
-        case 0xb16:
-        case 0xc16:
-        case 0xb17:
-        case 0xc17:
-        case 0xb18:
-        case 0xc18:
-        case 0xb19:
-        case 0xc19:
-        case 0xb1a:
-        case 0xc1a:
-        case 0xb1b:
-        case 0xc1b:
-        case 0xb1c:
-        case 0xc1c:
-        case 0xb1d:
-        case 0xc1d:
-        case 0xb1e:
-        case 0xc1e:
-        case 0xb1f:
-        case 0xc1f:
-            if (!counter_access_ok(s, csr))
-                goto invalid_csr;
-            val = 0;  // mhpmcounter3..31
-            break;
-
-        case 0xf14: val = s->mhartid; break;
-        case 0xf13: val = s->mimpid; break;
-        case 0xf12: val = s->marchid; break;
-        case 0xf11: val = s->mvendorid; break;
-        case 0x323:
-        case 0x324:
-        case 0x325:
-        case 0x326:
-        case 0x327:
-        case 0x328:
-        case 0x329:
-        case 0x32a:
-        case 0x32b:
-        case 0x32c:
-        case 0x32d:
-        case 0x32e:
-        case 0x32f:
-        case 0x330:
-        case 0x331:
-        case 0x332:
-        case 0x333:
-        case 0x334:
-        case 0x335:
-        case 0x336:
-        case 0x337:
-        case 0x338:
-        case 0x339:
-        case 0x33a:
-        case 0x33b:
-        case 0x33c:
-        case 0x33d:
-        case 0x33e:
-        case 0x33f: val = s->mhpmevent[csr & 0x1F]; break;
-
-        case CSR_PMPCFG(0):  // NB: 1 and 3 are _illegal_ in RV64
-        case CSR_PMPCFG(2): val = s->csr_pmpcfg[csr - CSR_PMPCFG(0)]; break;
-
-        case CSR_PMPADDR(0):  // NB: *must* support either none or all
-        case CSR_PMPADDR(1):
-        case CSR_PMPADDR(2):
-        case CSR_PMPADDR(3):
-        case CSR_PMPADDR(4):
-        case CSR_PMPADDR(5):
-        case CSR_PMPADDR(6):
-        case CSR_PMPADDR(7):
-        case CSR_PMPADDR(8):
-        case CSR_PMPADDR(9):
-        case CSR_PMPADDR(10):
-        case CSR_PMPADDR(11):
-        case CSR_PMPADDR(12):
-        case CSR_PMPADDR(13):
-        case CSR_PMPADDR(14):
-        case CSR_PMPADDR(15): val = s->csr_pmpaddr[csr - CSR_PMPADDR(0)]; break;
-#ifdef SIMPOINT_BB
-        case 0x8C2: val = 0; break;
-#endif
-
-        default:
-        invalid_csr:
-            if (s->machine->hooks.csr_read)
-                return s->machine->hooks.csr_read(s, csr, pval);
-
-#ifdef DUMP_INVALID_CSR
-            /* the 'time' counter is usually emulated */
-            if (csr != 0xc01 && csr != 0xc81) {
-                fprintf(dromajo_stderr, "csr_read: invalid CSR=0x%x\n", csr);
-            }
-#endif
-            *pval = 0;
-            return -1;
-    }
-#if defined(DUMP_CSR)
-    fprintf(stderr, "csr_read: hartid=%d csr=0x%03x val=0x%x\n", (int)s->mhartid, csr, (int)val);
-#endif
-    *pval = val;
-    return 0;
-}
-
 #if FLEN > 0
 static void set_frm(RISCVCPUState *s, unsigned int val) { s->frm = val; }
 
@@ -1126,307 +1568,511 @@ static void unpack_pmpaddrs(RISCVCPUState *s) {
             }
         }
     }
+}
 
-    tlb_flush_all(s);  // The TLB partically caches PMP decisions
+/* WARL, only the cache block operation enables and (menvcfg) PBMTE are
+ * implemented and CBIE=10 is reserved */
+static uint64_t envcfg_legalize(uint64_t val, uint64_t mask) {
+    val &= mask;
+    if ((val & ENVCFG_CBIE) == (2 << ENVCFG_CBIE_SHIFT))
+        val &= ~(uint64_t)ENVCFG_CBIE;
+    return val;
 }
 
-/* return -1 if invalid CSR, 0 if OK, -2 if CSR raised an exception,
- * 2 if TLBs have been flushed. */
-static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val) {
-    target_ulong mask;
+/*
+ * CSRs
+ *
+ * Every CSR has a descriptor in the machine's table, indexed by the CSR
+ * number.  csr_read and csr_write do the checks implied by the number
+ * (read-only, privilege) and by the descriptor flags, then call the
+ * handlers.  CSRs without a read handler are passed to the machine hooks.
+ */
+
+/* Plain CSRs, read as is */
+#define CSR_READ_FIELD(name, expr)                                                      \
+    static int csr_read_##name(RISCVCPUState *s, uint32_t csr, target_ulong *pval) { \
+        *pval = (expr);                                                                 \
+        return 0;                                                                       \
+    }
+
+/* Plain CSRs, written without legalization */
+#define CSR_WRITE_FIELD(name, field)                                                 \
+    static int csr_write_##name(RISCVCPUState *s, uint32_t csr, target_ulong val) { \
+        s->field = val;                                                              \
+        return 0;                                                                    \
+    }
 
-#if defined(DUMP_CSR)
-    fprintf(dromajo_stderr, "csr_write: hardid=%d csr=0x%03x val=0x", (int)s->mhartid, csr);
-    print_target_ulong(val);
-    fprintf(dromajo_stderr, "\n");
-#endif
-    switch (csr) {
 #if FLEN > 0
-        case 0x001: /* fflags */
-            s->fflags = val & 0x1f;
-            s->fs     = 3;
-            break;
-        case 0x002: /* frm */
-            set_frm(s, val & 7);
-            s->fs = 3;
-            break;
-        case 0x003: /* fcsr */
-            set_frm(s, (val >> 5) & 7);
-            s->fflags = val & 0x1f;
-            s->fs     = 3;
-            break;
+CSR_READ_FIELD(fflags, s->fflags)
+CSR_READ_FIELD(frm, s->frm)
+CSR_READ_FIELD(fcsr, s->fflags | (s->frm << 5))
+
+static int csr_write_fflags(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->fflags = val & 0x1f;
+    s->fs     = 3;
+    return 0;
+}
+
+static int csr_write_frm(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    set_frm(s, val & 7);
+    s->fs = 3;
+    return 0;
+}
+
+static int csr_write_fcsr(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    set_frm(s, (val >> 5) & 7);
+    s->fflags = val & 0x1f;
+    s->fs     = 3;
+    return 0;
+}
 #endif
-        case 0x100: /* sstatus */ set_mstatus(s, s->mstatus & ~SSTATUS_MASK | val & SSTATUS_MASK); break;
-        case 0x104: /* sie */
-            mask   = s->mideleg;
-            s->mie = s->mie & ~mask | val & mask;
-            break;
-        case 0x105:
-            // enforce 256-byte alignment for vectored interrupts
-            if (val & 1)
-                val &= ~255 + 1;
-            s->stvec = val & ~2;
-            break;
-        case 0x106: s->scounteren = val; break;
-        case 0x140: s->sscratch = val; break;
-        case 0x141:
-            s->sepc = val & (s->misa & MCPUID_C ? ~1 : ~3);
-            s->sepc = SEPC_TRUNCATE(s->sepc);
-            break;
-        case 0x142: s->scause = val & SCAUSE_MASK; break;
-        case 0x143: s->stval = STVAL_TRUNCATE(val); break;
-        case 0x144: /* sip */
-            mask   = s->mideleg;
-            s->mip = s->mip & ~mask | val & mask;
-            break;
-        case 0x180:
-            if (s->priv == PRV_S && s->mstatus & MSTATUS_TVM)
-                return -1;
-            {
-                uint64_t mode = (val >> 60) & 15;
-                if (mode == 0 || mode == 8 || mode == 9)
-                    s->satp = val & SATP_MASK;
-            }
-            /* no ASID implemented [yet] */
-            tlb_flush_all(s);
-            return 2;
 
-        case 0x300: set_mstatus(s, val); break;
-        case 0x301: /* misa */
-            /* We don't support changing misa */
-            break;
-        case 0x302: {
-            target_ulong mask = 0xB109;  // matching Spike
-            s->medeleg        = s->medeleg & ~mask | val & mask;
-            break;
-        }
-        case 0x303:
-            mask       = MIP_SSIP | MIP_STIP | MIP_SEIP;
-            s->mideleg = s->mideleg & ~mask | val & mask;
-            break;
-        case 0x304:
-            mask = MIE_MCIP /*| MIE_SCIP | MIE_UCIP*/ | MIE_MEIE | MIE_SEIE /*| MIE_UEIE*/ | MIE_MTIE | MIE_STIE
-                   | /*MIE_UTIE | */ MIE_MSIE | MIE_SSIE /*| MIE_USIE */;
-            s->mie = s->mie & ~mask | val & mask;
-            break;
-        case 0x305:
-            // enforce 256-byte alignment for vectored interrupts
-            if (val & 1)
-                val &= ~255 + 1;
-            s->mtvec = val & ((1ull << s->physical_addr_len) - 3);  // mtvec[1] === 0
-            break;
-        case 0x306: s->mcounteren = val; break;
-        case 0x320: s->mcountinhibit = val & ~2; break;
-        case 0x340: s->mscratch = val; break;
-        case 0x341:
-            s->mepc = val & (s->misa & MCPUID_C ? ~1 : ~3);
-            s->mepc = MEPC_TRUNCATE(s->mepc);
-            break;
-        case 0x342: s->mcause = val & MCAUSE_MASK; break;
-        case 0x343: s->mtval = MTVAL_TRUNCATE(val); break;
-        case 0x344:
-            mask   = /* MEIP | */ MIP_SEIP | /*MIP_UEIP | MTIP | */ MIP_STIP | /*MIP_UTIP | MSIP | */ MIP_SSIP /*| MIP_USIP*/;
-            s->mip = s->mip & ~mask | val & mask;
-            break;
+CSR_READ_FIELD(sstatus, get_mstatus(s, SSTATUS_MASK))
+CSR_READ_FIELD(sie, s->mie & s->mideleg)
+CSR_READ_FIELD(stvec, s->stvec)
+CSR_READ_FIELD(scounteren, s->scounteren)
+CSR_READ_FIELD(senvcfg, s->senvcfg)
+CSR_READ_FIELD(sscratch, s->sscratch)
+CSR_READ_FIELD(sepc, s->sepc)
+CSR_READ_FIELD(scause, s->scause)
+CSR_READ_FIELD(stval, s->stval)
+CSR_READ_FIELD(sip, s->mip & s->mideleg)
+CSR_READ_FIELD(satp, s->satp)
+
+static int csr_write_sstatus(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    set_mstatus(s, s->mstatus & ~SSTATUS_MASK | val & SSTATUS_MASK);
+    return 0;
+}
 
-        case 0x7a0:  // tselect
-            s->tselect = val % MAX_TRIGGERS;
-            break;
+static int csr_write_sie(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    target_ulong mask = s->mideleg;
+    s->mie            = s->mie & ~mask | val & mask;
+    return 0;
+}
 
-        case 0x7a1:  // tdata1
-            // Only support No Trigger and MControl
-            {
-                int type = val >> 60;
-                if (type != 0 && type != 2)
-                    break;
-                // SW can write type and mcontrol bits M and EXECUTE
-                mask                  = ((target_ulong)15 << 60) | MCONTROL_M | MCONTROL_EXECUTE;
-                s->tdata1[s->tselect] = s->tdata1[s->tselect] & ~mask | val & mask;
-            }
-            break;
+static int csr_write_stvec(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    // enforce 256-byte alignment for vectored interrupts
+    if (val & 1)
+        val &= ~255 + 1;
+    s->stvec = val & ~2;
+    return 0;
+}
 
-        case 0x7a2:  // tdata2
-            s->tdata2[s->tselect] = val;
-            break;
+CSR_WRITE_FIELD(scounteren, scounteren)
 
-        case 0x7a3:  // tdata3
-            s->tdata3[s->tselect] = val;
-            break;
+static int csr_write_senvcfg(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->senvcfg = envcfg_legalize(val, ENVCFG_MASK);
+    return 0;
+}
 
-        case 0x7b0:
-            if (!s->debug_mode)
-                goto invalid_csr;
-            /* XXX We have a very incomplete implementation of debug mode, only just enough
-               to restore a snapshot and stop counters */
-            mask                = 0x603;  // stopcount and stoptime && also the priv level to return
-            s->dcsr             = s->dcsr & ~mask | val & mask;
-            s->stop_the_counter = s->dcsr & 0x600 != 0;
-            break;
+CSR_WRITE_FIELD(sscratch, sscratch)
 
-        case 0x7b1:
-            if (!s->debug_mode)
-                goto invalid_csr;
-            s->dpc = val & (s->misa & MCPUID_C ? ~1 : ~3);
-            break;
+static int csr_write_sepc(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->sepc = val & (s->misa & MCPUID_C ? ~1 : ~3);
+    s->sepc = SEPC_TRUNCATE(s->sepc);
+    return 0;
+}
 
-        case 0x7b2:
-            if (!s->debug_mode)
-                goto invalid_csr;
-            s->dscratch = val;
-            break;
+static int csr_write_scause(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->scause = val & SCAUSE_MASK;
+    return 0;
+}
 
-        case 0x323:
-        case 0x324:
-        case 0x325:
-        case 0x326:
-        case 0x327:
-        case 0x328:
-        case 0x329:
-        case 0x32a:
-        case 0x32b:
-        case 0x32c:
-        case 0x32d:
-        case 0x32e:
-        case 0x32f:
-        case 0x330:
-        case 0x331:
-        case 0x332:
-        case 0x333:
-        case 0x334:
-        case 0x335:
-        case 0x336:
-        case 0x337:
-        case 0x338:
-        case 0x339:
-        case 0x33a:
-        case 0x33b:
-        case 0x33c:
-        case 0x33d:
-        case 0x33e:
-        case 0x33f: s->mhpmevent[csr & 0x1F] = val & (HPM_EVENT_SETMASK | HPM_EVENT_EVENTMASK); break;
-
-        case CSR_PMPCFG(0):  // NB: 1 and 3 are _illegal_ in RV64
-        case CSR_PMPCFG(2): {
-            assert(PMP_N % 8 == 0);
-            int c = csr - CSR_PMPCFG(0);
-
-            if (PMP_N <= c / 2 * 8)
-                break;
+static int csr_write_stval(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->stval = STVAL_TRUNCATE(val);
+    return 0;
+}
 
-            uint64_t orig    = s->csr_pmpcfg[c];
-            uint64_t new_val = 0;
+static int csr_write_sip(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    target_ulong mask = s->mideleg;
+    s->mip            = s->mip & ~mask | val & mask;
+    return 0;
+}
 
-            for (int i = 0; i < 8; ++i) {
-                uint64_t cfg = (orig >> (i * 8)) & 255;
-                if ((cfg & PMPCFG_L) == 0)
-                    cfg = (val >> (i * 8)) & 255;
-                cfg &= ~PMPCFG_RES;
-                new_val |= cfg << (i * 8);
-            }
+/* no ASID implemented [yet], the TLBs are flushed (CSR_FLUSH_TLB) */
+static int csr_write_satp(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    uint64_t mode = (val >> 60) & 15;
+    if (mode == 0 || mode == 8 || mode == 9) {
+        if (unlikely(s->machine->procstats) && s->satp != (val & SATP_MASK))
+            riscv_procstats_switch(s, s->priv, val & SATP_MASK);
+        s->satp = val & SATP_MASK;
+    }
+    if (s->tlbmodel)
+        riscv_tlbmodel_set_satp(s->tlbmodel);
+    return 0;
+}
 
-            s->csr_pmpcfg[c] = new_val;
+CSR_READ_FIELD(mstatus, get_mstatus(s, (target_ulong)-1))
+CSR_READ_FIELD(misa, s->misa | (target_ulong)2 << 62)
+CSR_READ_FIELD(medeleg, s->medeleg)
+CSR_READ_FIELD(mideleg, s->mideleg)
+CSR_READ_FIELD(mie, s->mie)
+CSR_READ_FIELD(mtvec, s->mtvec)
+CSR_READ_FIELD(mcounteren, s->mcounteren)
+CSR_READ_FIELD(menvcfg, s->menvcfg)
+CSR_READ_FIELD(mcountinhibit, s->mcountinhibit)
+CSR_READ_FIELD(mscratch, s->mscratch)
+CSR_READ_FIELD(mepc, s->mepc)
+CSR_READ_FIELD(mcause, s->mcause)
+CSR_READ_FIELD(mtval, s->mtval)
+CSR_READ_FIELD(mip, s->mip)
+
+static int csr_write_mstatus(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    set_mstatus(s, val);
+    return 0;
+}
 
-            unpack_pmpaddrs(s);
-            break;
-        }
+/* We don't support changing misa */
+static int csr_write_ignore(RISCVCPUState *s, uint32_t csr, target_ulong val) { return 0; }
 
-        case CSR_PMPADDR(0):  // NB: *must* support either none or all
-        case CSR_PMPADDR(1):
-        case CSR_PMPADDR(2):
-        case CSR_PMPADDR(3):
-        case CSR_PMPADDR(4):
-        case CSR_PMPADDR(5):
-        case CSR_PMPADDR(6):
-        case CSR_PMPADDR(7):
-        case CSR_PMPADDR(8):
-        case CSR_PMPADDR(9):
-        case CSR_PMPADDR(10):
-        case CSR_PMPADDR(11):
-        case CSR_PMPADDR(12):
-        case CSR_PMPADDR(13):
-        case CSR_PMPADDR(14):
-        case CSR_PMPADDR(15):
-            if (PMP_N <= csr - CSR_PMPADDR(0))
-                break;
+static int csr_write_medeleg(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    target_ulong mask = 0xB109;  // matching Spike
+    s->medeleg        = s->medeleg & ~mask | val & mask;
+    return 0;
+}
 
-            // Note, due to TOR ranges, one PMPADDR can affect two entries
-            // but we just recalculate all of them
-            s->csr_pmpaddr[csr - CSR_PMPADDR(0)] = val & PMPADDR_MASK;
-            unpack_pmpaddrs(s);
-            break;
+static int csr_write_mideleg(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    target_ulong mask = MIP_SSIP | MIP_STIP | MIP_SEIP;
+    s->mideleg        = s->mideleg & ~mask | val & mask;
+    return 0;
+}
 
-        case 0xb00: /* mcycle */ s->mcycle = val; break;
-        case 0xb02: /* minstret */ s->minstret = val; break;
-        case 0xb03:
-        case 0xb04:
-        case 0xb05:
-        case 0xb06:
-        case 0xb07:
-        case 0xb08:
-        case 0xb09:
-        case 0xb0a:
-        case 0xb0b:
-        case 0xb0c:
-        case 0xb0d:
-        case 0xb0e:
-        case 0xb0f:
-        case 0xb10:
-        case 0xb11:
-        case 0xb12:
-        case 0xb13:
-        case 0xb14:
-        case 0xb15:
-        case 0xb16:
-        case 0xb17:
-        case 0xb18:
-        case 0xb19:
-        case 0xb1a:
-        case 0xb1b:
-        case 0xb1c:
-        case 0xb1d:
-        case 0xb1e:
-        case 0xb1f:
-            // Allow, but ignore to write to performance counters mhpmcounter
-            break;
-#ifdef SIMPOINT_BB
-        case 0x8C2:
-            if ((val & 3) == 3) {
-                fprintf(dromajo_stderr, "simpoint adjust maxinsns to %lld\n", (long long)val >> 2);
-                s->machine->common.maxinsns = val >> 2;
-            } else if ((val & 3) == 2) {
-                fprintf(dromajo_stderr, "simpoint terminate\n");
-                s->benchmark_exit_code  = val >> 2;
-                s->terminate_simulation = 1;
-            } else if ((val & 1) && simpoint_roi) {
-                fprintf(dromajo_stderr, "simpoint ROI already started\n");
-            } else if ((val & 1) == 0 && simpoint_roi) {
-                fprintf(dromajo_stderr, "simpoint ROI finished\n");
-                simpoint_roi = 0;
-            } else if ((val & 1) == 0 && simpoint_roi == 0) {
-                fprintf(dromajo_stderr, "simpoint ROI already finished\n");
-            } else {
-                fprintf(dromajo_stderr, "simpoint ROI started\n");
-                simpoint_roi = 1;
-            }
+static int csr_write_mie(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    target_ulong mask = MIE_MCIP /*| MIE_SCIP | MIE_UCIP*/ | MIE_MEIE | MIE_SEIE /*| MIE_UEIE*/ | MIE_MTIE | MIE_STIE
+                        | /*MIE_UTIE | */ MIE_MSIE | MIE_SSIE /*| MIE_USIE */;
+    s->mie = s->mie & ~mask | val & mask;
+    return 0;
+}
 
-            break;
+static int csr_write_mtvec(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    // enforce 256-byte alignment for vectored interrupts
+    if (val & 1)
+        val &= ~255 + 1;
+    s->mtvec = val & ((1ull << s->physical_addr_len) - 3);  // mtvec[1] === 0
+    return 0;
+}
+
+CSR_WRITE_FIELD(mcounteren, mcounteren)
+
+static int csr_write_menvcfg(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    uint64_t old = s->menvcfg;
+    s->menvcfg   = envcfg_legalize(val, ENVCFG_MASK | ENVCFG_PBMTE);
+    if ((old ^ s->menvcfg) & ENVCFG_PBMTE) {
+        /* the translations cached in the TLBs depend on it */
+        tlb_flush_all(s);
+        return 2;
+    }
+    return 0;
+}
+
+static int csr_write_mcountinhibit(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->mcountinhibit = val & ~2;
+    return 0;
+}
+
+CSR_WRITE_FIELD(mscratch, mscratch)
+
+static int csr_write_mepc(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->mepc = val & (s->misa & MCPUID_C ? ~1 : ~3);
+    s->mepc = MEPC_TRUNCATE(s->mepc);
+    return 0;
+}
+
+static int csr_write_mcause(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->mcause = val & MCAUSE_MASK;
+    return 0;
+}
+
+static int csr_write_mtval(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->mtval = MTVAL_TRUNCATE(val);
+    return 0;
+}
+
+static int csr_write_mip(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    target_ulong mask = /* MEIP | */ MIP_SEIP | /*MIP_UEIP | MTIP | */ MIP_STIP | /*MIP_UTIP | MSIP | */ MIP_SSIP /*| MIP_USIP*/;
+    s->mip            = s->mip & ~mask | val & mask;
+    return 0;
+}
+
+CSR_READ_FIELD(mhpmevent, s->mhpmevent[csr & 0x1F])
+
+static int csr_write_mhpmevent(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->mhpmevent[csr & 0x1F] = val & (HPM_EVENT_SETMASK | HPM_EVENT_EVENTMASK);
+    return 0;
+}
+
+CSR_READ_FIELD(tselect, s->tselect)
+CSR_READ_FIELD(tdata1, s->tdata1[s->tselect])
+CSR_READ_FIELD(tdata2, s->tdata2[s->tselect])
+CSR_READ_FIELD(tdata3, s->tdata3[s->tselect])
+CSR_READ_FIELD(tinfo, 1 << 2)  // mcontrol only
+
+static int csr_write_tselect(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->tselect = val % MAX_TRIGGERS;
+    return 0;
+}
+
+/* Only support No Trigger and MControl, the TLBs are flushed
+ * (CSR_FLUSH_TLB) as they must not hold the pages of load/store triggers */
+static int csr_write_tdata1(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    int type = val >> 60;
+    if (type != 0 && type != 2)
+        return 0;
+    // SW can write type, hit, match and the mcontrol mode and access bits;
+    // timing, select, action and chain are hardwired to 0
+    target_ulong mask = ((target_ulong)15 << 60) | MCONTROL_HIT | MCONTROL_MATCH | MCONTROL_M | MCONTROL_S | MCONTROL_U
+                        | MCONTROL_EXECUTE | MCONTROL_STORE | MCONTROL_LOAD;
+    val = s->tdata1[s->tselect] & ~mask | val & mask;
+    if (((val & MCONTROL_MATCH) >> MCONTROL_MATCH_SHIFT) > MCONTROL_MATCH_LT)
+        val &= ~(target_ulong)MCONTROL_MATCH;
+    s->tdata1[s->tselect] = val;
+    triggers_update(s);
+    return 0;
+}
+
+static int csr_write_tdata2(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->tdata2[s->tselect] = val;
+    triggers_update(s);
+    return 0;
+}
+
+static int csr_write_tdata3(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->tdata3[s->tselect] = val;
+    return 0;
+}
+
+CSR_READ_FIELD(dcsr, s->dcsr)
+CSR_READ_FIELD(dpc, s->dpc)
+CSR_READ_FIELD(dscratch, s->dscratch)
+
+/* XXX We have a very incomplete implementation of debug mode, only just enough
+   to restore a snapshot and stop counters */
+static int csr_write_dcsr(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    target_ulong mask   = 0x603;  // stopcount and stoptime && also the priv level to return
+    s->dcsr             = s->dcsr & ~mask | val & mask;
+    s->stop_the_counter = s->dcsr & 0x600 != 0;
+    return 0;
+}
+
+static int csr_write_dpc(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    s->dpc = val & (s->misa & MCPUID_C ? ~1 : ~3);
+    return 0;
+}
+
+CSR_WRITE_FIELD(dscratch, dscratch)
+
+CSR_READ_FIELD(cycle, (int64_t)s->mcycle)
+CSR_READ_FIELD(instret, (int64_t)s->minstret)
+CSR_READ_FIELD(hpmcounter, 0)  // mhpmcounter3..31, writes are allowed but ignored
+
+CSR_WRITE_FIELD(mcycle, mcycle)
+CSR_WRITE_FIELD(minstret, minstret)
+
+CSR_READ_FIELD(mhartid, s->mhartid)
+CSR_READ_FIELD(mimpid, s->mimpid)
+CSR_READ_FIELD(marchid, s->marchid)
+CSR_READ_FIELD(mvendorid, s->mvendorid)
+
+CSR_READ_FIELD(pmpcfg, s->csr_pmpcfg[csr - CSR_PMPCFG(0)])
+CSR_READ_FIELD(pmpaddr, s->csr_pmpaddr[csr - CSR_PMPADDR(0)])
+
+/* The TLBs partially cache PMP decisions, they are flushed (CSR_FLUSH_TLB) */
+static int csr_write_pmpcfg(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    assert(PMP_N % 8 == 0);
+    int c = csr - CSR_PMPCFG(0);
+
+    if (PMP_N <= c / 2 * 8)
+        return 0;
+
+    uint64_t orig    = s->csr_pmpcfg[c];
+    uint64_t new_val = 0;
+
+    for (int i = 0; i < 8; ++i) {
+        uint64_t cfg = (orig >> (i * 8)) & 255;
+        if ((cfg & PMPCFG_L) == 0)
+            cfg = (val >> (i * 8)) & 255;
+        cfg &= ~PMPCFG_RES;
+        new_val |= cfg << (i * 8);
+    }
+
+    s->csr_pmpcfg[c] = new_val;
+
+    unpack_pmpaddrs(s);
+    return 0;
+}
+
+static int csr_write_pmpaddr(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+    if (PMP_N <= csr - CSR_PMPADDR(0))
+        return 0;
+
+    // Note, due to TOR ranges, one PMPADDR can affect two entries
+    // but we just recalculate all of them
+    s->csr_pmpaddr[csr - CSR_PMPADDR(0)] = val & PMPADDR_MASK;
+    unpack_pmpaddrs(s);
+    return 0;
+}
+
+#undef CSR_READ_FIELD
+#undef CSR_WRITE_FIELD
+
+void riscv_csr_register(RISCVMachine *m, uint32_t csr, RISCVCSRRead read, RISCVCSRWrite write, uint32_t flags,
+                        void *opaque) {
+    assert(csr < 4096);
+    m->csrs[csr].read   = read;
+    m->csrs[csr].write  = write;
+    m->csrs[csr].flags  = flags;
+    m->csrs[csr].opaque = opaque;
+}
+
+void riscv_csr_init(RISCVMachine *m) {
+#define REG(csr, name, flags)         riscv_csr_register(m, csr, csr_read_##name, csr_write_##name, flags, NULL)
+#define REG_RO(csr, name, flags)      riscv_csr_register(m, csr, csr_read_##name, NULL, flags, NULL)
+#define REG_IGNORE(csr, name, flags)  riscv_csr_register(m, csr, csr_read_##name, csr_write_ignore, flags, NULL)
+
+#if FLEN > 0
+    REG(0x001, fflags, CSR_FS);
+    REG(0x002, frm, CSR_FS);
+    REG(0x003, fcsr, CSR_FS);
 #endif
 
-        default:
-            if (s->machine->hooks.csr_write)
-                return s->machine->hooks.csr_write(s, csr, val);
+    REG(0x100, sstatus, 0);
+    REG(0x104, sie, 0);
+    REG(0x105, stvec, 0);
+    REG(0x106, scounteren, 0);
+    REG(0x10a, senvcfg, 0);
+    REG(0x140, sscratch, 0);
+    REG(0x141, sepc, 0);
+    REG(0x142, scause, 0);
+    REG(0x143, stval, 0);
+    REG(0x144, sip, 0);
+    REG(0x180, satp, CSR_TVM | CSR_FLUSH_TLB);
+
+    REG(0x300, mstatus, 0);
+    REG_IGNORE(0x301, misa, 0);
+    REG(0x302, medeleg, 0);
+    REG(0x303, mideleg, 0);
+    REG(0x304, mie, 0);
+    REG(0x305, mtvec, 0);
+    REG(0x306, mcounteren, 0);
+    REG(0x30a, menvcfg, 0);
+    REG(0x320, mcountinhibit, 0);
+    for (uint32_t csr = 0x323; csr <= 0x33f; ++csr) REG(csr, mhpmevent, 0);
+    REG(0x340, mscratch, 0);
+    REG(0x341, mepc, 0);
+    REG(0x342, mcause, 0);
+    REG(0x343, mtval, 0);
+    REG(0x344, mip, 0);
+
+    // NB: pmpcfg1 and 3 are _illegal_ in RV64, PMPADDR *must* support either none or all
+    REG(CSR_PMPCFG(0), pmpcfg, CSR_FLUSH_TLB);
+    REG(CSR_PMPCFG(2), pmpcfg, CSR_FLUSH_TLB);
+    for (uint32_t i = 0; i < 16; ++i) REG(CSR_PMPADDR(i), pmpaddr, CSR_FLUSH_TLB);
+
+    REG(0x7a0, tselect, 0);
+    REG(0x7a1, tdata1, CSR_FLUSH_TLB);
+    REG(0x7a2, tdata2, CSR_FLUSH_TLB);
+    REG(0x7a3, tdata3, 0);
+    REG_IGNORE(0x7a4, tinfo, 0);
+    REG(0x7b0, dcsr, CSR_DEBUG);
+    REG(0x7b1, dpc, CSR_DEBUG);
+    REG(0x7b2, dscratch, CSR_DEBUG);
+
+    riscv_csr_register(m, 0xb00, csr_read_cycle, csr_write_mcycle, CSR_COUNTER, NULL);
+    riscv_csr_register(m, 0xb02, csr_read_instret, csr_write_minstret, CSR_COUNTER, NULL);
+    REG_RO(0xc00, cycle, CSR_COUNTER);
+    REG_RO(0xc02, instret, CSR_COUNTER);
+    for (uint32_t i = 3; i < 32; ++i) {
+        REG_IGNORE(0xb00 + i, hpmcounter, CSR_COUNTER);
+        REG_RO(0xc00 + i, hpmcounter, CSR_COUNTER);
+    }
+
+    REG_RO(0xf11, mvendorid, 0);
+    REG_RO(0xf12, marchid, 0);
+    REG_RO(0xf13, mimpid, 0);
+    REG_RO(0xf14, mhartid, 0);
+
+#undef REG
+#undef REG_RO
+#undef REG_IGNORE
+}
+
+/* Checks of the descriptor flags, common to reads and writes */
+static bool csr_access_ok(RISCVCPUState *s, uint32_t csr, uint32_t flags) {
+    if ((flags & CSR_FS) && s->fs == 0)
+        return false;
+    if ((flags & CSR_COUNTER) && !counter_access_ok(s, csr))
+        return false;
+    if ((flags & CSR_DEBUG) && !s->debug_mode)
+        return false;
+    if ((flags & CSR_TVM) && s->priv == PRV_S && s->mstatus & MSTATUS_TVM)
+        return false;
+    return true;
+}
+
+/* return -1 if invalid CSR. 0 if OK. 'will_write' indicate that the
+   csr will be written after (used for CSR access check) */
+static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr, BOOL will_write) {
+    if (((csr & 0xc00) == 0xc00) && will_write)
+        return -1; /* read-only CSR */
+    if (s->priv < ((csr >> 8) & 3))
+        return -1; /* not enough priviledge */
+
+    /* the hooks may provide the CSRs Dromajo lacks or denies access to */
+    const RISCVCSRDesc *d = &s->machine->csrs[csr];
+    if (unlikely(!d->read || (d->flags && !csr_access_ok(s, csr, d->flags)))) {
+        if (s->machine->hooks.csr_read)
+            return s->machine->hooks.csr_read(s, csr, pval);
 
-        invalid_csr:
 #ifdef DUMP_INVALID_CSR
-            fprintf(dromajo_stderr, "csr_write: invalid CSR=0x%x\n", csr);
+        /* the 'time' counter is usually emulated */
+        if (csr != 0xc01 && csr != 0xc81) {
+            fprintf(dromajo_stderr, "csr_read: invalid CSR=0x%x\n", csr);
+        }
 #endif
-            return -1;
+        *pval = 0;
+        return -1;
     }
-    return 0;
+
+    int err = d->read(s, csr, pval);
+#if defined(DUMP_CSR)
+    fprintf(stderr, "csr_read: hartid=%d csr=0x%03x val=0x%x\n", (int)s->mhartid, csr, (int)*pval);
+#endif
+    return err;
+}
+
+/* return -1 if invalid CSR, 0 if OK, -2 if CSR raised an exception,
+ * 2 if TLBs have been flushed. */
+
+static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val) {
+#if defined(DUMP_CSR)
+    fprintf(dromajo_stderr, "csr_write: hardid=%d csr=0x%03x val=0x", (int)s->mhartid, csr);
+    print_target_ulong(val);
+    fprintf(dromajo_stderr, "\n");
+#endif
+    const RISCVCSRDesc *d = &s->machine->csrs[csr];
+    if (unlikely(!d->read || (d->flags && !csr_access_ok(s, csr, d->flags)))) {
+        if (s->machine->hooks.csr_write)
+            return s->machine->hooks.csr_write(s, csr, val);
+    } else if (d->write) {
+        int err = d->write(s, csr, val);
+        if (err < 0 || !(d->flags & CSR_FLUSH_TLB))
+            return err;
+        tlb_flush_all(s);
+        return 2;
+    }
+
+#ifdef DUMP_INVALID_CSR
+    fprintf(dromajo_stderr, "csr_write: invalid CSR=0x%x\n", csr);
+#endif
+    return -1;
 }
 
 static void set_priv(RISCVCPUState *s, int priv) {
     if (s->priv != priv) {
+        if (unlikely(s->machine->procstats))
+            riscv_procstats_switch(s, priv, s->satp);
+        if (unlikely(s->machine->telemetry))
+            riscv_telemetry_priv(s);
         tlb_flush_all(s);
         s->priv = priv;
     }
@@ -1475,6 +2121,11 @@ static void raise_exception2(RISCVCPUState *s, uint64_t cause, target_ulong tval
     }
 #endif
 
+    if (cause == CAUSE_USER_ECALL && unlikely(s->machine->procstats))
+        riscv_procstats_ecall(s);
+    if (unlikely(s->machine->telemetry))
+        riscv_telemetry_trap(s, cause);
+
     if (s->priv <= PRV_S) {
         /* delegate the exception to the supervisor priviledge */
         if (cause & CAUSE_INTERRUPT)
@@ -1600,6 +2251,7 @@ static int __must_use_result raise_interrupt(RISCVCPUState *s) {
 #endif
 
     raise_exception(s, irq_num | CAUSE_INTERRUPT);
+    s->took_interrupt = TRUE;
     return -1;
 }
 
@@ -1675,6 +2327,7 @@ RISCVCPUState *riscv_cpu_init(RISCVMachine *machine, int hartid) {
     s->plic_enable_irq = 0;
     s->misa |= MCPUID_SUPER | MCPUID_USER | MCPUID_I | MCPUID_M | MCPUID_A;
     s->most_recently_written_reg = -1;
+    s->next_event                = UINT64_MAX;
 #if FLEN >= 32
     s->most_recently_written_fp_reg = -1;
     s->misa |= MCPUID_F;
@@ -1709,7 +2362,21 @@ RISCVCPUState *riscv_cpu_init(RISCVMachine *machine, int hartid) {
     return s;
 }
 
-void riscv_cpu_end(RISCVCPUState *s) { free(s); }
+void riscv_cpu_end(RISCVCPUState *s) {
+    if (s->timing)
+        riscv_timing_end(s->timing, s->mhartid);
+    if (s->bpred)
+        riscv_bpred_end(s->bpred, s->mhartid);
+    if (s->tlbmodel)
+        riscv_tlbmodel_end(s->tlbmodel, s->mhartid);
+    if (s->bbv)
+        riscv_bbv_end(s->bbv);
+    if (s->hash)
+        riscv_hash_end(s->hash);
+    if (s->events)
+        riscv_events_end(s);
+    free(s);
+}
 
 void riscv_set_pc(RISCVCPUState *s, uint64_t val) { s->pc = val & (s->misa & MCPUID_C ? ~1 : ~3); }
 
@@ -1941,8 +2608,8 @@ static void create_boot_rom(RISCVCPUState *s, const char *file, const uint64_t c
     uint32_t data_pos       = 0xB00 / sizeof *rom;
     uint32_t data_pos_start = data_pos;
 
-    if (s->machine->ncpus == 1)  // FIXME: May be interesting to freeze hartid >= ncpus
-        create_hang_nonzero_hart(rom, &code_pos, &data_pos);
+    // Only hart 0 is restored by the ROM, the others wait in wfi
+    create_hang_nonzero_hart(rom, &code_pos, &data_pos);
 
     create_csr64_recovery(rom, &code_pos, &data_pos, 0x7b1, s->pc);  // Write to DPC (CSR, 0x7b1)
 
@@ -2022,6 +2689,8 @@ static void create_boot_rom(RISCVCPUState *s, const char *file, const uint64_t c
     create_csr12_recovery(rom, &code_pos, 0x320, s->mcountinhibit);
     create_csr12_recovery(rom, &code_pos, 0x306, s->mcounteren);
     create_csr12_recovery(rom, &code_pos, 0x106, s->scounteren);
+    create_csr64_recovery(rom, &code_pos, &data_pos, 0x30a, s->menvcfg);
+    create_csr64_recovery(rom, &code_pos, &data_pos, 0x10a, s->senvcfg);
 
     // NB: restore addr before cfgs for fewer surprises!
     for (int i = 0; i < 16; ++i) create_csr64_recovery(rom, &code_pos, &data_pos, CSR_PMPADDR(i), s->csr_pmpaddr[i]);
@@ -2087,7 +2756,10 @@ void riscv_cpu_serialize(RISCVCPUState *s, const char *dump_name, const uint64_t
     FILE * conf_fd   = 0;
     size_t n         = strlen(dump_name) + 64;
     char * conf_name = (char *)alloca(n);
-    snprintf(conf_name, n, "%s.re_regs", dump_name);
+    if (s->mhartid == 0)
+        snprintf(conf_name, n, "%s.re_regs", dump_name);
+    else
+        snprintf(conf_name, n, "%s.re_regs.%d", dump_name, (int)s->mhartid);
 
     conf_fd = fopen(conf_name, "w");
     if (conf_fd == 0)
@@ -2101,12 +2773,12 @@ void riscv_cpu_serialize(RISCVCPUState *s, const char *dump_name, const uint64_t
         fprintf(conf_fd, "reg_x%d:%llx\n", i, (long long)s->reg[i]);
     }
 
-#if LEN > 0
+#if FLEN > 0
     for (int i = 0; i < 32; i++) {
         fprintf(conf_fd, "reg_f%d:%llx\n", i, (long long)s->fp_reg[i]);
     }
-    fprintf(conf_fd, "fflags:%c\n", s->fflags);
-    fprintf(conf_fd, "frm:%c\n", s->frm);
+    fprintf(conf_fd, "fflags:%u\n", s->fflags);
+    fprintf(conf_fd, "frm:%u\n", s->frm);
 #endif
 
     const char *priv_str = "USHM";
@@ -2115,7 +2787,7 @@ void riscv_cpu_serialize(RISCVCPUState *s, const char *dump_name, const uint64_t
 
     fprintf(conf_fd, "pending_exception:%d\n", s->pending_exception);
 
-    fprintf(conf_fd, "mstatus:%llx\n", (unsigned long long)s->mstatus);
+    fprintf(conf_fd, "mstatus:%llx\n", (unsigned long long)get_mstatus(s, (target_ulong)-1));
     fprintf(conf_fd, "mtvec:%llx\n", (unsigned long long)s->mtvec);
     fprintf(conf_fd, "mscratch:%llx\n", (unsigned long long)s->mscratch);
     fprintf(conf_fd, "mepc:%llx\n", (unsigned long long)s->mepc);
@@ -2130,6 +2802,11 @@ void riscv_cpu_serialize(RISCVCPUState *s, const char *dump_name, const uint64_t
     fprintf(conf_fd, "mcounteren:%" PRIu32 "\n", s->mcounteren);
     fprintf(conf_fd, "mcountinhibit:%" PRIu32 "\n", s->mcountinhibit);
     fprintf(conf_fd, "tselect:%" PRIu32 "\n", s->tselect);
+    for (int i = 0; i < MAX_TRIGGERS; ++i) {
+        fprintf(conf_fd, "tdata1_%d:%llx\n", i, (unsigned long long)s->tdata1[i]);
+        fprintf(conf_fd, "tdata2_%d:%llx\n", i, (unsigned long long)s->tdata2[i]);
+        fprintf(conf_fd, "tdata3_%d:%llx\n", i, (unsigned long long)s->tdata3[i]);
+    }
 
     fprintf(conf_fd, "stvec:%llx\n", (unsigned long long)s->stvec);
     fprintf(conf_fd, "sscratch:%llx\n", (unsigned long long)s->sscratch);
@@ -2138,10 +2815,23 @@ void riscv_cpu_serialize(RISCVCPUState *s, const char *dump_name, const uint64_t
     fprintf(conf_fd, "stval:%llx\n", (unsigned long long)s->stval);
     fprintf(conf_fd, "satp:%llx\n", (unsigned long long)s->satp);
     fprintf(conf_fd, "scounteren:%llx\n", (unsigned long long)s->scounteren);
+    fprintf(conf_fd, "menvcfg:%llx\n", (unsigned long long)s->menvcfg);
+    fprintf(conf_fd, "senvcfg:%llx\n", (unsigned long long)s->senvcfg);
 
     for (int i = 0; i < 4; i += 2) fprintf(conf_fd, "pmpcfg%d:%llx\n", i, (unsigned long long)s->csr_pmpcfg[i]);
     for (int i = 0; i < 16; ++i) fprintf(conf_fd, "pmpaddr%d:%llx\n", i, (unsigned long long)s->csr_pmpaddr[i]);
 
+    fprintf(conf_fd, "mcycle:%" PRIu64 "\n", s->mcycle);
+    fprintf(conf_fd, "minstret:%" PRIu64 "\n", s->minstret);
+    fprintf(conf_fd, "timecmp:%" PRIu64 "\n", s->timecmp);
+    for (int i = 3; i < 32; ++i) fprintf(conf_fd, "mhpmevent%d:%llx\n", i, (unsigned long long)s->mhpmevent[i]);
+
+    // The memories are shared, they are written with the first hart
+    if (s->mhartid != 0) {
+        fclose(conf_fd);
+        return;
+    }
+
     PhysMemoryRange *boot_ram       = 0;
     int              main_ram_found = 0;
 
@@ -2164,6 +2854,8 @@ void riscv_cpu_serialize(RISCVCPUState *s, const char *dump_name, const uint64_t
         }
     }
 
+    fclose(conf_fd);
+
     if (!boot_ram || !main_ram_found) {
         fprintf(dromajo_stderr, "ERROR: could not find boot and main ram???\n");
         exit(-3);
@@ -2188,11 +2880,137 @@ void riscv_cpu_serialize(RISCVCPUState *s, const char *dump_name, const uint64_t
     }
 }
 
-void riscv_cpu_deserialize(RISCVCPUState *s, const char *dump_name) {
+/* Loads the registers written by riscv_cpu_serialize straight into the
+ * hart, without going through the CSR write side effects */
+static void deserialize_regs(RISCVCPUState *s, const char *dump_name) {
+    size_t n         = strlen(dump_name) + 64;
+    char * conf_name = (char *)alloca(n);
+    if (s->mhartid == 0)
+        snprintf(conf_name, n, "%s.re_regs", dump_name);
+    else
+        snprintf(conf_name, n, "%s.re_regs.%d", dump_name, (int)s->mhartid);
+
+    FILE *conf_fd = fopen(conf_name, "r");
+    if (conf_fd == 0)
+        err(-3, "opening %s for deserialization", conf_name);
+
+    char line[256];
+    while (fgets(line, sizeof line, conf_fd)) {
+        char *v = strchr(line, ':');
+        int   i, k;
+
+        if (line[0] == '#' || !v)
+            continue;
+        *v++ = 0;
+
+        uint64_t hex = strtoull(v, NULL, 16);
+        uint64_t dec = strtoull(v, NULL, 10);
+
+        if (sscanf(line, "reg_x%d", &i) == 1 && 0 < i && i < 32)
+            s->reg[i] = hex;
+#if FLEN > 0
+        else if (sscanf(line, "reg_f%d", &i) == 1 && 0 <= i && i < 32)
+            s->fp_reg[i] = hex;
+        else if (!strcmp(line, "fflags"))
+            s->fflags = dec;
+        else if (!strcmp(line, "frm"))
+            s->frm = dec;
+#endif
+        else if (sscanf(line, "pmpcfg%d", &i) == 1 && 0 <= i && i < 4)
+            s->csr_pmpcfg[i] = hex;
+        else if (sscanf(line, "pmpaddr%d", &i) == 1 && 0 <= i && i < 16)
+            s->csr_pmpaddr[i] = hex;
+        else if (sscanf(line, "mhpmevent%d", &i) == 1 && 3 <= i && i < 32)
+            s->mhpmevent[i] = hex;
+        else if (sscanf(line, "tdata%d_%d", &k, &i) == 2 && 1 <= k && k <= 3 && 0 <= i && i < MAX_TRIGGERS)
+            (k == 1 ? s->tdata1 : k == 2 ? s->tdata2 : s->tdata3)[i] = hex;
+        else if (!strcmp(line, "pc"))
+            s->pc = hex;
+        else if (!strcmp(line, "priv"))
+            s->priv = strchr("USHM", *v) ? strchr("USHM", *v) - "USHM" : PRV_M;
+        else if (!strcmp(line, "insn_counter"))
+            s->insn_counter = dec;
+        else if (!strcmp(line, "pending_exception"))
+            s->pending_exception = (int)strtol(v, NULL, 10);
+        else if (!strcmp(line, "mstatus"))
+            set_mstatus(s, hex);
+        else if (!strcmp(line, "mtvec"))
+            s->mtvec = hex;
+        else if (!strcmp(line, "mscratch"))
+            s->mscratch = hex;
+        else if (!strcmp(line, "mepc"))
+            s->mepc = hex;
+        else if (!strcmp(line, "mcause"))
+            s->mcause = hex;
+        else if (!strcmp(line, "mtval"))
+            s->mtval = hex;
+        else if (!strcmp(line, "misa"))
+            s->misa = dec;
+        else if (!strcmp(line, "mie"))
+            s->mie = dec;
+        else if (!strcmp(line, "mip"))
+            s->mip = dec;
+        else if (!strcmp(line, "medeleg"))
+            s->medeleg = dec;
+        else if (!strcmp(line, "mideleg"))
+            s->mideleg = dec;
+        else if (!strcmp(line, "mcounteren"))
+            s->mcounteren = dec;
+        else if (!strcmp(line, "mcountinhibit"))
+            s->mcountinhibit = dec;
+        else if (!strcmp(line, "tselect"))
+            s->tselect = dec;
+        else if (!strcmp(line, "stvec"))
+            s->stvec = hex;
+        else if (!strcmp(line, "sscratch"))
+            s->sscratch = hex;
+        else if (!strcmp(line, "sepc"))
+            s->sepc = hex;
+        else if (!strcmp(line, "scause"))
+            s->scause = hex;
+        else if (!strcmp(line, "stval"))
+            s->stval = hex;
+        else if (!strcmp(line, "satp"))
+            s->satp = hex;
+        else if (!strcmp(line, "scounteren"))
+            s->scounteren = hex;
+        else if (!strcmp(line, "menvcfg"))
+            s->menvcfg = hex;
+        else if (!strcmp(line, "senvcfg"))
+            s->senvcfg = hex;
+        else if (!strcmp(line, "mcycle"))
+            s->mcycle = dec;
+        else if (!strcmp(line, "minstret"))
+            s->minstret = dec;
+        else if (!strcmp(line, "timecmp"))
+            s->timecmp = dec;
+    }
+    fclose(conf_fd);
+
+    /* the state derived from the CSRs, as their write handlers do */
+    unpack_pmpaddrs(s);
+    triggers_update(s);
+    if (s->tlbmodel)
+        riscv_tlbmodel_set_satp(s->tlbmodel);
+
+    /* the checkpoint resumes at pc instead of leaving the boot ROM with dret */
+    s->debug_mode       = false;
+    s->stop_the_counter = false;
+    tlb_flush_all(s);
+}
+
+void riscv_cpu_deserialize(RISCVCPUState *s, const char *dump_name, bool direct) {
+    if (direct)
+        deserialize_regs(s, dump_name);
+
+    // The memories are shared, they are read with the first hart
+    if (s->mhartid != 0)
+        return;
+
     for (int i = s->mem_map->n_phys_mem_range - 1; i >= 0; --i) {
         PhysMemoryRange *pr = &s->mem_map->phys_mem_range[i];
 
-        if (pr->is_ram && pr->addr == ROM_BASE_ADDR) {
+        if (pr->is_ram && pr->addr == ROM_BASE_ADDR && !direct) {
             size_t n         = strlen(dump_name) + 64;
             char * boot_name = (char *)alloca(n);
             snprintf(boot_name, n, "%s.bootram", dump_name);
@@ -0,0 +1,385 @@
+/*
+ * Block cache of instruction words shared by all harts
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_dbcache.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "dromajo.h"
+#include "iomem.h"
+
+#define DBCACHE_PAGE_BITS 12
+#define DBCACHE_PAGE_SIZE (1 << DBCACHE_PAGE_BITS)
+
+struct DBCacheSlot {
+    std::atomic<uint32_t> seq; /* odd while the block is being written */
+    RISCVCodeBlock        b;
+};
+
+/* Code page words of a RAM range, accessed with the __atomic builtins */
+struct DBCacheRAM {
+    const uint8_t *       base;
+    uint64_t              size;
+    std::vector<uint32_t> pages;
+};
+
+struct RISCVDBCache {
+    DBCacheSlot *           slots;
+    uint32_t                bits;
+    std::vector<DBCacheRAM> rams;
+
+    /* statistics, relaxed */
+    std::atomic<uint64_t> n_lookups;
+    std::atomic<uint64_t> n_hits;
+    std::atomic<uint64_t> n_builds;
+    std::atomic<uint64_t> n_code_writes;
+};
+
+static inline uint32_t dbcache_hash(uint64_t paddr, uint32_t mode, uint32_t bits) {
+    return (uint32_t)((((paddr >> 1) ^ ((uint64_t)mode << 60)) * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+RISCVDBCache *riscv_dbcache_init(int bits, PhysMemoryMap *mem_map) {
+    RISCVDBCache *c = new RISCVDBCache();
+
+    c->bits  = bits;
+    c->slots = new DBCacheSlot[1u << bits]();
+
+    for (int i = 0; i < mem_map->n_phys_mem_range; ++i) {
+        PhysMemoryRange *pr = &mem_map->phys_mem_range[i];
+        if (!pr->is_ram)
+            continue;
+        uint64_t n_pages = (pr->org_size + DBCACHE_PAGE_SIZE - 1) >> DBCACHE_PAGE_BITS;
+        c->rams.push_back(DBCacheRAM{pr->phys_mem, pr->org_size, std::vector<uint32_t>(n_pages, 0)});
+    }
+
+    return c;
+}
+
+static uint32_t *dbcache_page(RISCVDBCache *c, const uint8_t *ptr) {
+    for (auto &r : c->rams)
+        if (r.base <= ptr && ptr < r.base + r.size)
+            return &r.pages[(ptr - r.base) >> DBCACHE_PAGE_BITS];
+    return NULL;
+}
+
+void riscv_dbcache_end(RISCVDBCache *c) {
+    fprintf(dromajo_stderr,
+            "dbcache: %" PRIu64 " lookups %" PRIu64 " hits %" PRIu64 " blocks built %" PRIu64 " code page writes\n",
+            c->n_lookups.load(),
+            c->n_hits.load(),
+            c->n_builds.load(),
+            c->n_code_writes.load());
+
+    delete[] c->slots;
+    delete c;
+}
+
+bool riscv_dbcache_lookup(RISCVDBCache *c, uint64_t paddr, uint32_t mode, RISCVCodeBlock *b) {
+    DBCacheSlot *slot = &c->slots[dbcache_hash(paddr, mode, c->bits)];
+
+    c->n_lookups.fetch_add(1, std::memory_order_relaxed);
+
+    for (;;) {
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            return false;
+        memcpy(b, &slot->b, sizeof *b);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) == seq)
+            break;
+    }
+
+    /* slots never written are empty */
+    if (!b->n_insns || b->paddr != paddr || b->mode != mode || !riscv_dbcache_block_valid(b))
+        return false;
+
+    c->n_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/* Control transfers and instructions that can change the mode or the
+ * mapping (CSR accesses, xRET, sfence.vma, fence.i) end a block */
+static bool dbcache_ends_block(uint32_t insn) {
+    switch (insn & 3) {
+        case 1: {
+            uint32_t funct3 = (insn >> 13) & 7;
+            return funct3 == 5 || funct3 == 6 || funct3 == 7; /* c.j c.beqz c.bnez */
+        }
+        case 2: /* c.jr c.jalr c.ebreak */ return ((insn >> 13) & 7) == 4 && ((insn >> 2) & 0x1f) == 0;
+        case 3: break;
+        default: return false;
+    }
+
+    switch (insn & 0x7f) {
+        case 0x63: /* branch */
+        case 0x67: /* jalr */
+        case 0x6f: /* jal */
+        case 0x73: /* system */ return true;
+        case 0x0f: /* fence.i */ return ((insn >> 12) & 7) == 1;
+        default: return false;
+    }
+}
+
+/* The few instructions the loop idioms are made of */
+enum { OP_OTHER, OP_LOAD, OP_STORE, OP_ADDI, OP_BRANCH };
+
+typedef struct DBCacheOp {
+    int     op;
+    int     funct3;
+    int     rd, rs1, rs2;
+    int64_t imm;
+} DBCacheOp;
+
+static DBCacheOp dbcache_decode_op(uint32_t insn) {
+    DBCacheOp o = {OP_OTHER, 0, 0, 0, 0, 0};
+
+    if ((insn & 3) != 3) {
+        uint32_t funct3 = (insn >> 13) & 7;
+        int      r_hi   = ((insn >> 7) & 7) + 8;
+        int      r_lo   = ((insn >> 2) & 7) + 8;
+
+        if ((insn & 3) == 0 && (funct3 == 2 || funct3 == 3 || funct3 == 6 || funct3 == 7)) {
+            /* c.lw c.ld c.sw c.sd */
+            o.op     = funct3 & 4 ? OP_STORE : OP_LOAD;
+            o.funct3 = funct3 & 3;
+            o.rs1    = r_hi;
+            o.rd = o.rs2 = r_lo;
+            o.imm        = ((insn >> 10) & 7) << 3;
+            if (o.funct3 == 2)
+                o.imm |= ((insn >> 6) & 1) << 2 | ((insn >> 5) & 1) << 6;
+            else
+                o.imm |= ((insn >> 5) & 3) << 6;
+        } else if ((insn & 3) == 1 && funct3 == 0) { /* c.addi */
+            o.op = OP_ADDI;
+            o.rd = o.rs1 = (insn >> 7) & 0x1f;
+            o.imm        = (int64_t)((int32_t)(((insn >> 12) & 1) << 31 | ((insn >> 2) & 0x1f) << 26) >> 26);
+        } else if ((insn & 3) == 1 && funct3 == 7) { /* c.bnez */
+            uint32_t imm = ((insn >> 12) & 1) << 8 | ((insn >> 10) & 3) << 3 | ((insn >> 5) & 3) << 6
+                           | ((insn >> 3) & 3) << 1 | ((insn >> 2) & 1) << 5;
+            o.op     = OP_BRANCH;
+            o.funct3 = 1;
+            o.rs1    = r_hi;
+            o.rs2    = 0;
+            o.imm    = (int64_t)((int32_t)(imm << 23) >> 23);
+        }
+        return o;
+    }
+
+    o.funct3 = (insn >> 12) & 7;
+    o.rd     = (insn >> 7) & 0x1f;
+    o.rs1    = (insn >> 15) & 0x1f;
+    o.rs2    = (insn >> 20) & 0x1f;
+    switch (insn & 0x7f) {
+        case 0x03:
+            if (o.funct3 != 7) {
+                o.op  = OP_LOAD;
+                o.imm = (int32_t)insn >> 20;
+            }
+            break;
+        case 0x23:
+            if (o.funct3 < 4) {
+                o.op  = OP_STORE;
+                o.imm = (int32_t)(((int32_t)insn >> 25) << 5 | ((insn >> 7) & 0x1f));
+            }
+            break;
+        case 0x13:
+            if (o.funct3 == 0) {
+                o.op  = OP_ADDI;
+                o.imm = (int32_t)insn >> 20;
+            }
+            break;
+        case 0x63:
+            if (o.funct3 == 1 || o.funct3 == 6) { /* bne bltu */
+                o.op  = OP_BRANCH;
+                o.imm = (int32_t)(((int32_t)insn >> 31) << 12 | ((insn >> 7) & 1) << 11 | ((insn >> 25) & 0x3f) << 5
+                                  | ((insn >> 8) & 0xf) << 1);
+            }
+            break;
+    }
+    return o;
+}
+
+/* Recognizes a block that is a whole memset/memcpy loop, by following
+ * how much every register was bumped at each instruction */
+static void dbcache_find_idiom(RISCVCodeBlock *b) {
+    RISCVBlockIdiom *id = &b->idiom;
+    int64_t          bump[32] = {0};
+    DBCacheOp        load = {OP_OTHER, 0, 0, 0, 0, 0}, store = load, br;
+    uint32_t         offset = 0;
+
+    id->kind = DBCACHE_IDIOM_NONE;
+    if (b->n_insns < 3)
+        return;
+
+    for (uint32_t i = 0; i + 1 < b->n_insns; ++i) {
+        DBCacheOp o = dbcache_decode_op(b->insn[i]);
+
+        switch (o.op) {
+            case OP_LOAD:
+                if (load.op != OP_OTHER || store.op != OP_OTHER || o.rd == 0)
+                    return;
+                o.imm += bump[o.rs1];
+                load = o;
+                break;
+            case OP_STORE:
+                if (store.op != OP_OTHER)
+                    return;
+                o.imm += bump[o.rs1];
+                store = o;
+                break;
+            case OP_ADDI:
+                if (o.rd == 0 || o.rd != o.rs1)
+                    return;
+                bump[o.rd] += o.imm;
+                break;
+            default: return;
+        }
+        offset += (b->insn[i] & 3) == 3 ? 4 : 2;
+    }
+    br = dbcache_decode_op(b->insn[b->n_insns - 1]);
+    if (br.op != OP_BRANCH || br.imm != -(int64_t)offset || store.op != OP_STORE || store.imm != 0)
+        return;
+
+    RISCVBlockIdiom r;
+    r.width = 1 << store.funct3;
+    r.dst   = store.rs1;
+    r.bltu  = br.funct3 == 6;
+    if (load.op == OP_LOAD) {
+        if (store.rs2 != load.rd || (load.funct3 & 3) != store.funct3 || load.imm != 0 || load.rs1 == r.dst)
+            return;
+        r.kind        = DBCACHE_IDIOM_COPY;
+        r.src         = load.rs1;
+        r.tmp         = load.rd;
+        r.load_funct3 = load.funct3;
+        if (r.tmp == r.src || r.tmp == r.dst)
+            return;
+    } else {
+        if (store.rs2 != 0)
+            return;
+        r.kind = DBCACHE_IDIOM_ZERO;
+        r.src = r.tmp = r.dst;
+        r.load_funct3 = 0;
+    }
+
+    /* only the pointers move, by the access size */
+    for (int reg = 1; reg < 32; ++reg)
+        if (bump[reg] != ((reg == r.dst || reg == r.src) ? r.width : 0))
+            return;
+
+    if ((br.rs1 == r.dst || br.rs1 == r.src) && !(r.kind == DBCACHE_IDIOM_COPY && br.rs2 == r.tmp)) {
+        r.cmp = br.rs1;
+        r.end = br.rs2;
+    } else if (!r.bltu && (br.rs2 == r.dst || br.rs2 == r.src) && br.rs1 != r.tmp) {
+        r.cmp = br.rs2;
+        r.end = br.rs1;
+    } else {
+        return;
+    }
+    if (r.end == r.dst || r.end == r.src)
+        return;
+
+    *id = r;
+}
+
+bool riscv_dbcache_build(RISCVDBCache *c, const uint8_t *ptr, uint64_t paddr, uint32_t mode, RISCVCodeBlock *b,
+                         bool *new_code_page) {
+    uint32_t  avail = DBCACHE_PAGE_SIZE - (paddr & (DBCACHE_PAGE_SIZE - 1));
+    uint32_t  off   = 0;
+    uint32_t *page  = dbcache_page(c, ptr);
+
+    *new_code_page = false;
+    if (!page)
+        return false;
+
+    /* mark the page before reading it: a racing write either lands
+     * before the reads or sees the mark and bumps the word */
+    uint32_t old = __atomic_fetch_or(page, 1, __ATOMIC_SEQ_CST);
+
+    *new_code_page = !(old & 1);
+    b->paddr       = paddr;
+    b->mode        = mode;
+    b->page        = page;
+    b->page_tag    = old | 1;
+    b->n_insns     = 0;
+
+    while (b->n_insns < DBCACHE_MAX_INSNS && off + 2 <= avail) {
+        uint16_t lo;
+        uint32_t insn;
+
+        memcpy(&lo, ptr + off, 2);
+        if ((lo & 3) == 3) {
+            if (off + 4 > avail)
+                break;
+            memcpy(&insn, ptr + off, 4);
+            off += 4;
+        } else {
+            insn = lo;
+            off += 2;
+        }
+        b->insn[b->n_insns++] = insn;
+
+        /* without RVC a compressed encoding is illegal, leave it to the
+         * interpreter to trap on */
+        if (dbcache_ends_block(insn) || ((insn & 3) != 3 && !(mode & 4)))
+            break;
+    }
+    if (b->n_insns == 0)
+        return false;
+    b->size = off;
+    dbcache_find_idiom(b);
+
+    c->n_builds.fetch_add(1, std::memory_order_relaxed);
+
+    /* publish, unless another hart is writing the slot */
+    DBCacheSlot *slot = &c->slots[dbcache_hash(paddr, mode, c->bits)];
+    uint32_t     seq  = slot->seq.load(std::memory_order_relaxed);
+    if (!(seq & 1) && slot->seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+        memcpy(&slot->b, b, sizeof *b);
+        slot->seq.store(seq + 2, std::memory_order_release);
+    }
+
+    return true;
+}
+
+bool riscv_dbcache_write(RISCVDBCache *c, const uint8_t *ptr, size_t size) {
+    bool hit = false;
+
+    for (auto &r : c->rams) {
+        if (ptr + size <= r.base || r.base + r.size <= ptr)
+            continue;
+        uint64_t first = (std::max(ptr, r.base) - r.base) >> DBCACHE_PAGE_BITS;
+        uint64_t last  = (std::min(ptr + size, r.base + r.size) - 1 - r.base) >> DBCACHE_PAGE_BITS;
+        for (uint64_t i = first; i <= last; ++i) {
+            uint32_t w = __atomic_load_n(&r.pages[i], __ATOMIC_SEQ_CST);
+            if (!(w & 1))
+                continue;
+            /* odd + 1 clears the mark and counts the invalidation; a
+             * failed exchange means another writer just did it */
+            if (__atomic_compare_exchange_n(&r.pages[i], &w, w + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                c->n_code_writes.fetch_add(1, std::memory_order_relaxed);
+            hit = true;
+        }
+    }
+
+    return hit;
+}
@@ -0,0 +1,119 @@
+/*
+ * Scheduled interrupt and device events
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_events.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <queue>
+#include <vector>
+
+#include "dromajo.h"
+#include "riscv_machine.h"
+
+struct RISCVEvent {
+    uint64_t       icount;
+    uint64_t       seq; /* events due at the same count fire in schedule order */
+    RISCVEventKind kind;
+    uint32_t       value;
+    int            level;
+
+    bool operator>(const RISCVEvent &e) const { return icount != e.icount ? icount > e.icount : seq > e.seq; }
+};
+
+struct RISCVEventQueue {
+    std::priority_queue<RISCVEvent, std::vector<RISCVEvent>, std::greater<RISCVEvent>> q;
+    uint64_t                                                                           seq;
+};
+
+void riscv_events_schedule(RISCVCPUState *s, uint64_t icount, RISCVEventKind kind, uint32_t value, int level) {
+    if (!s->events)
+        s->events = new RISCVEventQueue();
+
+    s->events->q.push(RISCVEvent{icount, s->events->seq++, kind, value, level});
+    s->next_event = s->events->q.top().icount;
+}
+
+int riscv_events_load(RISCVMachine *m, const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        vm_error("could not open the event schedule %s\n", filename);
+        return -1;
+    }
+
+    char line[256];
+    int  n_events = 0;
+    for (int lineno = 1; fgets(line, sizeof line, f); ++lineno) {
+        char *   comment = strchr(line, '#');
+        int      hartid, level = 0, n;
+        uint64_t icount;
+        uint32_t value;
+        char     kind[16];
+
+        if (comment)
+            *comment = 0;
+        n = sscanf(line, "%d %" SCNu64 " %15s %" SCNi32 " %d", &hartid, &icount, kind, &value, &level);
+        if (n <= 0)
+            continue;
+
+        RISCVEventKind k;
+        if (n == 4 && !strcmp(kind, "mip"))
+            k = RISCV_EVENT_MIP_SET;
+        else if (n == 4 && !strcmp(kind, "mip_clear"))
+            k = RISCV_EVENT_MIP_CLEAR;
+        else if (n == 5 && !strcmp(kind, "irq") && 0 < value && value < 32)
+            k = RISCV_EVENT_IRQ;
+        else {
+            vm_error("%s:%d: invalid event\n", filename, lineno);
+            fclose(f);
+            return -1;
+        }
+        if (hartid < 0 || m->ncpus <= hartid) {
+            vm_error("%s:%d: no hart %d\n", filename, lineno, hartid);
+            fclose(f);
+            return -1;
+        }
+
+        riscv_events_schedule(m->cpu_state[hartid], icount, k, value, level);
+        n_events++;
+    }
+    fclose(f);
+
+    fprintf(dromajo_stderr, "events: %d scheduled from %s\n", n_events, filename);
+    return 0;
+}
+
+void riscv_events_fire(RISCVCPUState *s) {
+    auto &q = s->events->q;
+
+    while (!q.empty() && q.top().icount <= s->insn_counter) {
+        RISCVEvent e = q.top();
+        q.pop();
+
+        switch (e.kind) {
+            case RISCV_EVENT_MIP_SET: riscv_cpu_set_mip(s, e.value); break;
+            case RISCV_EVENT_MIP_CLEAR: riscv_cpu_reset_mip(s, e.value); break;
+            case RISCV_EVENT_IRQ: set_irq(&s->machine->plic_irq[e.value], e.level); break;
+        }
+    }
+
+    s->next_event = q.empty() ? UINT64_MAX : q.top().icount;
+}
+
+void riscv_events_end(RISCVCPUState *s) { delete s->events; }
@@ -0,0 +1,50 @@
+/*
+ * Rolling hashes of the committed architectural state
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_hash.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "cutils.h"
+#include "dromajo.h"
+
+RISCVHash *riscv_hash_init(const char *filename, int hartid, uint64_t interval) {
+    RISCVHash *h = (RISCVHash *)mallocz(sizeof *h);
+
+    h->f = fopen(filename, "w");
+    if (!h->f) {
+        vm_error("could not open %s for the state hashes\n", filename);
+        free(h);
+        return NULL;
+    }
+    h->interval = interval;
+    h->hash     = RISCV_HASH_INIT;
+    fprintf(h->f, "# dromajo state hash, interval %" PRIu64 ", hart %d\n", interval, hartid);
+
+    return h;
+}
+
+void riscv_hash_emit(RISCVHash *h) { fprintf(h->f, "%" PRIu64 " %016" PRIx64 "\n", h->count, h->hash); }
+
+void riscv_hash_end(RISCVHash *h) {
+    /* the last, partial, interval */
+    if (h->count % h->interval)
+        riscv_hash_emit(h);
+    fclose(h->f);
+    free(h);
+}
@@ -56,6 +56,7 @@
 #include "dw_apb_uart.h"
 #include "elf64.h"
 #include "iomem.h"
+#include "replay.h"
 
 /* RISCV machine */
 
@@ -686,8 +687,10 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst, const char *dtb_name,
                 if (misa & (1 << i))
                     *q++ = 'a' + i;
             }
-            *q = '\0';
+            strcpy(q, "_zicbom_zicboz_svinval_svnapot_svpbmt");
             fdt_prop_str(s, "riscv,isa", isa_string);
+            fdt_prop_u32(s, "riscv,cbom-block-size", CBO_BLOCK_SIZE);
+            fdt_prop_u32(s, "riscv,cboz-block-size", CBO_BLOCK_SIZE);
 
             fdt_prop_str(s, "mmu-type", max_xlen <= 32 ? "riscv,sv32" : "riscv,sv48");
             fdt_prop_u32(s, "clock-frequency", CPU_FREQUENCY);
@@ -1024,6 +1027,11 @@ static void riscv_flush_tlb_write_range(void *opaque, uint8_t *ram_addr, size_t
     for (int i = 0; i < s->ncpus; ++i) riscv_cpu_flush_tlb_write_range_ram(s->cpu_state[i], ram_addr, ram_size);
 }
 
+static void riscv_ram_written(void *opaque, uint8_t *ram_addr, size_t size) {
+    RISCVMachine *s = (RISCVMachine *)opaque;
+    riscv_dbcache_write(s->dbcache, ram_addr, size);
+}
+
 void virt_machine_set_defaults(VirtMachineParams *p) {
     memset(p, 0, sizeof *p);
     p->physical_addr_len = PHYSICAL_ADDR_LEN_DEFAULT;
@@ -1033,6 +1041,9 @@ void virt_machine_set_defaults(VirtMachineParams *p) {
     p->plic_size         = PLIC_SIZE;
     p->clint_base_addr   = CLINT_BASE_ADDR;
     p->clint_size        = CLINT_SIZE;
+    riscv_timing_set_defaults(&p->timing_params);
+    riscv_bpred_set_defaults(&p->bpred_params);
+    riscv_tlbmodel_set_defaults(&p->tlbmodel_params);
 }
 
 RISCVMachine *virt_machine_init(const VirtMachineParams *p) {
@@ -1074,6 +1085,7 @@ RISCVMachine *virt_machine_init(const VirtMachineParams *p) {
         return NULL;
     }
 
+    riscv_csr_init(s);
     for (int i = 0; i < s->ncpus; ++i) {
         s->cpu_state[i] = riscv_cpu_init(s, i);
     }
@@ -1085,6 +1097,27 @@ RISCVMachine *virt_machine_init(const VirtMachineParams *p) {
 
     for (int i = 0; i < s->ncpus; ++i) {
         s->cpu_state[i]->physical_addr_len = p->physical_addr_len;
+        if (p->timing)
+            s->cpu_state[i]->timing = riscv_timing_init(&p->timing_params);
+        if (p->timing || p->bpred_params.type != BPRED_NONE) {
+            /* the timing model needs a predictor, bimodal by default */
+            RISCVBPredParams bp = p->bpred_params;
+            if (bp.type == BPRED_NONE)
+                bp.type = BPRED_BIMODAL;
+            s->cpu_state[i]->bpred = riscv_bpred_init(&bp);
+            if (!s->cpu_state[i]->bpred)
+                return NULL;
+        }
+        if (p->tlbmodel) {
+            s->cpu_state[i]->tlbmodel = riscv_tlbmodel_init(&p->tlbmodel_params);
+            if (!s->cpu_state[i]->tlbmodel)
+                return NULL;
+        }
+    }
+    if (p->dbcache || p->idioms) {
+        s->idioms               = p->idioms;
+        s->dbcache              = riscv_dbcache_init(12, s->mem_map);
+        s->mem_map->ram_written = riscv_ram_written;
     }
 
     if (p->mmio_start) {
@@ -1257,32 +1290,46 @@ void virt_machine_end(RISCVMachine *s) {
     if (s->common.snapshot_save_name)
         virt_machine_serialize(s, s->common.snapshot_save_name);
 
+    /* before the harts go */
+    if (s->procstats)
+        riscv_procstats_end(s->procstats);
+    if (s->telemetry)
+        riscv_telemetry_end(s->telemetry);
+
     /* XXX: stop all */
     for (int i = 0; i < s->ncpus; ++i) {
         riscv_cpu_end(s->cpu_state[i]);
     }
+    if (s->dbcache)
+        riscv_dbcache_end(s->dbcache);
+
+    if (s->common.replay)
+        replay_end(s->common.replay);
 
     if (s->mmio_addrset_size > 0)
         free(s->mmio_addrset);
+    free(s->watch);
 
     phys_mem_map_end(s->mem_map);
     free(s);
 }
 
 void virt_machine_serialize(RISCVMachine *m, const char *dump_name) {
-    RISCVCPUState *s = m->cpu_state[0];  // FIXME: MULTICORE
+    vm_error("plic: %x %x\n", m->plic_pending_irq, m->plic_served_irq);
 
-    vm_error("plic: %x %x timecmp=%llx\n", m->plic_pending_irq, m->plic_served_irq, (unsigned long long)s->timecmp);
-
-    assert(m->ncpus == 1);  // FIXME: riscv_cpu_serialize must be patched for multicore
-    riscv_cpu_serialize(s, dump_name, m->clint_base_addr);
+    // Every hart has its registers in <dump_name>.re_regs[.<hartid>], the memories go with hart 0
+    for (int i = 0; i < m->ncpus; ++i) {
+        RISCVCPUState *s = m->cpu_state[i];
+        vm_error("hart %d: timecmp=%llx\n", i, (unsigned long long)s->timecmp);
+        riscv_cpu_serialize(s, dump_name, m->clint_base_addr);
+    }
 }
 
 void virt_machine_deserialize(RISCVMachine *m, const char *dump_name) {
-    RISCVCPUState *s = m->cpu_state[0];  // FIXME: MULTICORE
+    // The boot ROM only restores hart 0, see virt_machine_main
+    assert(m->ncpus == 1 || m->common.snapshot_direct);
 
-    assert(m->ncpus == 1);  // FIXME: riscv_cpu_serialize must be patched for multicore
-    riscv_cpu_deserialize(s, dump_name);
+    for (int i = 0; i < m->ncpus; ++i) riscv_cpu_deserialize(m->cpu_state[i], dump_name, m->common.snapshot_direct);
 }
 
 int virt_machine_get_sleep_duration(RISCVMachine *m, int hartid, int ms_delay) {
@@ -0,0 +1,293 @@
+/*
+ * Per-process and per-syscall instruction accounting for Linux guests
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_procstats.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "dromajo.h"
+#include "riscv_machine.h"
+
+struct ProcCounts {
+    uint64_t insns[4]; /* by privilege level */
+};
+
+struct SyscallCounts {
+    uint64_t calls;
+    uint64_t insns;
+    uint64_t max;
+};
+
+struct Pending {
+    uint64_t nr;
+    uint64_t start;
+};
+
+struct HartState {
+    int      priv;
+    uint64_t satp;
+    uint64_t since; /* insn_counter when priv or satp last changed */
+};
+
+struct RISCVProcStats {
+    RISCVMachine *m;
+    FILE *        f;
+    uint64_t      interval;
+    uint64_t      next;
+    uint64_t      start; /* hart 0 instructions at the start of the interval */
+    int           n_intervals;
+
+    HartState harts[MAX_CPUS];
+
+    /* the current interval and the whole run */
+    std::map<uint64_t, ProcCounts>    procs, all_procs;
+    std::map<uint64_t, SyscallCounts> syscalls, all_syscalls;
+
+    /* system calls in progress, by hart and satp */
+    std::map<std::pair<int, uint64_t>, Pending> pending;
+};
+
+/* The generic Linux system call numbers (asm-generic/unistd.h) used by
+ * RISC-V, the most common ones only */
+static const char *syscall_name(uint64_t nr) {
+    static const struct {
+        uint64_t    nr;
+        const char *name;
+    } names[] = {
+        {17, "getcwd"},
+        {23, "dup"},
+        {24, "dup3"},
+        {25, "fcntl"},
+        {29, "ioctl"},
+        {34, "mkdirat"},
+        {35, "unlinkat"},
+        {48, "faccessat"},
+        {49, "chdir"},
+        {56, "openat"},
+        {57, "close"},
+        {59, "pipe2"},
+        {61, "getdents64"},
+        {62, "lseek"},
+        {63, "read"},
+        {64, "write"},
+        {65, "readv"},
+        {66, "writev"},
+        {67, "pread64"},
+        {68, "pwrite64"},
+        {72, "pselect6"},
+        {73, "ppoll"},
+        {78, "readlinkat"},
+        {79, "newfstatat"},
+        {80, "fstat"},
+        {93, "exit"},
+        {94, "exit_group"},
+        {96, "set_tid_address"},
+        {98, "futex"},
+        {99, "set_robust_list"},
+        {101, "nanosleep"},
+        {113, "clock_gettime"},
+        {115, "clock_nanosleep"},
+        {124, "sched_yield"},
+        {129, "kill"},
+        {134, "rt_sigaction"},
+        {135, "rt_sigprocmask"},
+        {139, "rt_sigreturn"},
+        {153, "times"},
+        {160, "uname"},
+        {169, "gettimeofday"},
+        {172, "getpid"},
+        {173, "getppid"},
+        {174, "getuid"},
+        {175, "geteuid"},
+        {176, "getgid"},
+        {177, "getegid"},
+        {178, "gettid"},
+        {179, "sysinfo"},
+        {198, "socket"},
+        {214, "brk"},
+        {215, "munmap"},
+        {216, "mremap"},
+        {220, "clone"},
+        {221, "execve"},
+        {222, "mmap"},
+        {226, "mprotect"},
+        {233, "madvise"},
+        {260, "wait4"},
+        {261, "prlimit64"},
+        {278, "getrandom"},
+        {291, "statx"},
+    };
+
+    for (const auto &n : names)
+        if (n.nr == nr)
+            return n.name;
+    return "-";
+}
+
+/* Credits the instructions since the last change to the current process */
+static void account(RISCVProcStats *p, RISCVCPUState *s) {
+    HartState &h = p->harts[s->mhartid];
+    uint64_t   n = s->insn_counter - h.since;
+
+    if (n) {
+        p->procs[h.satp].insns[h.priv] += n;
+        h.since = s->insn_counter;
+    }
+}
+
+RISCVProcStats *riscv_procstats_init(RISCVMachine *m, const char *filename, uint64_t interval) {
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        vm_error("could not open %s for the process stats\n", filename);
+        return NULL;
+    }
+
+    RISCVProcStats *p = new RISCVProcStats();
+    p->m              = m;
+    p->f              = f;
+    p->interval       = interval;
+    p->start          = m->cpu_state[0]->insn_counter;
+    p->next           = interval ? p->start + interval : UINT64_MAX;
+
+    for (int i = 0; i < m->ncpus; ++i) {
+        RISCVCPUState *s = m->cpu_state[i];
+        p->harts[i]      = {s->priv, s->satp, s->insn_counter};
+    }
+
+    fprintf(f, "# dromajo process stats, interval %" PRIu64 "\n", interval);
+
+    return p;
+}
+
+static void dump(FILE *f, const std::map<uint64_t, ProcCounts> &procs, const std::map<uint64_t, SyscallCounts> &syscalls) {
+    /* busiest first */
+    std::vector<std::pair<uint64_t, ProcCounts>> by_insns(procs.begin(), procs.end());
+    auto total = [](const ProcCounts &c) { return c.insns[PRV_U] + c.insns[PRV_S] + c.insns[PRV_M]; };
+    std::stable_sort(by_insns.begin(), by_insns.end(), [&](const std::pair<uint64_t, ProcCounts> &a,
+                                                           const std::pair<uint64_t, ProcCounts> &b) {
+        return total(a.second) > total(b.second);
+    });
+
+    fprintf(f, "%-18s %5s %-12s %14s %14s %14s %14s\n", "satp", "asid", "root", "user", "kernel", "machine", "total");
+    for (const auto &e : by_insns) {
+        uint64_t satp = e.first;
+        fprintf(f,
+                "0x%016" PRIx64 " %5u 0x%010" PRIx64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n",
+                satp,
+                (unsigned)(satp >> 44) & 0xffff,
+                (satp & (((uint64_t)1 << 44) - 1)) << 12,
+                e.second.insns[PRV_U],
+                e.second.insns[PRV_S],
+                e.second.insns[PRV_M],
+                total(e.second));
+    }
+
+    fprintf(f, "\n%-7s %-18s %10s %14s %12s %12s\n", "syscall", "name", "calls", "instructions", "average", "max");
+    for (const auto &e : syscalls)
+        fprintf(f,
+                "%7" PRIu64 " %-18s %10" PRIu64 " %14" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+                e.first,
+                syscall_name(e.first),
+                e.second.calls,
+                e.second.insns,
+                e.second.insns / e.second.calls,
+                e.second.max);
+}
+
+/* Writes and resets the tables of the current interval */
+static void dump_interval(RISCVProcStats *p) {
+    RISCVMachine *m = p->m;
+
+    for (int i = 0; i < m->ncpus; ++i) account(p, m->cpu_state[i]);
+
+    uint64_t now = m->cpu_state[0]->insn_counter;
+    fprintf(p->f, "\n# interval %d, hart 0 instructions %" PRIu64 " to %" PRIu64 "\n", ++p->n_intervals, p->start, now);
+    dump(p->f, p->procs, p->syscalls);
+
+    for (const auto &e : p->procs)
+        for (int i = 0; i < 4; ++i) p->all_procs[e.first].insns[i] += e.second.insns[i];
+    for (const auto &e : p->syscalls) {
+        SyscallCounts &c = p->all_syscalls[e.first];
+        c.calls += e.second.calls;
+        c.insns += e.second.insns;
+        c.max = std::max(c.max, e.second.max);
+    }
+    p->procs.clear();
+    p->syscalls.clear();
+    p->start = now;
+}
+
+void riscv_procstats_switch(RISCVCPUState *s, int priv, uint64_t satp) {
+    RISCVProcStats *p = s->machine->procstats;
+    HartState &     h = p->harts[s->mhartid];
+
+    account(p, s);
+
+    /* back in user mode: the pending system call of the process is over */
+    if (priv == PRV_U && (h.priv != PRV_U || h.satp != satp)) {
+        auto it = p->pending.find(std::make_pair((int)s->mhartid, satp));
+        if (it != p->pending.end()) {
+            SyscallCounts &c = p->syscalls[it->second.nr];
+            uint64_t       n = s->insn_counter - it->second.start;
+            c.calls++;
+            c.insns += n;
+            c.max = std::max(c.max, n);
+            p->pending.erase(it);
+        }
+    }
+
+    h.priv = priv;
+    h.satp = satp;
+}
+
+void riscv_procstats_ecall(RISCVCPUState *s) {
+    RISCVProcStats *p = s->machine->procstats;
+
+    p->pending[std::make_pair((int)s->mhartid, s->satp)] = {s->reg[17], s->insn_counter};
+}
+
+void riscv_procstats_step(RISCVProcStats *p) {
+    if (p->m->cpu_state[0]->insn_counter >= p->next) {
+        dump_interval(p);
+        p->next += p->interval;
+    }
+}
+
+void riscv_procstats_end(RISCVProcStats *p) {
+    RISCVMachine *m = p->m;
+
+    if (p->interval) {
+        /* the last, partial, interval */
+        if (m->cpu_state[0]->insn_counter > p->start)
+            dump_interval(p);
+        fprintf(p->f, "\n# whole run, %d intervals\n", p->n_intervals);
+        dump(p->f, p->all_procs, p->all_syscalls);
+    } else {
+        for (int i = 0; i < m->ncpus; ++i) account(p, m->cpu_state[i]);
+        fprintf(p->f, "\n# whole run, hart 0 instructions %" PRIu64 " to %" PRIu64 "\n", p->start, m->cpu_state[0]->insn_counter);
+        dump(p->f, p->procs, p->syscalls);
+    }
+
+    fclose(p->f);
+    delete p;
+}
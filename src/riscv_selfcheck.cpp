@@ -0,0 +1,381 @@
+/*
+ * Lockstep self-check of the accelerated execution tiers
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_selfcheck.h"
+
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cutils.h"
+#include "dromajo.h"
+#include "riscv_machine.h"
+
+#define SELFCHECK_RING_SIZE 1024 /* power of 2 */
+
+enum {
+    SELFCHECK_STEP,  /* step the hart up to icount */
+    SELFCHECK_BLOCK, /* step, then compare */
+    SELFCHECK_CHECK, /* compare only */
+    SELFCHECK_END,
+};
+
+enum {
+    SELFCHECK_RUNNING,
+    SELFCHECK_MATCH,
+    SELFCHECK_MISMATCH,
+};
+
+/* In the order of get_state */
+static const char *const csr_names[] = {
+    "fflags",  "frm",     "mstatus", "mtvec",    "mscratch", "mepc",   "mcause", "mtval", "mie",    "mip",
+    "medeleg", "mideleg", "stvec",   "sscratch", "sepc",     "scause", "stval",  "satp",  "mcycle", "minstret",
+};
+
+#define SELFCHECK_N_CSRS (sizeof csr_names / sizeof csr_names[0])
+
+typedef struct SelfCheckState {
+    uint64_t pc;
+    uint64_t priv;
+    uint64_t reg[32];
+    uint64_t fp_reg[32];
+    uint64_t csr[SELFCHECK_N_CSRS];
+    uint64_t wsum;
+    uint64_t wbytes;
+} SelfCheckState;
+
+typedef struct SelfCheckSlot {
+    uint32_t       kind;
+    int32_t        hartid;
+    uint64_t       icount;
+    SelfCheckState state; /* of the parent, for the comparisons */
+} SelfCheckSlot;
+
+/* Shared by both processes, head is only written by the parent and
+ * tail and result only by the child */
+typedef struct SelfCheckRing {
+    uint64_t      head;
+    uint64_t      tail;
+    int           result;
+    SelfCheckSlot slot[SELFCHECK_RING_SIZE];
+} SelfCheckRing;
+
+struct RISCVSelfCheck {
+    RISCVMachine * m;
+    SelfCheckRing *ring;
+    pid_t          pid;
+    bool           failed;
+
+    /* State after the previous step of every hart */
+    uint64_t pc[MAX_CPUS];
+    uint64_t icount[MAX_CPUS];
+};
+
+/* Also resets the write sum for the next block */
+static void get_state(RISCVCPUState *s, SelfCheckState *st) {
+    st->pc   = s->pc;
+    st->priv = s->priv;
+    for (int i = 0; i < 32; ++i) st->reg[i] = s->reg[i];
+#if FLEN > 0
+    for (int i = 0; i < 32; ++i) st->fp_reg[i] = s->fp_reg[i];
+    st->csr[0] = s->fflags;
+    st->csr[1] = s->frm;
+#else
+    memset(st->fp_reg, 0, sizeof st->fp_reg);
+    st->csr[0] = 0;
+    st->csr[1] = 0;
+#endif
+    st->csr[2]  = s->mstatus;
+    st->csr[3]  = s->mtvec;
+    st->csr[4]  = s->mscratch;
+    st->csr[5]  = s->mepc;
+    st->csr[6]  = s->mcause;
+    st->csr[7]  = s->mtval;
+    st->csr[8]  = s->mie;
+    st->csr[9]  = s->mip;
+    st->csr[10] = s->medeleg;
+    st->csr[11] = s->mideleg;
+    st->csr[12] = s->stvec;
+    st->csr[13] = s->sscratch;
+    st->csr[14] = s->sepc;
+    st->csr[15] = s->scause;
+    st->csr[16] = s->stval;
+    st->csr[17] = s->satp;
+    st->csr[18] = s->mcycle;
+    st->csr[19] = s->minstret;
+    st->wsum    = s->selfcheck_wsum;
+    st->wbytes  = s->selfcheck_wbytes;
+
+    s->selfcheck_wsum   = 0;
+    s->selfcheck_wbytes = 0;
+}
+
+static void report_field(FILE *f, const char *name, uint64_t ref, uint64_t fast) {
+    fprintf(f, "  %-9s reference 0x%016" PRIx64 " accelerated 0x%016" PRIx64 "\n", name, ref, fast);
+}
+
+/* Prints the fields that differ, returns whether there were any */
+static bool compare_state(FILE *f, int hartid, uint64_t from, uint64_t to, const SelfCheckState *ref,
+                          const SelfCheckState *fast) {
+    if (!memcmp(ref, fast, sizeof *ref))
+        return false;
+
+    fprintf(f,
+            "selfcheck: hart %d diverged in the block of instructions %" PRIu64 " to %" PRIu64 "\n",
+            hartid,
+            from,
+            to);
+
+    char name[8];
+    if (ref->pc != fast->pc)
+        report_field(f, "pc", ref->pc, fast->pc);
+    if (ref->priv != fast->priv)
+        report_field(f, "priv", ref->priv, fast->priv);
+    for (int i = 0; i < 32; ++i) {
+        if (ref->reg[i] == fast->reg[i])
+            continue;
+        snprintf(name, sizeof name, "x%d", i);
+        report_field(f, name, ref->reg[i], fast->reg[i]);
+    }
+    for (int i = 0; i < 32; ++i) {
+        if (ref->fp_reg[i] == fast->fp_reg[i])
+            continue;
+        snprintf(name, sizeof name, "f%d", i);
+        report_field(f, name, ref->fp_reg[i], fast->fp_reg[i]);
+    }
+    for (size_t i = 0; i < SELFCHECK_N_CSRS; ++i)
+        if (ref->csr[i] != fast->csr[i])
+            report_field(f, csr_names[i], ref->csr[i], fast->csr[i]);
+    if (ref->wsum != fast->wsum || ref->wbytes != fast->wbytes)
+        fprintf(f,
+                "  writes    reference %" PRIu64 " bytes (sum 0x%016" PRIx64 ") accelerated %" PRIu64
+                " bytes (sum 0x%016" PRIx64 ")\n",
+                ref->wbytes,
+                ref->wsum,
+                fast->wbytes,
+                fast->wsum);
+
+    return true;
+}
+
+static void null_write(void *opaque, const uint8_t *buf, int len) {}
+
+static int null_read(void *opaque, uint8_t *buf, int len) { return 0; }
+
+static void null_write_packet(EthernetDevice *net, const uint8_t *buf, int len) {}
+
+/* The child: follows the steps of the parent with the plain interpreter */
+static void __attribute__((noreturn)) reference_loop(RISCVMachine *m, SelfCheckRing *ring, pid_t parent) {
+    FILE *report = dromajo_stderr;
+    FILE *null   = fopen("/dev/null", "w");
+
+    /* nothing the reference does may be seen outside */
+    dromajo_stdout = null;
+    dromajo_stderr = null;
+    if (m->common.console) {
+        m->common.console->write_data  = null_write;
+        m->common.console->writev_data = NULL;
+    }
+    if (m->common.net)
+        m->common.net->write_packet = null_write_packet;
+
+    m->dbcache = NULL;
+    m->idioms  = false;
+
+    uint64_t from[MAX_CPUS];
+    for (int i = 0; i < m->ncpus; ++i) {
+        RISCVCPUState *s = m->cpu_state[i];
+        s->bbv           = NULL;
+        s->hash          = NULL;
+        from[i]          = s->insn_counter;
+    }
+
+    for (uint64_t tail = 0;; ++tail) {
+        while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+            if (getppid() != parent)
+                _exit(2);
+            sched_yield();
+        }
+
+        const SelfCheckSlot *e = &ring->slot[tail & (SELFCHECK_RING_SIZE - 1)];
+        if (e->kind == SELFCHECK_END) {
+            __atomic_store_n(&ring->result, SELFCHECK_MATCH, __ATOMIC_RELEASE);
+            _exit(0);
+        }
+
+        RISCVCPUState *s = m->cpu_state[e->hartid];
+        if (e->kind != SELFCHECK_CHECK) {
+            /* a step of the parent that retired many instructions is
+             * run to the same count, within a bound in case the
+             * reference went astray */
+            uint64_t start = s->insn_counter;
+            uint64_t limit = 2 * (e->icount > start ? e->icount - start : 0) + 2;
+            virt_machine_run(m, e->hartid);
+            for (uint64_t n = 1; s->insn_counter < e->icount && n < limit; ++n) virt_machine_run(m, e->hartid);
+        }
+
+        if (e->kind != SELFCHECK_STEP) {
+            SelfCheckState st;
+            get_state(s, &st);
+            if (compare_state(report, e->hartid, from[e->hartid], s->insn_counter, &st, &e->state)) {
+                fflush(report);
+                __atomic_store_n(&ring->result, SELFCHECK_MISMATCH, __ATOMIC_RELEASE);
+                _exit(1);
+            }
+            from[e->hartid] = s->insn_counter;
+        }
+
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Waits for room in the ring; NULL if the reference is gone */
+static SelfCheckSlot *ring_slot(RISCVSelfCheck *c) {
+    SelfCheckRing *ring = c->ring;
+
+    if (c->failed)
+        return NULL;
+    while (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == SELFCHECK_RING_SIZE) {
+        int status;
+        if (__atomic_load_n(&ring->result, __ATOMIC_ACQUIRE) != SELFCHECK_RUNNING
+            || waitpid(c->pid, &status, WNOHANG) != 0) {
+            c->failed = true;
+            return NULL;
+        }
+        sched_yield();
+    }
+
+    return &ring->slot[ring->head & (SELFCHECK_RING_SIZE - 1)];
+}
+
+static void ring_push(RISCVSelfCheck *c) { __atomic_store_n(&c->ring->head, c->ring->head + 1, __ATOMIC_RELEASE); }
+
+RISCVSelfCheck *riscv_selfcheck_start(RISCVMachine *m) {
+    SelfCheckRing *ring
+        = (SelfCheckRing *)mmap(NULL, sizeof *ring, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    RISCVSelfCheck *c = (RISCVSelfCheck *)mallocz(sizeof *c);
+    c->m              = m;
+    c->ring           = ring;
+    for (int i = 0; i < m->ncpus; ++i) {
+        c->pc[i]     = m->cpu_state[i]->pc;
+        c->icount[i] = m->cpu_state[i]->insn_counter;
+    }
+
+    /* from now on all the writes go through the slow paths, which sum
+     * them, and neither process takes console input nor resize events,
+     * which are polled at step counts that differ between the tiers */
+    m->selfcheck = c;
+    for (int i = 0; i < m->mem_map->n_phys_mem_range; ++i) {
+        PhysMemoryRange *pr = &m->mem_map->phys_mem_range[i];
+        if (!pr->is_ram)
+            continue;
+        for (int j = 0; j < m->ncpus; ++j)
+            riscv_cpu_flush_tlb_write_range_ram(m->cpu_state[j], pr->phys_mem, pr->size);
+    }
+    if (m->common.console)
+        m->common.console->read_data = null_read;
+    m->common.console_dev = NULL;
+
+    // the child must not write out buffered output a second time
+    fflush(NULL);
+
+    pid_t parent = getpid();
+    c->pid       = fork();
+    if (c->pid < 0) {
+        perror("fork");
+        m->selfcheck = NULL;
+        munmap(ring, sizeof *ring);
+        free(c);
+        return NULL;
+    }
+    if (c->pid == 0)
+        reference_loop(m, ring, parent);
+
+    return c;
+}
+
+bool riscv_selfcheck_step(RISCVSelfCheck *c, int hartid) {
+    RISCVCPUState *s      = c->m->cpu_state[hartid];
+    uint64_t       pc     = s->pc;
+    uint64_t       icount = s->insn_counter;
+
+    /* the block goes on while the step retired one instruction and
+     * fell through to the next one */
+    bool block_end = icount - c->icount[hartid] != 1 || (pc != c->pc[hartid] + 2 && pc != c->pc[hartid] + 4);
+
+    c->pc[hartid]     = pc;
+    c->icount[hartid] = icount;
+
+    SelfCheckSlot *e = ring_slot(c);
+    if (!e)
+        return false;
+    e->kind   = block_end ? SELFCHECK_BLOCK : SELFCHECK_STEP;
+    e->hartid = hartid;
+    e->icount = icount;
+    if (block_end)
+        get_state(s, &e->state);
+    ring_push(c);
+
+    return true;
+}
+
+bool riscv_selfcheck_end(RISCVSelfCheck *c) {
+    RISCVMachine *m = c->m;
+
+    /* the last blocks may not have ended */
+    for (int i = 0; i < m->ncpus; ++i) {
+        SelfCheckSlot *e = ring_slot(c);
+        if (!e)
+            break;
+        e->kind   = SELFCHECK_CHECK;
+        e->hartid = i;
+        e->icount = m->cpu_state[i]->insn_counter;
+        get_state(m->cpu_state[i], &e->state);
+        ring_push(c);
+    }
+
+    SelfCheckSlot *e = ring_slot(c);
+    if (e) {
+        e->kind = SELFCHECK_END;
+        ring_push(c);
+    }
+
+    int status;
+    waitpid(c->pid, &status, 0);
+
+    bool ok = __atomic_load_n(&c->ring->result, __ATOMIC_ACQUIRE) == SELFCHECK_MATCH;
+    if (!ok && __atomic_load_n(&c->ring->result, __ATOMIC_ACQUIRE) == SELFCHECK_RUNNING)
+        fprintf(dromajo_stderr, "selfcheck: the reference process exited early\n");
+    else if (ok)
+        fprintf(dromajo_stderr, "selfcheck: no divergence\n");
+
+    m->selfcheck = NULL;
+    munmap(c->ring, sizeof *c->ring);
+    free(c);
+
+    return ok;
+}
@@ -0,0 +1,217 @@
+/*
+ * Live statistics in shared memory for external monitors
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_telemetry.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "LiveCacheCore.h"
+#include "cutils.h"
+#include "dromajo.h"
+#include "riscv_machine.h"
+
+static_assert(RISCV_TELEMETRY_MAX_HARTS == MAX_CPUS, "a telemetry page slot per hart");
+
+struct RISCVTelemetry {
+    RISCVMachine *      m;
+    RISCVTelemetryPage *page;
+    char *              name;
+    uint64_t            interval;
+    uint64_t            left; /* steps before the next update */
+
+    /* at the start and the previous update, for the MIPS */
+    uint64_t start_insns;
+    uint64_t last_insns;
+    uint64_t last_ns;
+
+    /* per hart, the privilege split up to since and the traps */
+    uint64_t since[MAX_CPUS];
+    uint64_t insns_by_priv[MAX_CPUS][4];
+    uint64_t exceptions[MAX_CPUS];
+    uint64_t interrupts[MAX_CPUS];
+};
+
+/* Removed at exit when the run does not get to virt_machine_end */
+static RISCVTelemetry *telemetry_live;
+
+static void telemetry_atexit(void) {
+    /* forked children see the page but do not own the name */
+    if (telemetry_live && telemetry_live->page->pid == (uint32_t)getpid())
+        riscv_telemetry_end(telemetry_live);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t total_insns(RISCVMachine *m) {
+    uint64_t n = 0;
+    for (int i = 0; i < m->ncpus; ++i) n += m->cpu_state[i]->insn_counter;
+    return n;
+}
+
+static void publish(RISCVTelemetry *t, bool running) {
+    RISCVMachine *      m    = t->m;
+    RISCVTelemetryPage *page = t->page;
+    uint64_t            now  = now_ns();
+    uint64_t            n    = total_insns(m);
+
+    /* odd while the values change */
+    __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    page->running   = running;
+    page->updates++;
+    page->update_ns = now;
+    /* the final update has the average of the run */
+    if (!running && now > page->start_ns)
+        page->mips = (double)(n - t->start_insns) * 1000 / (now - page->start_ns);
+    else if (now > t->last_ns)
+        page->mips = (double)(n - t->last_insns) * 1000 / (now - t->last_ns);
+
+    std::vector<Simpoint> &sp = m->common.simpoints;
+    page->simpoint            = m->common.simpoint_next < sp.size() ? (int64_t)sp[m->common.simpoint_next].id : -1;
+    page->simpoints_done      = m->common.simpoint_next;
+    page->simpoints_total     = sp.size();
+#ifdef LIVECACHE
+    if (m->llc) {
+        page->llc_accesses = m->llc->getAccesses();
+        page->llc_misses   = m->llc->getMisses();
+    }
+#endif
+
+    for (int i = 0; i < m->ncpus; ++i) {
+        RISCVCPUState *     s = m->cpu_state[i];
+        RISCVTelemetryHart *h = &page->harts[i];
+
+        h->insns = s->insn_counter;
+        for (int p = 0; p < 4; ++p) h->insns_by_priv[p] = t->insns_by_priv[i][p];
+        h->insns_by_priv[s->priv] += s->insn_counter - t->since[i];
+        h->exceptions = t->exceptions[i];
+        h->interrupts = t->interrupts[i];
+        h->pc         = s->pc;
+        h->priv       = s->priv;
+        /* a cache of size 0 is not modelled */
+        if (s->timing && s->timing->icache) {
+            h->icache_accesses = s->timing->icache->getAccesses();
+            h->icache_misses   = s->timing->icache->getMisses();
+        }
+        if (s->timing && s->timing->dcache) {
+            h->dcache_accesses = s->timing->dcache->getAccesses();
+            h->dcache_misses   = s->timing->dcache->getMisses();
+        }
+    }
+
+    __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+
+    t->last_insns = n;
+    t->last_ns    = now;
+}
+
+RISCVTelemetry *riscv_telemetry_init(RISCVMachine *m, const char *name, uint64_t interval) {
+    char *path = (char *)malloc(strlen(name) + 2);
+    sprintf(path, "%s%s", strchr(name, '/') ? "" : "/", name);
+
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(RISCVTelemetryPage)) < 0) {
+        vm_error("could not create the shared memory object %s for the telemetry\n", path);
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(path);
+        }
+        free(path);
+        return NULL;
+    }
+    void *page = mmap(NULL, sizeof(RISCVTelemetryPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        vm_error("could not map the telemetry page %s\n", path);
+        shm_unlink(path);
+        free(path);
+        return NULL;
+    }
+
+    RISCVTelemetry *t = (RISCVTelemetry *)mallocz(sizeof *t);
+    t->m              = m;
+    t->page           = (RISCVTelemetryPage *)page;
+    t->name           = path;
+    t->interval       = interval;
+    t->left           = interval;
+    t->start_insns    = total_insns(m);
+    t->last_insns     = t->start_insns;
+    t->last_ns        = now_ns();
+    for (int i = 0; i < m->ncpus; ++i) t->since[i] = m->cpu_state[i]->insn_counter;
+
+    /* the object is new and zeroed, nobody reads it before magic is set */
+    t->page->version  = RISCV_TELEMETRY_VERSION;
+    t->page->size     = sizeof(RISCVTelemetryPage);
+    t->page->pid      = getpid();
+    t->page->nharts   = m->ncpus;
+    t->page->start_ns = t->last_ns;
+    publish(t, true);
+    __atomic_store_n(&t->page->magic, RISCV_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+
+    static bool atexit_done;
+    if (!atexit_done) {
+        atexit(telemetry_atexit);
+        atexit_done = true;
+    }
+    telemetry_live = t;
+
+    return t;
+}
+
+void riscv_telemetry_end(RISCVTelemetry *t) {
+    if (telemetry_live == t)
+        telemetry_live = NULL;
+
+    publish(t, false);
+    munmap(t->page, sizeof(RISCVTelemetryPage));
+    shm_unlink(t->name);
+    free(t->name);
+    free(t);
+}
+
+void riscv_telemetry_step(RISCVTelemetry *t) {
+    if (--t->left)
+        return;
+    t->left = t->interval;
+    publish(t, true);
+}
+
+void riscv_telemetry_priv(RISCVCPUState *s) {
+    RISCVTelemetry *t = s->machine->telemetry;
+    int             i = s->mhartid;
+
+    t->insns_by_priv[i][s->priv] += s->insn_counter - t->since[i];
+    t->since[i] = s->insn_counter;
+}
+
+void riscv_telemetry_trap(RISCVCPUState *s, uint64_t cause) {
+    RISCVTelemetry *t = s->machine->telemetry;
+
+    if (cause & CAUSE_INTERRUPT)
+        t->interrupts[s->mhartid]++;
+    else
+        t->exceptions[s->mhartid]++;
+}
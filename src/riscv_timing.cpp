@@ -0,0 +1,191 @@
+/*
+ * Approximate timing model
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_timing.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "LiveCacheCore.h"
+#include "cutils.h"
+#include "dromajo.h"
+#include "riscv_machine.h"
+
+static const char *timing_class_name[TIMING_CLASS_COUNT] = {
+    "alu", "mul", "div", "load", "store", "amo", "fp", "fdiv", "branch", "system",
+};
+
+void riscv_timing_set_defaults(RISCVTimingParams *p) {
+    p->latency[TIMING_CLASS_ALU]    = 1;
+    p->latency[TIMING_CLASS_MUL]    = 3;
+    p->latency[TIMING_CLASS_DIV]    = 20;
+    p->latency[TIMING_CLASS_LOAD]   = 2;
+    p->latency[TIMING_CLASS_STORE]  = 1;
+    p->latency[TIMING_CLASS_AMO]    = 5;
+    p->latency[TIMING_CLASS_FP]     = 4;
+    p->latency[TIMING_CLASS_FDIV]   = 20;
+    p->latency[TIMING_CLASS_BRANCH] = 1;
+    p->latency[TIMING_CLASS_SYSTEM] = 5;
+    p->icache_size                  = 32 * 1024;
+    p->dcache_size                  = 32 * 1024;
+    p->miss_penalty                 = 30;
+    p->mispredict_penalty           = 8;
+}
+
+RISCVTiming *riscv_timing_init(const RISCVTimingParams *p) {
+    RISCVTiming *t = (RISCVTiming *)mallocz(sizeof *t);
+
+    t->p = *p;
+    if (t->p.icache_size > 0)
+        t->icache = new LiveCache("IL1", t->p.icache_size);
+    if (t->p.dcache_size > 0)
+        t->dcache = new LiveCache("DL1", t->p.dcache_size);
+
+    t->last_fetch_line = ~(uint64_t)0;
+
+    return t;
+}
+
+void riscv_timing_end(RISCVTiming *t, int hartid) {
+    uint64_t n_insn = 0;
+    for (int i = 0; i < TIMING_CLASS_COUNT; ++i) n_insn += t->n_insn[i];
+
+    fprintf(dromajo_stderr,
+            "timing hart %d: insns %" PRIu64 " cycles %" PRIu64 " IPC %.3f\n",
+            hartid,
+            n_insn,
+            t->n_cycles,
+            t->n_cycles ? (double)n_insn / t->n_cycles : 0.0);
+    fprintf(dromajo_stderr, "timing hart %d:", hartid);
+    for (int i = 0; i < TIMING_CLASS_COUNT; ++i) fprintf(dromajo_stderr, " %s %" PRIu64, timing_class_name[i], t->n_insn[i]);
+    fprintf(dromajo_stderr,
+            "\ntiming hart %d: imiss %" PRIu64 " dmiss %" PRIu64 " branches %" PRIu64 " mispredicts %" PRIu64 "\n",
+            hartid,
+            t->n_imiss,
+            t->n_dmiss,
+            t->n_branch,
+            t->n_mispredict);
+
+    delete t->icache;
+    delete t->dcache;
+    free(t);
+}
+
+static inline void timing_add(RISCVTiming *t, int cycles) {
+    t->stall += cycles;
+    t->n_cycles += cycles;
+}
+
+static RISCVTimingClass timing_classify(uint32_t insn) {
+    int funct3;
+
+    switch (insn & 3) {
+        case 0: /* C0 */
+            funct3 = (insn >> 13) & 7;
+            if (funct3 == 0)
+                return TIMING_CLASS_ALU;
+            return funct3 < 4 ? TIMING_CLASS_LOAD : TIMING_CLASS_STORE;
+        case 1: /* C1 */
+            funct3 = (insn >> 13) & 7;
+            return funct3 >= 5 ? TIMING_CLASS_BRANCH : TIMING_CLASS_ALU;
+        case 2: /* C2 */
+            funct3 = (insn >> 13) & 7;
+            if (funct3 >= 1 && funct3 <= 3)
+                return TIMING_CLASS_LOAD;
+            if (funct3 >= 5)
+                return TIMING_CLASS_STORE;
+            if (funct3 == 4 && ((insn >> 2) & 0x1f) == 0)
+                return TIMING_CLASS_BRANCH; /* c.jr/c.jalr/c.ebreak */
+            return TIMING_CLASS_ALU;
+        default: break;
+    }
+
+    switch (insn & 0x7f) {
+        case 0x03:
+        case 0x07: return TIMING_CLASS_LOAD;
+        case 0x23:
+        case 0x27: return TIMING_CLASS_STORE;
+        case 0x2f: return TIMING_CLASS_AMO;
+        case 0x33:
+        case 0x3b:
+            if ((insn >> 25) == 1)
+                return ((insn >> 12) & 7) < 4 ? TIMING_CLASS_MUL : TIMING_CLASS_DIV;
+            return TIMING_CLASS_ALU;
+        case 0x43:
+        case 0x47:
+        case 0x4b:
+        case 0x4f: return TIMING_CLASS_FP;
+        case 0x53:
+            switch (insn >> 27) {
+                case 0x03: /* fdiv */
+                case 0x0b: /* fsqrt */ return TIMING_CLASS_FDIV;
+                default: return TIMING_CLASS_FP;
+            }
+        case 0x63:
+        case 0x67:
+        case 0x6f: return TIMING_CLASS_BRANCH;
+        case 0x0f:
+        case 0x73: return TIMING_CLASS_SYSTEM;
+        default: return TIMING_CLASS_ALU;
+    }
+}
+
+void riscv_timing_insn(RISCVTiming *t, uint64_t pc, uint32_t insn) {
+    RISCVTimingClass c = timing_classify(insn);
+
+    t->n_insn[c]++;
+    t->n_cycles++;
+    if (t->p.latency[c] > 1)
+        timing_add(t, t->p.latency[c] - 1);
+
+    /* The I-cache is looked up once per line change; it is indexed by
+     * the virtual PC which is good enough for an estimate. */
+    uint64_t line = pc >> 6;
+    if (t->icache && line != t->last_fetch_line) {
+        t->last_fetch_line = line;
+        if (!t->icache->read(pc)) {
+            t->n_imiss++;
+            timing_add(t, t->p.miss_penalty);
+        }
+    }
+}
+
+void riscv_timing_dmem(RISCVTiming *t, uint64_t paddr, bool is_write) {
+    if (!t->dcache)
+        return;
+
+    bool hit = is_write ? t->dcache->write(paddr) : t->dcache->read(paddr);
+    if (!hit) {
+        t->n_dmiss++;
+        timing_add(t, t->p.miss_penalty);
+    }
+}
+
+void riscv_timing_dmem_inval(RISCVTiming *t, uint64_t paddr) {
+    if (t->dcache)
+        t->dcache->invalidate(paddr);
+}
+
+void riscv_timing_ctf(RISCVTiming *t, bool mispredict) {
+    t->n_branch++;
+    if (mispredict) {
+        t->n_mispredict++;
+        timing_add(t, t->p.mispredict_penalty);
+    }
+}
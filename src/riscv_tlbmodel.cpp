@@ -0,0 +1,279 @@
+/*
+ * Target TLB model
+ *
+ * Copyright (C) 2018,2019, Esperanto Technologies Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "riscv_tlbmodel.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "dromajo.h"
+#include "riscv_machine.h"
+
+/* 4K, Svnapot 64K, 2M, 1G */
+static const int page_shifts[] = {12, 16, 21, 30};
+
+class TLBArray {
+    struct Entry {
+        uint64_t vpn; /* vaddr >> shift */
+        uint64_t stamp;
+        uint32_t asid;
+        uint8_t  shift;
+        bool     global;
+        bool     valid;
+    };
+
+    std::vector<Entry> entries;
+    int                ways;
+    uint64_t           set_mask;
+    uint64_t           clock;
+
+    Entry *set(uint64_t vpn) { return &entries[(vpn & set_mask) * ways]; }
+
+  public:
+    uint64_t n_access;
+    uint64_t n_miss;
+
+    TLBArray(int n, int w)
+        : entries(n, Entry{0, 0, 0, 0, false, false}), ways(w), set_mask(n / w - 1), clock(0), n_access(0), n_miss(0) {}
+
+    /* *global, if given, is set to the G bit of the entry hit */
+    bool lookup(uint64_t vaddr, uint32_t asid, bool superpages, bool *global = NULL) {
+        for (int i = 0; i < (superpages ? 4 : 1); ++i) {
+            uint64_t vpn = vaddr >> page_shifts[i];
+            Entry *  e   = set(vpn);
+            for (int w = 0; w < ways; ++w)
+                if (e[w].valid && e[w].shift == page_shifts[i] && e[w].vpn == vpn && (e[w].global || e[w].asid == asid)) {
+                    e[w].stamp = ++clock;
+                    if (global)
+                        *global = e[w].global;
+                    return true;
+                }
+        }
+        return false;
+    }
+
+    void fill(uint64_t vaddr, uint32_t asid, int shift, bool global) {
+        uint64_t vpn = vaddr >> shift;
+        Entry *  e = set(vpn), *victim = e;
+        for (int w = 0; w < ways; ++w) {
+            if (!e[w].valid) {
+                victim = &e[w];
+                break;
+            }
+            if (e[w].stamp < victim->stamp)
+                victim = &e[w];
+        }
+        *victim = Entry{vpn, ++clock, asid, (uint8_t)shift, global, true};
+    }
+
+    void flush(bool has_vaddr, uint64_t vaddr, bool has_asid, uint32_t asid) {
+        for (auto &e : entries) {
+            if (has_vaddr && e.vpn != vaddr >> e.shift)
+                continue;
+            if (has_asid && (e.global || e.asid != asid))
+                continue;
+            e.valid = false;
+        }
+    }
+};
+
+struct ASIDStat {
+    uint64_t access[2];
+    uint64_t miss[2]; /* L1 */
+    uint64_t walks;
+    uint64_t walk_refs;
+};
+
+struct RISCVTLBModel {
+    RISCVTLBModelParams p;
+    TLBArray *          l1[2]; /* DTLB, ITLB */
+    TLBArray *          l2;
+
+    /* The most recently used page of each L1 is a guaranteed hit */
+    uint64_t last_page[2];
+    uint32_t last_asid[2];
+
+    std::map<uint32_t, ASIDStat> asid_stats;
+    uint32_t                     cur_asid;
+    ASIDStat *                   cur_stat;
+    uint64_t                     n_walks;
+    uint64_t                     n_walk_refs;
+};
+
+static ASIDStat &asid_stat(RISCVTLBModel *tm, uint32_t asid) {
+    if (!tm->cur_stat || tm->cur_asid != asid) {
+        tm->cur_asid = asid;
+        tm->cur_stat = &tm->asid_stats[asid];
+    }
+    return *tm->cur_stat;
+}
+
+static bool tlb_geometry_ok(int entries, int ways) {
+    return ways > 0 && entries > 0 && entries % ways == 0 && ((entries / ways) & (entries / ways - 1)) == 0;
+}
+
+void riscv_tlbmodel_set_defaults(RISCVTLBModelParams *p) {
+    p->itlb_entries  = 32;
+    p->itlb_ways     = 32;
+    p->dtlb_entries  = 32;
+    p->dtlb_ways     = 32;
+    p->l2tlb_entries = 1024;
+    p->l2tlb_ways    = 4;
+    p->superpages    = true;
+    p->asid          = true;
+    p->walk_to_cache = false;
+}
+
+RISCVTLBModel *riscv_tlbmodel_init(const RISCVTLBModelParams *p) {
+    if (!tlb_geometry_ok(p->itlb_entries, p->itlb_ways) || !tlb_geometry_ok(p->dtlb_entries, p->dtlb_ways)
+        || (p->l2tlb_entries && !tlb_geometry_ok(p->l2tlb_entries, p->l2tlb_ways))) {
+        vm_error("tlb: entries/ways must be a power of 2\n");
+        return NULL;
+    }
+
+    RISCVTLBModel *tm = new RISCVTLBModel();
+    tm->p             = *p;
+    tm->l1[0]         = new TLBArray(p->dtlb_entries, p->dtlb_ways);
+    tm->l1[1]         = new TLBArray(p->itlb_entries, p->itlb_ways);
+    if (p->l2tlb_entries)
+        tm->l2 = new TLBArray(p->l2tlb_entries, p->l2tlb_ways);
+    tm->last_page[0] = tm->last_page[1] = ~(uint64_t)0;
+
+    return tm;
+}
+
+static double pct(uint64_t n, uint64_t d) { return d ? 100.0 * n / d : 0.0; }
+
+void riscv_tlbmodel_end(RISCVTLBModel *tm, int hartid) {
+    fprintf(dromajo_stderr,
+            "tlb hart %d: itlb %" PRIu64 "/%" PRIu64 " (%.2f%%) dtlb %" PRIu64 "/%" PRIu64 " (%.2f%%)",
+            hartid,
+            tm->l1[1]->n_miss,
+            tm->l1[1]->n_access,
+            pct(tm->l1[1]->n_miss, tm->l1[1]->n_access),
+            tm->l1[0]->n_miss,
+            tm->l1[0]->n_access,
+            pct(tm->l1[0]->n_miss, tm->l1[0]->n_access));
+    if (tm->l2)
+        fprintf(dromajo_stderr,
+                " l2tlb %" PRIu64 "/%" PRIu64 " (%.2f%%)",
+                tm->l2->n_miss,
+                tm->l2->n_access,
+                pct(tm->l2->n_miss, tm->l2->n_access));
+    fprintf(dromajo_stderr, " walks %" PRIu64 " pte reads %" PRIu64 "\n", tm->n_walks, tm->n_walk_refs);
+
+    for (auto &e : tm->asid_stats) {
+        const ASIDStat &a = e.second;
+        fprintf(dromajo_stderr,
+                "tlb hart %d   asid %5u: itlb %" PRIu64 "/%" PRIu64 " (%.2f%%) dtlb %" PRIu64 "/%" PRIu64
+                " (%.2f%%) walks %" PRIu64 " pte reads %" PRIu64 "\n",
+                hartid,
+                e.first,
+                a.miss[1],
+                a.access[1],
+                pct(a.miss[1], a.access[1]),
+                a.miss[0],
+                a.access[0],
+                pct(a.miss[0], a.access[0]),
+                a.walks,
+                a.walk_refs);
+    }
+
+    delete tm->l1[0];
+    delete tm->l1[1];
+    delete tm->l2;
+    delete tm;
+}
+
+bool riscv_tlbmodel_lookup(RISCVTLBModel *tm, bool is_code, uint64_t vaddr, uint32_t asid) {
+    TLBArray *l1   = tm->l1[is_code];
+    ASIDStat &st   = asid_stat(tm, asid);
+    uint64_t  page = vaddr >> 12;
+
+    l1->n_access++;
+    st.access[is_code]++;
+
+    if (page == tm->last_page[is_code] && asid == tm->last_asid[is_code])
+        return true;
+
+    if (l1->lookup(vaddr, asid, tm->p.superpages)) {
+        tm->last_page[is_code] = page;
+        tm->last_asid[is_code] = asid;
+        return true;
+    }
+
+    l1->n_miss++;
+    st.miss[is_code]++;
+
+    if (tm->l2) {
+        tm->l2->n_access++;
+        bool global;
+        if (tm->l2->lookup(vaddr, asid, tm->p.superpages, &global)) {
+            /* the L2 hit refills the L1 with a 4K entry, global if it is */
+            l1->fill(vaddr, asid, 12, global);
+            tm->last_page[is_code] = page;
+            tm->last_asid[is_code] = asid;
+            return true;
+        }
+        tm->l2->n_miss++;
+    }
+
+    return false;
+}
+
+void riscv_tlbmodel_fill(RISCVTLBModel *tm, bool is_code, uint64_t vaddr, uint32_t asid, int page_shift, bool global,
+                         int walk_refs) {
+    ASIDStat &st = asid_stat(tm, asid);
+
+    st.walks++;
+    st.walk_refs += walk_refs;
+    tm->n_walks++;
+    tm->n_walk_refs += walk_refs;
+
+    if (!tm->p.superpages)
+        page_shift = 12;
+    if (!tm->p.asid)
+        global = false;
+
+    tm->l1[is_code]->fill(vaddr, asid, page_shift, global);
+    if (tm->l2)
+        tm->l2->fill(vaddr, asid, page_shift, global);
+    tm->last_page[is_code] = vaddr >> 12;
+    tm->last_asid[is_code] = asid;
+}
+
+void riscv_tlbmodel_flush(RISCVTLBModel *tm, bool has_vaddr, uint64_t vaddr, bool has_asid, uint32_t asid) {
+    if (!tm->p.asid)
+        has_asid = false;
+
+    tm->l1[0]->flush(has_vaddr, vaddr, has_asid, asid);
+    tm->l1[1]->flush(has_vaddr, vaddr, has_asid, asid);
+    if (tm->l2)
+        tm->l2->flush(has_vaddr, vaddr, has_asid, asid);
+    tm->last_page[0] = tm->last_page[1] = ~(uint64_t)0;
+}
+
+void riscv_tlbmodel_set_satp(RISCVTLBModel *tm) {
+    if (!tm->p.asid)
+        riscv_tlbmodel_flush(tm, false, 0, false, 0);
+}
+
+bool riscv_tlbmodel_walk_to_cache(const RISCVTLBModel *tm) { return tm->p.walk_to_cache; }
@@ -360,6 +360,8 @@ static int virtio_memcpy_to_ram(VIRTIODevice *s, virtio_phys_addr_t addr, const
         if (!ptr)
             return -1;
         memcpy(ptr, buf, l);
+        if (s->mem_map->ram_written)
+            s->mem_map->ram_written(s->mem_map->opaque, ptr, l);
         addr += l;
         buf += l;
         count -= l;
@@ -1071,17 +1073,64 @@ typedef struct VIRTIOConsoleDevice {
     CharacterDevice *cs;
 } VIRTIOConsoleDevice;
 
+#define CONSOLE_MAX_IOV 64
+
+static void console_flush_iov(CharacterDevice *cs, const struct iovec *iov, int iovcnt) {
+    if (cs->writev_data) {
+        cs->writev_data(cs->opaque, iov, iovcnt);
+        return;
+    }
+    for (int i = 0; i < iovcnt; ++i) cs->write_data(cs->opaque, (const uint8_t *)iov[i].iov_base, iov[i].iov_len);
+}
+
+/* Sends the device-readable part of the chain to the console without
+ * copying it, one segment per contiguous piece of guest RAM */
+static void virtio_console_send(VIRTIODevice *s, CharacterDevice *cs, int queue_idx, int desc_idx) {
+    struct iovec iov[CONSOLE_MAX_IOV];
+    int          iovcnt = 0;
+    VIRTIODesc   desc;
+
+    for (;;) {
+        if (get_desc(s, &desc, queue_idx, desc_idx) || (desc.flags & VRING_DESC_F_WRITE))
+            break;
+
+        virtio_phys_addr_t addr  = desc.addr;
+        int                count = desc.len;
+        while (count > 0) {
+            int      l   = min_int(count, VIRTIO_PAGE_SIZE - (addr & (VIRTIO_PAGE_SIZE - 1)));
+            uint8_t *ptr = s->get_ram_ptr(s, addr);
+            if (!ptr)
+                goto done;
+            if (iovcnt && (uint8_t *)iov[iovcnt - 1].iov_base + iov[iovcnt - 1].iov_len == ptr) {
+                iov[iovcnt - 1].iov_len += l;
+            } else {
+                if (iovcnt == CONSOLE_MAX_IOV) {
+                    console_flush_iov(cs, iov, iovcnt);
+                    iovcnt = 0;
+                }
+                iov[iovcnt].iov_base = ptr;
+                iov[iovcnt].iov_len  = l;
+                iovcnt++;
+            }
+            addr += l;
+            count -= l;
+        }
+
+        if (!(desc.flags & VRING_DESC_F_NEXT))
+            break;
+        desc_idx = desc.next;
+    }
+done:
+    if (iovcnt)
+        console_flush_iov(cs, iov, iovcnt);
+}
+
 static int virtio_console_recv_request(VIRTIODevice *s, int queue_idx, int desc_idx, int read_size, int write_size) {
     VIRTIOConsoleDevice *s1 = (VIRTIOConsoleDevice *)s;
-    CharacterDevice *    cs = s1->cs;
-    uint8_t *            buf;
 
     if (queue_idx == 1) {
         /* send to console */
-        buf = (uint8_t *)malloc(read_size);
-        memcpy_from_queue(s, buf, queue_idx, desc_idx, 0, read_size);
-        cs->write_data(cs->opaque, buf, read_size);
-        free(buf);
+        virtio_console_send(s, s1->cs, queue_idx, desc_idx);
         virtio_consume_desc(s, queue_idx, desc_idx, 0);
     }
     return 0;
@@ -1133,6 +1182,22 @@ int virtio_console_write_data(VIRTIODevice *s, const uint8_t *buf, int buf_len)
     return buf_len;
 }
 
+void virtio_console_poll(VIRTIODevice *s) {
+    CharacterDevice *cs = ((VIRTIOConsoleDevice *)s)->cs;
+    uint8_t          buf[4096];
+
+    /* one read per receive buffer, until either runs out */
+    for (;;) {
+        int len = min_int(virtio_console_get_write_len(s), sizeof buf);
+        if (len <= 0)
+            break;
+        len = cs->read_data(cs->opaque, buf, len);
+        if (len <= 0)
+            break;
+        virtio_console_write_data(s, buf, len);
+    }
+}
+
 /* send a resize event */
 void virtio_console_resize_event(VIRTIODevice *s, int width, int height) {
     /* indicate the console size */